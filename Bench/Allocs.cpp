@@ -0,0 +1,30 @@
+// Counts heap allocations for the benchmarks by replacing the global operator new
+// the array and nothrow forms fall back to this one, so everything the client allocates is seen
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> count(0);
+
+uint64_t allocations()
+{
+	return count.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+	count.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
@@ -0,0 +1,98 @@
+// Minimal timing harness shared by the benchmarks
+// benchmarks are built next to the client sources along with Allocs.cpp, e.g.
+// g++ -O2 -I../Client CipherBench.cpp Allocs.cpp ../Client/Cipher.cpp -lcryptopp
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// operator new calls so far, counted by the replacement in Allocs.cpp
+uint64_t allocations();
+
+// runs fn passes times and reports the best pass as GB/s over bytes, the best pass being the least disturbed one
+// allocations are averaged over the passes
+inline double measure(const std::string& name, uint64_t bytes, const std::function<void()>& fn, int passes = 5)
+{
+	double best = 0;
+	fn(); // warm up caches and page in the buffers
+	uint64_t allocs = allocations();
+	for (int i = 0; i < passes; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+		double rate = bytes / took.count() / 1e9;
+		if (rate > best) best = rate;
+	}
+	allocs = allocations() - allocs;
+	std::cout << std::left << std::setw(24) << name << std::fixed << std::setprecision(2) << best << " GB/s  "
+		<< (double)allocs / passes << " allocs" << std::endl;
+	return best;
+}
+
+// for operations much shorter than a pass: fn is one operation, called as often as fits in about 100ms per pass
+// reports the best pass per operation, MB/s when an operation covers bytes, and allocations per operation
+inline double measureOps(const std::string& name, uint64_t bytes, const std::function<void()>& fn, int passes = 5)
+{
+	auto start = std::chrono::steady_clock::now();
+	fn(); // warm up, and a first guess at how long an operation takes
+	std::chrono::duration<double> once = std::chrono::steady_clock::now() - start;
+	uint64_t ops = once.count() > 0.1 ? 1 : (uint64_t)(0.1 / std::max(once.count(), 1e-9));
+	double best = 0;
+	uint64_t allocs = allocations();
+	for (int i = 0; i < passes; i++)
+	{
+		start = std::chrono::steady_clock::now();
+		for (uint64_t j = 0; j < ops; j++)
+			fn();
+		std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+		double each = took.count() / ops;
+		if (!best or each < best) best = each;
+	}
+	allocs = allocations() - allocs;
+	std::cout << std::left << std::setw(32) << name << std::fixed << std::setprecision(0) << std::right << std::setw(12) << best * 1e9 << " ns/op";
+	if (bytes) std::cout << std::setprecision(1) << std::setw(10) << bytes / best / 1e6 << " MB/s";
+	std::cout << std::setprecision(2) << std::setw(10) << (double)allocs / (ops * passes) << " allocs/op" << std::left << std::endl;
+	return best;
+}
+
+// keeps the compiler from dropping work whose result is never read
+inline void consume(const void* p)
+{
+	static const void* volatile sink;
+	sink = p;
+}
+
+// writes size bytes that vary enough for checksums, ciphers and deflate not to be helped by them
+inline void writeSample(const std::string& path, size_t size)
+{
+	std::vector<char> data(size);
+	uint32_t x = 2463534242u;
+	for (size_t i = 0; i < size; i++)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		data[i] = (char)x;
+	}
+	std::ofstream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
+	out.write(data.data(), data.size());
+}
+
+// silences std::cout while in scope - the client reports every step there
+struct Quiet
+{
+	std::streambuf* old;
+	Quiet() : old(std::cout.rdbuf(NULL)) {}
+	~Quiet()
+	{
+		std::cout.rdbuf(old);
+		std::cout.clear();
+	}
+};
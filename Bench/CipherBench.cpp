@@ -0,0 +1,98 @@
+// Compares the file encryption paths of the client
+// usage: cipherbench [megabytes]
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "Bench.hpp"
+#include "Cipher.hpp"
+#include "filters.h"
+
+#define STREAM_CHUNK 262144 // plaintext per call in the chunked cases, what CBC uploads used before the pipeline
+
+int main(int argc, char* argv[])
+{
+	size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+	std::vector<char> in(size), out(size + CryptoPP::AES::BLOCKSIZE);
+	for (size_t i = 0; i < size; i++)
+		in[i] = (char)(i * 131);
+	CryptoPP::SecByteBlock key(AES_SIZE);
+	memset(key.data(), 0x5a, AES_SIZE);
+	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };
+	const CryptoPP::byte* src = reinterpret_cast<const CryptoPP::byte*>(in.data());
+	CryptoPP::byte* dst = reinterpret_cast<CryptoPP::byte*>(out.data());
+
+	// the original loop: one block pumped through the filter and flushed at a time
+	measure("cbc filter, 16b puts", size, [&]()
+	{
+		CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption e;
+		e.SetKeyWithIV(key, key.size(), iv);
+		CryptoPP::StreamTransformationFilter f(e, new CryptoPP::ArraySink(dst, out.size()));
+		for (size_t i = 0; i < size; i += CryptoPP::AES::BLOCKSIZE)
+		{
+			f.Put(src + i, CryptoPP::AES::BLOCKSIZE);
+			f.Flush(false);
+		}
+		f.MessageEnd();
+		consume(dst);
+	});
+	// the filter chain fed STREAM_CHUNK at a time
+	measure("cbc filter, chunked", size, [&]()
+	{
+		CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption e;
+		e.SetKeyWithIV(key, key.size(), iv);
+		CryptoPP::StreamTransformationFilter f(e, new CryptoPP::ArraySink(dst, out.size()));
+		for (size_t i = 0; i < size; i += STREAM_CHUNK)
+			f.Put(src + i, std::min((size_t)STREAM_CHUNK, size - i));
+		f.MessageEnd();
+		consume(dst);
+	});
+	// what encryptFile does now
+	measure("cbc bulk", size, [&]()
+	{
+		BulkCBC engine(key, iv);
+		size_t whole = size - size % CryptoPP::AES::BLOCKSIZE;
+		for (size_t i = 0; i < whole; i += STREAM_CHUNK)
+			engine.process(in.data() + i, out.data() + i, std::min((size_t)STREAM_CHUNK, whole - i));
+		engine.finish(in.data() + whole, size - whole, out.data() + whole);
+		consume(dst);
+	});
+	// independent CBC streams interleaved on one core, as MultiCBC runs concurrent uploads - MB/s over all lanes
+	if (MultiCBC::available())
+	{
+		std::vector<std::vector<char>> lanes(MULTI_CBC_LANES, std::vector<char>(size - size % CryptoPP::AES::BLOCKSIZE));
+		for (unsigned count : { 1u, 2u, 4u, (unsigned)MULTI_CBC_LANES })
+		{
+			MultiCBC::Stream streams[MULTI_CBC_LANES];
+			MultiCBC::Stream* lane[MULTI_CBC_LANES];
+			const char* from[MULTI_CBC_LANES];
+			char* to[MULTI_CBC_LANES];
+			for (unsigned l = 0; l < count; l++)
+			{
+				MultiCBC::init(streams[l], key, iv);
+				lane[l] = &streams[l];
+				from[l] = in.data();
+				to[l] = lanes[l].data();
+			}
+			measure("cbc multi x" + std::to_string(count), (size - size % CryptoPP::AES::BLOCKSIZE) * count, [&]()
+			{
+				MultiCBC::encrypt(lane, from, to, size / CryptoPP::AES::BLOCKSIZE, count);
+				consume(to[0]);
+			});
+		}
+	}
+	// CTR from version 4 on, single threaded and on every core
+	CryptoPP::byte nonce[NONCE_SIZE] = { 0 };
+	unsigned cores = std::thread::hardware_concurrency();
+	for (unsigned threads : { 1u, cores ? cores : 1u })
+	{
+		ParallelCTR engine(key, nonce, threads);
+		measure("ctr x" + std::to_string(threads), size, [&]()
+		{
+			engine.process(0, in.data(), out.data(), size);
+			consume(dst);
+		});
+	}
+	return 0;
+}
@@ -0,0 +1,173 @@
+// Times the client's hot paths one at a time - the per file ones across a range of file sizes
+// usage: hotpathbench [largest file in megabytes]
+// runs in a scratch directory under the system temp directory, holding its own transfer.info, me.info and sample files
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "Bench.hpp"
+#include "Cipher.hpp"
+#include "Cksum.hpp"
+#include "KeyPool.hpp"
+#include "MappedFile.hpp"
+#include "Request.hpp"
+#include "SendEngine.hpp"
+#include "Session.hpp"
+#include "filters.h"
+#include "osrng.h"
+
+uint32_t memcrc(MappedFile& fin); // Protocol.cpp
+void encryptFile(CryptoPP::SecByteBlock key, MappedFile& fin, SendEngine* sender, Cksum& crc); // Protocol.cpp
+
+std::string sizeLabel(size_t size)
+{
+	return size >= 1 << 20 ? std::to_string(size >> 20) + "Mb" : std::to_string(size >> 10) + "Kb";
+}
+
+int main(int argc, char* argv[])
+{
+	size_t largest = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / "hotpathbench";
+	std::filesystem::create_directories(dir);
+	std::filesystem::current_path(dir);
+	std::filesystem::remove("me.info");
+	std::filesystem::remove("ticket.info");
+	std::filesystem::remove(KEY_CACHE_FILE);
+	{
+		std::ofstream transfer("transfer.info", std::ios::out | std::ios::trunc);
+		transfer << "127.0.0.1:1234\nbench\nsample4096\n";
+	}
+	{
+		Quiet quiet;
+		ConfigHandler provision; // writes me.info and the key cache back on the way out, as after a registration
+		provision.setUID(std::string(UID_SIZE, '\x5a'));
+		provision.setKey(KeyPool::generate());
+		provision.keySuccess();
+	}
+
+	CryptoPP::SecByteBlock key(AES_SIZE);
+	memset(key.data(), 0x5a, AES_SIZE);
+	// encryptFile sends through the session's engine, connected to a local socket that reads and drops everything
+	ConfigHandler conf;
+	Session s(&conf, NULL, NULL, 0);
+	boost::asio::io_context sinkContext;
+	boost::asio::ip::tcp::acceptor acceptor(sinkContext, boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	boost::asio::ip::tcp::socket sink(sinkContext);
+	s.getSocket()->connect(acceptor.local_endpoint());
+	acceptor.accept(sink);
+	s.getSender()->configure();
+	std::thread discard([&sink]()
+	{
+		std::vector<char> buffer(1 << 20);
+		boost::system::error_code ec;
+		while (!ec) sink.read_some(boost::asio::buffer(buffer), ec);
+	});
+	for (size_t size = 4096; size <= largest; size *= 16)
+	{
+		std::string path = "sample" + std::to_string(size);
+		writeSample(path, size);
+		measureOps("memcrc " + sizeLabel(size), size, [&]()
+		{
+			MappedFile f(path);
+			uint32_t crc = memcrc(f);
+			consume(&crc);
+		});
+		// the real encryptFile - pipeline, cksum, bulk CBC and the gather writes of the send engine
+		measureOps("encryptFile " + sizeLabel(size), size, [&]()
+		{
+			Quiet quiet; // it reports every file
+			MappedFile f(path);
+			Cksum crc;
+			encryptFile(key, f, s.getSender(), crc);
+			s.getSender()->end();
+			consume(&crc);
+		});
+	}
+
+	std::string uid(UID_SIZE, '\x5a');
+	measureOps("generateHeader", 0, [&]()
+	{
+		Header header = generateHeader(uid.data(), SEND_FILE, SIZE_SIZE + NAME_SIZE, CLIENT_VER);
+		consume(&header);
+	});
+	char name[NAME_SIZE] = "sample4096";
+	measureOps("NameRequest::write", 0, [&]()
+	{
+		char request[NameRequest::fixed];
+		NameRequest::write(request, sizeof(request), name);
+		consume(request);
+	});
+	measureOps("FileCodecRequest::write", 0, [&]()
+	{
+		CryptoPP::byte nonce[NONCE_SIZE] = { 0 };
+		char request[FileCodecRequest::fixed];
+		FileCodecRequest::write(request, sizeof(request), 4096, name, CIPHER_CTR, nonce, 0, CODEC_NONE, 4096);
+		consume(request);
+	});
+	std::vector<uint32_t> crcs(4096, 0x5a5a5a5a); // a 4Gb file's worth of chunk cksums
+	std::vector<char> listed(ChunkCRCsRequest::size(name, crcs));
+	measureOps("ChunkCRCsRequest::write 4096", listed.size(), [&]()
+	{
+		ChunkCRCsRequest::write(listed.data(), listed.size(), name, crcs);
+		consume(listed.data());
+	});
+
+	// the constructors are timed on their own, the me.info writeback of the destructor happens after the pass
+	std::vector<std::unique_ptr<ConfigHandler>> held;
+	held.reserve(1 << 16);
+	measureOps("ConfigHandler()", 0, [&]()
+	{
+		held.emplace_back(new ConfigHandler());
+		if (held.size() == held.capacity())
+		{
+			Quiet quiet;
+			held.clear();
+		}
+	});
+	{
+		Quiet quiet;
+		held.clear();
+	}
+	// the key is loaded on first use - from me.info's base64 text, or from the DER cache written along with it
+	for (bool cached : { false, true })
+	{
+		measureOps(cached ? "getKey() from DER cache" : "getKey() from base64", 0, [&]()
+		{
+			ConfigHandler c;
+			c.setKeyCache(cached);
+			consume(&c.getKey());
+		}, 3);
+	}
+
+	std::string wrapped;
+	{
+		CryptoPP::AutoSeededRandomPool rng;
+		CryptoPP::RSAES_OAEP_SHA_Encryptor e(CryptoPP::RSA::PublicKey(conf.getKey()));
+		CryptoPP::ArraySource as(key.data(), key.size(), true,
+			new CryptoPP::PK_EncryptorFilter(rng, e, new CryptoPP::StringSink(wrapped)));
+	}
+	CryptoPP::SecByteBlock encrypted((CryptoPP::byte*)wrapped.data(), wrapped.size());
+	measureOps("Session::setAES (OAEP unwrap)", 0, [&]()
+	{
+		s.setAES(encrypted);
+		consume(s.getAES().data());
+	});
+	// what sendKey does without a key pool
+	measureOps("sendKey keygen", 0, [&]()
+	{
+		CryptoPP::RSA::PrivateKey privateKey = KeyPool::generate();
+		CryptoPP::RSA::PublicKey publicKey(privateKey);
+		std::string spki;
+		CryptoPP::StringSink ss(spki);
+		publicKey.DEREncode(ss);
+		consume(spki.data());
+	}, 3);
+	boost::system::error_code ec;
+	s.getSocket()->close(ec); // ends the drain
+	discard.join();
+	Quiet quiet; // conf writes me.info back on the way out
+	return 0;
+}
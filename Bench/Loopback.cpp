@@ -0,0 +1,317 @@
+#include "Loopback.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include "defs.hpp"
+#include "HeaderHandler.hpp"
+#include "Cksum.hpp"
+#include "rijndael.h"
+#include "modes.h"
+#include "osrng.h"
+#include "rsa.h"
+#include "filters.h"
+
+#define RECV_CHUNK 1048576 // ciphertext read, decrypted and checksummed at a time
+
+using boost::asio::ip::tcp;
+
+namespace
+{
+	std::string toHex(const std::string& bytes)
+	{
+		static const char digits[] = "0123456789abcdef";
+		std::string hex;
+		for (unsigned char c : bytes)
+		{
+			hex.push_back(digits[c >> 4]);
+			hex.push_back(digits[c & 15]);
+		}
+		return hex;
+	}
+
+	// file name as the client sent it, cut at the terminator and kept inside the upload directory
+	std::string cleanName(const char* raw)
+	{
+		std::string name(raw, strnlen(raw, NAME_SIZE));
+		std::string clean;
+		for (char c : name)
+			if (c != '/' and c != '\\') clean.push_back(c);
+		size_t dots;
+		while ((dots = clean.find("..")) != std::string::npos) clean.erase(dots, 2);
+		return clean;
+	}
+
+	// a fresh AES key and its OAEP encryption under the client's public key
+	std::string wrapKey(const std::string& der, CryptoPP::SecByteBlock& aes)
+	{
+		CryptoPP::AutoSeededRandomPool rng;
+		aes = CryptoPP::SecByteBlock(AES_SIZE);
+		rng.GenerateBlock(aes.data(), aes.size());
+		CryptoPP::RSA::PublicKey publicKey;
+		CryptoPP::StringSource source(der, true);
+		publicKey.Load(source);
+		CryptoPP::RSAES_OAEP_SHA_Encryptor e(publicKey);
+		std::string wrapped;
+		CryptoPP::ArraySource as(aes.data(), aes.size(), true,
+			new CryptoPP::PK_EncryptorFilter(rng, e, new CryptoPP::StringSink(wrapped)));
+		return wrapped;
+	}
+
+	double since(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void reply(tcp::socket& socket, std::chrono::milliseconds delay, uint16_t code, const std::string& payload = "")
+	{
+		if (delay.count()) std::this_thread::sleep_for(delay);
+		ServerHeader header;
+		header.version = BASE_VER;
+		header.code = code;
+		header.size = (uint32_t)payload.size();
+		std::vector<boost::asio::const_buffer> buffers;
+		buffers.push_back(boost::asio::buffer(&header, SERVER_HEADER_SIZE));
+		buffers.push_back(boost::asio::buffer(payload));
+		boost::asio::write(socket, buffers);
+	}
+}
+
+LoopbackServer::LoopbackServer(const std::string& dir, std::chrono::milliseconds delay)
+	: acceptor(io, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0)), stopping(false), dir(dir), delay(delay)
+{
+	listener = std::thread([this]() { accept(); });
+}
+
+LoopbackServer::~LoopbackServer()
+{
+	stop();
+}
+
+unsigned short LoopbackServer::port() const
+{
+	return acceptor.local_endpoint().port();
+}
+
+// stops listening and waits for every connection to be closed by its client
+void LoopbackServer::stop()
+{
+	if (!listener.joinable()) return;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	boost::system::error_code ec;
+	tcp::socket wake(io); // the accept loop only looks at stopping once a connection comes in
+	wake.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port()), ec);
+	listener.join();
+	std::vector<std::thread> open;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		open.swap(connections);
+	}
+	for (std::thread& t : open)
+		t.join();
+	acceptor.close(ec);
+}
+
+void LoopbackServer::accept()
+{
+	while (true)
+	{
+		tcp::socket socket(io);
+		boost::system::error_code ec;
+		acceptor.accept(socket, ec);
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopping) return;
+		if (ec) continue;
+		socket.set_option(tcp::no_delay(true), ec);
+		connections.emplace_back([this](tcp::socket s) { serve(std::move(s)); }, std::move(socket));
+	}
+}
+
+void LoopbackServer::record(const std::string& phase, double seconds, uint64_t bytes)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	Phase& p = phases[phase];
+	p.count++;
+	p.seconds += seconds;
+	p.bytes += bytes;
+}
+
+// one client connection, until the client closes it or sends something it can't make sense of
+void LoopbackServer::serve(tcp::socket socket)
+{
+	std::string uid; // settled by REGISTER or RECONNECT
+	CryptoPP::SecByteBlock aes;
+	std::vector<char> in(RECV_CHUNK), out(RECV_CHUNK);
+	std::chrono::steady_clock::time_point waiting = std::chrono::steady_clock::now();
+	bool crcSent = false;
+	try
+	{
+		while (true)
+		{
+			Header header;
+			boost::asio::read(socket, boost::asio::buffer(&header, HEADER_SIZE));
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if (crcSent) record("crc round trip", since(waiting)); // SEND_CRC out until the client's verdict is in
+			crcSent = false;
+			std::string from(header.UID, UID_SIZE);
+			size_t expected = 0;
+			switch (header.code)
+			{
+			case REGISTER: case RECONNECT: case CRC_ACK: case CRC_NACK: case CRC_FAIL:
+				expected = NAME_SIZE;
+				break;
+			case SEND_KEY:
+				expected = NAME_SIZE + KEY_SIZE;
+				break;
+			case SEND_FILE:
+				expected = header.size; // checked once the static part is in
+				break;
+			}
+			if (!expected or header.size != expected or (header.code != REGISTER and header.code != RECONNECT and from != uid))
+			{
+				if (header.size > RECV_CHUNK) return; // not worth draining, the client gives up on a closed socket
+				boost::asio::read(socket, boost::asio::buffer(in.data(), header.size));
+				reply(socket, delay, GENERIC_ERROR);
+				continue;
+			}
+			if (header.code == SEND_FILE)
+			{
+				char meta[SIZE_SIZE + NAME_SIZE];
+				if (header.size < sizeof(meta)) return;
+				boost::asio::read(socket, boost::asio::buffer(meta, sizeof(meta)));
+				uint32_t size = *(uint32_t*)meta;
+				std::string name = cleanName(meta + SIZE_SIZE);
+				if (size != header.size - sizeof(meta) or !size or size % CryptoPP::AES::BLOCKSIZE or !aes.size() or name.empty())
+					return; // the data can't be skipped reliably, drop the connection
+				std::ofstream file;
+				if (!dir.empty())
+				{
+					std::filesystem::path path = std::filesystem::path(dir) / toHex(uid);
+					std::filesystem::create_directories(path);
+					file.open(path / name, std::ios::out | std::ios::trunc | std::ios::binary);
+				}
+				CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };
+				CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption d;
+				d.SetKeyWithIV(aes.data(), aes.size(), iv);
+				Cksum crc;
+				uint32_t remaining = size;
+				double reading = 0, decrypting = 0, writing = 0;
+				while (remaining)
+				{
+					size_t req = std::min((size_t)remaining, (size_t)RECV_CHUNK);
+					std::chrono::steady_clock::time_point step = std::chrono::steady_clock::now();
+					boost::asio::read(socket, boost::asio::buffer(in.data(), req));
+					reading += since(step);
+					step = std::chrono::steady_clock::now();
+					d.ProcessData((CryptoPP::byte*)out.data(), (const CryptoPP::byte*)in.data(), req);
+					remaining -= (uint32_t)req;
+					size_t plain = req;
+					if (!remaining) // strip the PKCS padding of the last block
+					{
+						unsigned char pad = (unsigned char)out[req - 1];
+						if (!pad or pad > CryptoPP::AES::BLOCKSIZE) return;
+						plain -= pad;
+					}
+					crc.update(out.data(), plain);
+					decrypting += since(step);
+					step = std::chrono::steady_clock::now();
+					if (file.is_open()) file.write(out.data(), plain);
+					writing += since(step);
+				}
+				file.close();
+				record("file socket read", reading, size);
+				record("file decrypt+cksum", decrypting, size);
+				if (!dir.empty()) record("file write", writing, size);
+				record("file", since(start), size);
+				std::string payload = uid;
+				payload.append((const char*)&size, SIZE_SIZE);
+				payload.append(meta + SIZE_SIZE, NAME_SIZE);
+				uint32_t sum = crc.finalize();
+				payload.append((const char*)&sum, CRC_SIZE);
+				reply(socket, delay, GET_CRC, payload);
+				waiting = std::chrono::steady_clock::now();
+				crcSent = true;
+				continue;
+			}
+			std::string payload(header.size, '\0');
+			boost::asio::read(socket, boost::asio::buffer(&payload[0], payload.size()));
+			switch (header.code)
+			{
+			case REGISTER:
+			{
+				CryptoPP::AutoSeededRandomPool rng;
+				uid.resize(UID_SIZE);
+				rng.GenerateBlock((CryptoPP::byte*)&uid[0], UID_SIZE);
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					clients[uid] = "";
+				}
+				reply(socket, delay, REGISTER_GOOD, uid);
+				record("register", since(start));
+				break;
+			}
+			case RECONNECT:
+			{
+				std::string der;
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					auto known = clients.find(from);
+					if (known != clients.end()) der = known->second;
+				}
+				if (der.empty())
+				{
+					reply(socket, delay, RECONNECT_BAD);
+					break;
+				}
+				uid = from;
+				reply(socket, delay, RECONNECT_GOOD, uid + wrapKey(der, aes));
+				record("reconnect", since(start));
+				break;
+			}
+			case SEND_KEY:
+			{
+				std::string der = payload.substr(NAME_SIZE, KEY_SIZE);
+				std::string wrapped = wrapKey(der, aes);
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					clients[uid] = der;
+				}
+				reply(socket, delay, GOOD_KEY, uid + wrapped);
+				record("key exchange", since(start));
+				break;
+			}
+			case CRC_ACK: case CRC_FAIL:
+				reply(socket, delay, ACK, uid);
+				break;
+			case CRC_NACK: // the file comes again without an answer
+				break;
+			}
+		}
+	}
+	catch (std::exception const&) // the client closed the connection, or sent a key that doesn't load
+	{
+	}
+}
+
+std::map<std::string, LoopbackServer::Phase> LoopbackServer::timings()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return phases;
+}
+
+// one line per phase: how often it ran, the time it took in total and on average, and the rate where it moved bytes
+void LoopbackServer::report(std::ostream& out)
+{
+	for (const auto& phase : timings())
+	{
+		const Phase& p = phase.second;
+		out << std::left << std::setw(20) << phase.first << std::right << std::setw(8) << p.count << " x "
+			<< std::fixed << std::setprecision(3) << std::setw(10) << p.seconds << " s";
+		if (p.count) out << std::setw(12) << p.seconds / p.count * 1e3 << " ms avg";
+		if (p.bytes and p.seconds > 0) out << std::setprecision(1) << std::setw(10) << p.bytes / p.seconds / 1e6 << " MB/s";
+		out << std::endl;
+	}
+}
@@ -0,0 +1,49 @@
+// In-process stand-in for the Python server, for end to end benchmarks of the client
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+// Speaks protocol version 3 - REGISTER or RECONNECT, SEND_KEY, then SEND_FILE and the CRC exchange for every file -
+// and replies with version 3 headers, so clients settle on it and send every file in AES-CBC
+// listens on 127.0.0.1 on a port of the system's choosing and serves each connection on its own thread
+// uploads are decrypted and checksummed either way, and only written out when a directory is given
+class LoopbackServer
+{
+public:
+	struct Phase
+	{
+		uint64_t count = 0;
+		double seconds = 0;
+		uint64_t bytes = 0;
+	};
+private:
+	boost::asio::io_context io;
+	boost::asio::ip::tcp::acceptor acceptor;
+	std::thread listener;
+	std::vector<std::thread> connections;
+	bool stopping;
+	std::string dir; // where uploads are kept, empty discards them
+	std::chrono::milliseconds delay; // added before every reply, to stand in for a slower link
+	std::mutex lock; // clients, phases and connections
+	std::map<std::string, std::string> clients; // UID to DER public key
+	std::map<std::string, Phase> phases;
+	void accept();
+	void serve(boost::asio::ip::tcp::socket socket);
+	void record(const std::string& phase, double seconds, uint64_t bytes = 0);
+public:
+	LoopbackServer(const std::string& dir = "", std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+	~LoopbackServer();
+	LoopbackServer(const LoopbackServer&) = delete;
+	LoopbackServer& operator=(const LoopbackServer&) = delete;
+	unsigned short port() const;
+	void stop();
+	std::map<std::string, Phase> timings();
+	void report(std::ostream& out);
+};
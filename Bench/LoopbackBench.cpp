@@ -0,0 +1,73 @@
+// Full client runs against the loopback server: registration, key exchange and every upload over real sockets
+// usage: loopbackbench [-m megabytes per file] [-n files] [-j sessions] [-r runs] [-d reply delay ms] [-k]
+// -k keeps the uploads in the scratch directory instead of discarding them once checksummed
+// each run after the first reconnects with the UID and key the first one registered, as a returning client would
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "Bench.hpp"
+#include "Loopback.hpp"
+#include "Session.hpp"
+
+int main(int argc, char* argv[])
+{
+	size_t size = 64 << 20;
+	unsigned files = 4, sessions = 1, runs = 3;
+	int delay = 0;
+	bool keep = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-m") and i + 1 < argc) size = strtoul(argv[++i], NULL, 10) << 20;
+		else if (!strcmp(argv[i], "-n") and i + 1 < argc) files = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-j") and i + 1 < argc) sessions = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-r") and i + 1 < argc) runs = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-d") and i + 1 < argc) delay = std::max(0, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-k")) keep = true;
+		else
+		{
+			std::cout << "Usage: " << argv[0] << " [-m megabytes per file] [-n files] [-j sessions] [-r runs] [-d reply delay ms] [-k]" << std::endl;
+			return 1;
+		}
+	}
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / "loopbackbench";
+	std::filesystem::create_directories(dir);
+	std::filesystem::current_path(dir);
+	for (const char* stale : { "me.info", TICKET_FILE, JOURNAL_FILE })
+		std::filesystem::remove(stale);
+	std::filesystem::remove_all("uploads");
+
+	LoopbackServer server(keep ? (dir / "uploads").string() : "", std::chrono::milliseconds(delay));
+	{
+		std::ofstream transfer("transfer.info", std::ios::out | std::ios::trunc);
+		transfer << "127.0.0.1:" << server.port() << "\nbench\n";
+		for (unsigned i = 0; i < files; i++)
+		{
+			std::string path = "sample" + std::to_string(i);
+			writeSample(path, size);
+			transfer << path << "\n";
+		}
+	}
+	uint64_t total = (uint64_t)size * files;
+	for (unsigned run = 0; run < runs; run++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		try
+		{
+			Quiet quiet;
+			ConfigHandler conf; // writes me.info on the way out, the next run reconnects with it
+			runSessions(&conf, sessions);
+		}
+		catch (std::exception const& error)
+		{
+			std::cout << "Run " << run << " failed:" << error.what() << std::endl;
+			return 1;
+		}
+		std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+		std::cout << "Run " << run << ": " << std::fixed << std::setprecision(3) << took.count() << " s, "
+			<< std::setprecision(1) << total / took.count() / 1e6 << " MB/s" << std::endl;
+	}
+	server.stop();
+	server.report(std::cout);
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cstring>
+#include "Chunker.hpp"
+#include "sha.h"
+
+// cut point masks - top bits of the hash, which depend on the last 64 bytes seen
+#define MASK_BITS(n) (~0ULL << (64 - (n)))
+static const uint64_t maskSmall = MASK_BITS(DEDUP_AVG_BITS + 2); // before the average size
+static const uint64_t maskLarge = MASK_BITS(DEDUP_AVG_BITS - 2); // after it
+
+// gear table from a fixed splitmix64 sequence - cut points have to be the same on every run
+struct GearTable
+{
+	uint64_t values[256];
+	GearTable()
+	{
+		uint64_t state = 0x9E3779B97F4A7C15ULL;
+		for (uint64_t& v : values)
+		{
+			uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			v = z ^ (z >> 31);
+		}
+	}
+};
+static const GearTable gear;
+
+// length of the chunk starting at data, size being what is left of the file
+size_t Chunker::cut(const unsigned char* data, size_t size)
+{
+	if (size <= DEDUP_MIN_CHUNK) return size;
+	size_t end = std::min(size, (size_t)DEDUP_MAX_CHUNK);
+	size_t normal = std::min(end, (size_t)(1 << DEDUP_AVG_BITS));
+	uint64_t hash = 0;
+	size_t i = DEDUP_MIN_CHUNK; // nothing before the minimum can be a cut point, so it isn't hashed either
+	for (; i < normal; i++)
+	{
+		hash = (hash << 1) + gear.values[data[i]];
+		if (!(hash & maskSmall)) return i + 1;
+	}
+	for (; i < end; i++)
+	{
+		hash = (hash << 1) + gear.values[data[i]];
+		if (!(hash & maskLarge)) return i + 1;
+	}
+	return end;
+}
+
+// splits the whole file into chunks with their digests, checksumming it on the way
+// a chunk crossing a mapping window is put together in a staging buffer first
+void Chunker::split(MappedFile& fin, std::vector<Chunk>& chunks, ChunkedCksum& crc)
+{
+	uint64_t size = fin.size();
+	uint64_t offset = 0;
+	std::vector<char> stage;
+	CryptoPP::SHA256 sha;
+	chunks.clear();
+	while (offset < size)
+	{
+		size_t want = (size_t)std::min((uint64_t)DEDUP_MAX_CHUNK, size - offset);
+		size_t available;
+		const char* p = fin.map(offset, available);
+		if (available < want)
+		{
+			stage.resize(want);
+			for (size_t copied = 0; copied < want; copied += available)
+			{
+				const char* q = fin.map(offset + copied, available);
+				available = std::min(available, want - copied);
+				memcpy(stage.data() + copied, q, available);
+			}
+			p = stage.data();
+		}
+		Chunk chunk;
+		chunk.offset = offset;
+		chunk.length = (uint32_t)cut(reinterpret_cast<const unsigned char*>(p), want);
+		sha.CalculateDigest(chunk.digest, reinterpret_cast<const CryptoPP::byte*>(p), chunk.length);
+		crc.update(p, chunk.length);
+		chunks.push_back(chunk);
+		offset += chunk.length;
+	}
+	crc.finish();
+}
@@ -0,0 +1,24 @@
+// Content defined chunking for deduplicated uploads
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "defs.hpp"
+#include "Cksum.hpp"
+#include "MappedFile.hpp"
+
+// FastCDC: a gear rolling hash cuts wherever its top bits are all zero, so an insertion only moves the cuts around it
+// normalized chunking tests more bits before the average size and fewer after it, which keeps chunk sizes close to the average
+// every chunk is identified by its SHA-256, the server keeps chunks per UID and only asks for the ones it lacks
+class Chunker
+{
+public:
+	struct Chunk
+	{
+		uint64_t offset;
+		uint32_t length;
+		unsigned char digest[DIGEST_SIZE];
+	};
+	static size_t cut(const unsigned char* data, size_t size);
+	static void split(MappedFile& fin, std::vector<Chunk>& chunks, ChunkedCksum& crc);
+};
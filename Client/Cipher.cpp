@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "Cipher.hpp"
+
+BulkCBC::BulkCBC(const CryptoPP::SecByteBlock& key, const CryptoPP::byte* iv) : multi(key.size() == AES_SIZE and MultiCBC::available())
+{
+	if (multi) MultiCBC::init(stream, key, iv);
+	else e.SetKeyWithIV(key, key.size(), iv, CryptoPP::AES::BLOCKSIZE);
+}
+
+// the MultiCBC round keys and chaining value are ours to wipe, CryptoPP wipes its own key schedule
+BulkCBC::~BulkCBC()
+{
+	CryptoPP::SecureWipeBuffer(stream.schedule, sizeof(stream.schedule));
+	CryptoPP::SecureWipeBuffer(stream.chain, sizeof(stream.chain));
+}
+
+// len has to be a multiple of the block size - out may equal in
+void BulkCBC::process(const char* in, char* out, size_t len)
+{
+	if (len % CryptoPP::AES::BLOCKSIZE) throw std::invalid_argument("CBC input has to be whole blocks");
+	if (multi) MultiCBC::submit(stream, in, out, len);
+	else e.ProcessData(reinterpret_cast<CryptoPP::byte*>(out), reinterpret_cast<const CryptoPP::byte*>(in), len);
+}
+
+// encrypts the last len (less than a block) bytes along with their padding, returns the BLOCKSIZE bytes written to out
+size_t BulkCBC::finish(const char* in, size_t len, char* out)
+{
+	if (len >= CryptoPP::AES::BLOCKSIZE) throw std::invalid_argument("CBC tail has to be shorter than a block");
+	CryptoPP::byte last[CryptoPP::AES::BLOCKSIZE];
+	memcpy(last, in, len);
+	memset(last + len, (int)(CryptoPP::AES::BLOCKSIZE - len), CryptoPP::AES::BLOCKSIZE - len);
+	process((const char*)last, out, CryptoPP::AES::BLOCKSIZE);
+	return CryptoPP::AES::BLOCKSIZE;
+}
+
+ParallelCTR::ParallelCTR(const CryptoPP::SecByteBlock& key, const CryptoPP::byte* nonce, unsigned threads)
+	: key(key), threads(threads ? threads : 1)
+{
+	memcpy(this->nonce, nonce, NONCE_SIZE);
+}
+
+// encrypts len bytes that sit at offset (a multiple of the block size) in the file
+void ParallelCTR::segment(uint64_t offset, const char* in, char* out, size_t len) const
+{
+	CryptoPP::byte counter[NONCE_SIZE];
+	memcpy(counter, nonce, NONCE_SIZE);
+	uint64_t add = offset / CryptoPP::AES::BLOCKSIZE;
+	for (int i = NONCE_SIZE - 1; i >= 0 and add; i--) // 128 bit big endian addition
+	{
+		uint64_t sum = counter[i] + (add & 0xff);
+		counter[i] = (CryptoPP::byte)sum;
+		add = (add >> 8) + (sum >> 8);
+	}
+	CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption e;
+	e.SetKeyWithIV(key, key.size(), counter, NONCE_SIZE);
+	e.ProcessData(reinterpret_cast<CryptoPP::byte*>(out), reinterpret_cast<const CryptoPP::byte*>(in), len);
+}
+
+// splits the range into CTR_SEGMENT pieces spread over the worker threads - out may equal in
+void ParallelCTR::process(uint64_t offset, const char* in, char* out, size_t len) const
+{
+	size_t segments = (len + CTR_SEGMENT - 1) / CTR_SEGMENT;
+	unsigned count = (unsigned)std::min<size_t>(threads, segments);
+	if (count < 2)
+	{
+		segment(offset, in, out, len);
+		return;
+	}
+	// each thread takes a contiguous run of segments so it only sets up one key schedule
+	size_t per = (segments + count - 1) / count * CTR_SEGMENT;
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < count; i++)
+	{
+		size_t start = per * i;
+		if (start >= len) break;
+		size_t n = std::min(per, len - start);
+		workers.emplace_back([this, offset, in, out, start, n]() { segment(offset + start, in + start, out + start, n); });
+	}
+	segment(offset, in, out, std::min(per, len));
+	for (std::thread& t : workers)
+		t.join();
+}
+
+unsigned ParallelCTR::getThreads() const
+{
+	return threads;
+}
@@ -0,0 +1,44 @@
+// File encryption engines
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "cryptlib.h"
+#include "rijndael.h"
+#include "modes.h"
+#include "misc.h"
+#include "defs.hpp"
+#include "MultiCBC.hpp"
+
+// AES-CBC over large buffers: whole blocks go straight through ProcessData, so AES-NI gets hundreds of Kb per call
+// instead of a filter chain deciding how much to buffer - the chaining value carries over between calls
+// finish pads the last partial block itself (PKCS#7, always 1 to BLOCKSIZE bytes)
+// with AES-NI and a 128 bit key the blocks go through MultiCBC instead, interleaved with those of other uploads
+class BulkCBC
+{
+private:
+	CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption e;
+	MultiCBC::Stream stream;
+	bool multi;
+public:
+	BulkCBC(const CryptoPP::SecByteBlock& key, const CryptoPP::byte* iv);
+	~BulkCBC();
+	BulkCBC(const BulkCBC&) = delete;
+	BulkCBC& operator=(const BulkCBC&) = delete;
+	void process(const char* in, char* out, size_t len);
+	size_t finish(const char* in, size_t len, char* out);
+};
+
+// AES-CTR whose keystream can start at any block, so independent segments of one file are encrypted on separate threads
+// the counter is the 16 byte big endian nonce plus the block index, matching PyCryptodome's MODE_CTR with initial_value
+class ParallelCTR
+{
+private:
+	CryptoPP::SecByteBlock key;
+	CryptoPP::byte nonce[NONCE_SIZE];
+	unsigned threads;
+	void segment(uint64_t offset, const char* in, char* out, size_t len) const;
+public:
+	ParallelCTR(const CryptoPP::SecByteBlock& key, const CryptoPP::byte* nonce, unsigned threads);
+	void process(uint64_t offset, const char* in, char* out, size_t len) const;
+	unsigned getThreads() const;
+};
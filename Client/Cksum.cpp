@@ -0,0 +1,461 @@
+// Streaming POSIX cksum engine: table, slicing-by-8/16 and PCLMULQDQ folding kernels picked at runtime
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "Cksum.hpp"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define CKSUM_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CKSUM_TARGET
+#else
+#include <cpuid.h>
+#define CKSUM_TARGET __attribute__((target("pclmul,ssse3")))
+#endif
+#endif
+
+#define POLY 0x04c11db7
+#define CLMUL_MIN 128 // shorter inputs aren't worth setting up the folding registers for
+
+// start of implementation of POSIX cksum
+static const uint32_t crctab[] = {
+0x00000000,
+0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
+0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6,
+0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
+0x4c11db70, 0x48d0c6c7, 0x4593e01e, 0x4152fda9, 0x5f15adac,
+0x5bd4b01b, 0x569796c2, 0x52568b75, 0x6a1936c8, 0x6ed82b7f,
+0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3, 0x709f7b7a,
+0x745e66cd, 0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
+0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5, 0xbe2b5b58,
+0xbaea46ef, 0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033,
+0xa4ad16ea, 0xa06c0b5d, 0xd4326d90, 0xd0f37027, 0xddb056fe,
+0xd9714b49, 0xc7361b4c, 0xc3f706fb, 0xceb42022, 0xca753d95,
+0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1, 0xe13ef6f4,
+0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d, 0x34867077, 0x30476dc0,
+0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5,
+0x2ac12072, 0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16,
+0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca, 0x7897ab07,
+0x7c56b6b0, 0x71159069, 0x75d48dde, 0x6b93dddb, 0x6f52c06c,
+0x6211e6b5, 0x66d0fb02, 0x5e9f46bf, 0x5a5e5b08, 0x571d7dd1,
+0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
+0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b,
+0xbb60adfc, 0xb6238b25, 0xb2e29692, 0x8aad2b2f, 0x8e6c3698,
+0x832f1041, 0x87ee0df6, 0x99a95df3, 0x9d684044, 0x902b669d,
+0x94ea7b2a, 0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e,
+0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2, 0xc6bcf05f,
+0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34,
+0xdc3abded, 0xd8fba05a, 0x690ce0ee, 0x6dcdfd59, 0x608edb80,
+0x644fc637, 0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb,
+0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f, 0x5c007b8a,
+0x58c1663d, 0x558240e4, 0x51435d53, 0x251d3b9e, 0x21dc2629,
+0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5, 0x3f9b762c,
+0x3b5a6b9b, 0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff,
+0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623, 0xf12f560e,
+0xf5ee4bb9, 0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65,
+0xeba91bbc, 0xef68060b, 0xd727bbb6, 0xd3e6a601, 0xdea580d8,
+0xda649d6f, 0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3,
+0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7, 0xae3afba2,
+0xaafbe615, 0xa7b8c0cc, 0xa379dd7b, 0x9b3660c6, 0x9ff77d71,
+0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74,
+0x857130c3, 0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640,
+0x4e8ee645, 0x4a4ffbf2, 0x470cdd2b, 0x43cdc09c, 0x7b827d21,
+0x7f436096, 0x7200464f, 0x76c15bf8, 0x68860bfd, 0x6c47164a,
+0x61043093, 0x65c52d24, 0x119b4be9, 0x155a565e, 0x18197087,
+0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
+0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d,
+0x2056cd3a, 0x2d15ebe3, 0x29d4f654, 0xc5a92679, 0xc1683bce,
+0xcc2b1d17, 0xc8ea00a0, 0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb,
+0xdbee767c, 0xe3a1cbc1, 0xe760d676, 0xea23f0af, 0xeee2ed18,
+0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4, 0x89b8fd09,
+0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662,
+0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf,
+0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
+};
+
+// slicing tables: slice[k][b] is the CRC of byte b followed by k zero bytes
+struct CksumTables
+{
+	uint32_t slice[16][256];
+	uint32_t pow2[64]; // x^(8*2^i) mod P, used to shift a CRC past 2^i bytes
+	CksumTables();
+};
+
+// multiplies two polynomials modulo P
+static uint32_t mulmod(uint32_t a, uint32_t b)
+{
+	uint32_t r = 0;
+	for (int i = 31; i >= 0; i--)
+	{
+		r = (r << 1) ^ ((r & 0x80000000) ? POLY : 0);
+		if ((b >> i) & 1) r ^= a;
+	}
+	return r;
+}
+
+// x^n mod P
+static uint32_t xpowmod(uint64_t n)
+{
+	uint32_t r = 1, base = 2;
+	while (n)
+	{
+		if (n & 1) r = mulmod(r, base);
+		base = mulmod(base, base);
+		n >>= 1;
+	}
+	return r;
+}
+
+CksumTables::CksumTables()
+{
+	for (int b = 0; b < 256; b++)
+		slice[0][b] = crctab[b];
+	for (int k = 1; k < 16; k++)
+		for (int b = 0; b < 256; b++)
+			slice[k][b] = (slice[k - 1][b] << 8) ^ crctab[slice[k - 1][b] >> 24];
+	pow2[0] = 0x100; // x^8
+	for (int i = 1; i < 64; i++)
+		pow2[i] = mulmod(pow2[i - 1], pow2[i - 1]);
+}
+
+static const CksumTables& tables()
+{
+	static const CksumTables t;
+	return t;
+}
+
+static inline uint32_t loadBE32(const unsigned char* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// classic byte at a time kernel
+static uint32_t crcTable(uint32_t s, const unsigned char* p, size_t n)
+{
+	while (n--)
+		s = (s << 8) ^ crctab[(s >> 24) ^ *p++];
+	return s;
+}
+
+static uint32_t crcSlice8(uint32_t s, const unsigned char* p, size_t n)
+{
+	const uint32_t(*t)[256] = tables().slice;
+	while (n >= 8)
+	{
+		uint32_t a = s ^ loadBE32(p);
+		s = t[7][a >> 24] ^ t[6][(a >> 16) & 0xff] ^ t[5][(a >> 8) & 0xff] ^ t[4][a & 0xff]
+			^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+		p += 8;
+		n -= 8;
+	}
+	return crcTable(s, p, n);
+}
+
+static uint32_t crcSlice16(uint32_t s, const unsigned char* p, size_t n)
+{
+	const uint32_t(*t)[256] = tables().slice;
+	while (n >= 16)
+	{
+		uint32_t a = s ^ loadBE32(p);
+		s = t[15][a >> 24] ^ t[14][(a >> 16) & 0xff] ^ t[13][(a >> 8) & 0xff] ^ t[12][a & 0xff]
+			^ t[11][p[4]] ^ t[10][p[5]] ^ t[9][p[6]] ^ t[8][p[7]]
+			^ t[7][p[8]] ^ t[6][p[9]] ^ t[5][p[10]] ^ t[4][p[11]]
+			^ t[3][p[12]] ^ t[2][p[13]] ^ t[1][p[14]] ^ t[0][p[15]];
+		p += 16;
+		n -= 16;
+	}
+	return crcSlice8(s, p, n);
+}
+
+#ifdef CKSUM_X86
+// folding constants: low qword is x^D mod P, high qword x^(D+64) mod P
+struct ClmulConsts
+{
+	uint64_t k512[2];
+	uint64_t k128[2];
+	ClmulConsts()
+	{
+		k512[0] = xpowmod(512);
+		k512[1] = xpowmod(512 + 64);
+		k128[0] = xpowmod(128);
+		k128[1] = xpowmod(128 + 64);
+	}
+};
+
+static const ClmulConsts& clmulConsts()
+{
+	static const ClmulConsts c;
+	return c;
+}
+
+// moves block x forward by the distance k was built for
+CKSUM_TARGET static inline __m128i fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00));
+}
+
+// Folds 4 blocks in parallel 64 bytes at a time until a single 128 bit remainder congruent to the input is left
+// the remainder is then run through the table kernel, which yields the same CRC as the input it replaces
+CKSUM_TARGET static uint32_t crcClmul(uint32_t s, const unsigned char* p, size_t n)
+{
+	if (n < CLMUL_MIN) return crcSlice16(s, p, n);
+	const ClmulConsts& c = clmulConsts();
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m128i k512 = _mm_loadu_si128((const __m128i*)c.k512);
+	const __m128i k128 = _mm_loadu_si128((const __m128i*)c.k128);
+	__m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), bswap);
+	__m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), bswap);
+	__m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), bswap);
+	__m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), bswap);
+	x0 = _mm_xor_si128(x0, _mm_set_epi32((int)s, 0, 0, 0)); // running state goes into the first 4 bytes
+	p += 64;
+	n -= 64;
+	while (n >= 64)
+	{
+		x0 = _mm_xor_si128(fold(x0, k512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), bswap));
+		x1 = _mm_xor_si128(fold(x1, k512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), bswap));
+		x2 = _mm_xor_si128(fold(x2, k512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), bswap));
+		x3 = _mm_xor_si128(fold(x3, k512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), bswap));
+		p += 64;
+		n -= 64;
+	}
+	x0 = _mm_xor_si128(fold(x0, k128), x1);
+	x0 = _mm_xor_si128(fold(x0, k128), x2);
+	x0 = _mm_xor_si128(fold(x0, k128), x3);
+	while (n >= 16)
+	{
+		x0 = _mm_xor_si128(fold(x0, k128), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), bswap));
+		p += 16;
+		n -= 16;
+	}
+	unsigned char rem[16];
+	_mm_storeu_si128((__m128i*)rem, _mm_shuffle_epi8(x0, bswap));
+	return crcSlice16(crcTable(0, rem, 16), p, n);
+}
+
+// PCLMULQDQ and PSHUFB (SSSE3) are both needed
+static bool haveClmul()
+{
+	unsigned int ecx;
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 1);
+	ecx = (unsigned int)regs[2];
+#else
+	unsigned int eax, ebx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+#endif
+	return (ecx & (1 << 1)) && (ecx & (1 << 9));
+}
+#endif
+
+typedef uint32_t(*CrcKernel)(uint32_t, const unsigned char*, size_t);
+
+static Cksum::Kernel bestKernel()
+{
+#ifdef CKSUM_X86
+	if (haveClmul()) return Cksum::CLMUL;
+#endif
+	return sizeof(void*) >= 8 ? Cksum::SLICE16 : Cksum::SLICE8;
+}
+
+static CrcKernel kernelFor(Cksum::Kernel k)
+{
+	switch (k)
+	{
+	case Cksum::TABLE:
+		return crcTable;
+	case Cksum::SLICE8:
+		return crcSlice8;
+	case Cksum::SLICE16:
+		return crcSlice16;
+#ifdef CKSUM_X86
+	case Cksum::CLMUL:
+		return haveClmul() ? crcClmul : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+// kernel currently in use - chosen on first use, the static init is thread safe
+struct Dispatch
+{
+	Cksum::Kernel kind;
+	CrcKernel fn;
+	Dispatch() : kind(bestKernel()), fn(kernelFor(kind)) {}
+};
+
+static Dispatch& dispatch()
+{
+	static Dispatch d;
+	return d;
+}
+
+// overrides the kernel used by every engine (benchmarks) - AUTO selects the fastest one the cpu supports
+// not meant to be called while other threads are checksumming
+bool Cksum::setKernel(Kernel k)
+{
+	if (k == AUTO) k = bestKernel();
+	CrcKernel f = kernelFor(k);
+	if (!f) return false;
+	dispatch().kind = k;
+	dispatch().fn = f;
+	return true;
+}
+
+Cksum::Kernel Cksum::getKernel()
+{
+	return dispatch().kind;
+}
+
+const char* Cksum::kernelName(Kernel k)
+{
+	switch (k)
+	{
+	case TABLE: return "table";
+	case SLICE8: return "slice8";
+	case SLICE16: return "slice16";
+	case CLMUL: return "clmul";
+	default: return "auto";
+	}
+}
+
+Cksum::Cksum()
+{
+	reset();
+}
+
+void Cksum::reset()
+{
+	raw = 0;
+	len = 0;
+}
+
+// continue raw CRC state over more data
+uint32_t Cksum::compute(uint32_t raw, const void* data, size_t size)
+{
+	return dispatch().fn(raw, (const unsigned char*)data, size);
+}
+
+void Cksum::update(const void* data, size_t size)
+{
+	raw = compute(raw, data, size);
+	len += size;
+}
+
+// splits a large buffer between threads and stitches the partial CRCs together with combine
+void Cksum::parallelUpdate(const void* data, size_t size, unsigned threads)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	size_t piece = size / (threads ? threads : 1);
+	if (threads < 2 || piece < (1 << 20)) // not worth spawning threads for less than 1Mb each
+	{
+		update(data, size);
+		return;
+	}
+	std::vector<uint32_t> parts(threads);
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < threads; i++)
+	{
+		size_t off = piece * i, n = (i == threads - 1) ? size - off : piece;
+		workers.emplace_back([&parts, p, off, n, i]() { parts[i] = compute(0, p + off, n); });
+	}
+	parts[0] = compute(raw, p, piece); // first piece continues the running state on this thread
+	for (std::thread& t : workers)
+		t.join();
+	raw = parts[0];
+	for (unsigned i = 1; i < threads; i++)
+	{
+		size_t off = piece * i, n = (i == threads - 1) ? size - off : piece;
+		raw = combine(raw, parts[i], n);
+	}
+	len += size;
+}
+
+// raw CRC of A||B given the raw CRCs of A and B and the length of B
+uint32_t Cksum::combine(uint32_t rawA, uint32_t rawB, uint64_t lenB)
+{
+	const uint32_t* pow2 = tables().pow2;
+	for (int i = 0; lenB; i++, lenB >>= 1)
+		if (lenB & 1) rawA = mulmod(rawA, pow2[i]);
+	return rawA ^ rawB;
+}
+
+// Extend with the length of the data and complement
+uint32_t Cksum::finalize(uint32_t raw, uint64_t len)
+{
+	while (len != 0)
+	{
+		unsigned char c = len & 0377;
+		len >>= 8;
+		raw = (raw << 8) ^ crctab[(raw >> 24) ^ c];
+	}
+	return ~raw;
+}
+
+uint32_t Cksum::finalize() const
+{
+	return finalize(raw, len);
+}
+
+uint32_t Cksum::state() const
+{
+	return raw;
+}
+
+uint64_t Cksum::length() const
+{
+	return len;
+}
+
+// extend the state by a piece that was checksummed separately
+void Cksum::append(uint32_t rawB, uint64_t lenB)
+{
+	raw = combine(raw, rawB, lenB);
+	len += lenB;
+}
+
+ChunkedCksum::ChunkedCksum(uint64_t chunkSize) : chunkSize(chunkSize)
+{
+}
+
+// data may arrive in pieces of any size, chunk boundaries are tracked here
+void ChunkedCksum::update(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	while (size)
+	{
+		size_t req = (size_t)(chunkSize - part.length() < size ? chunkSize - part.length() : size);
+		part.update(p, req);
+		p += req;
+		size -= req;
+		if (part.length() == chunkSize) finish();
+	}
+}
+
+// closes the chunk being filled, the last one of a stream is usually shorter
+void ChunkedCksum::finish()
+{
+	if (!part.length()) return;
+	chunks.push_back(part.finalize());
+	whole.append(part.state(), part.length());
+	part.reset();
+}
+
+// cksum of everything fed so far - call finish first
+uint32_t ChunkedCksum::finalize() const
+{
+	return whole.finalize();
+}
+
+const std::vector<uint32_t>& ChunkedCksum::getChunks() const
+{
+	return chunks;
+}
+// end of implementation of POSIX cksum
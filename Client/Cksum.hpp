@@ -0,0 +1,48 @@
+// Streaming POSIX cksum engine
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Raw state is the CRC (poly 0x04C11DB7, no reflection, zero init) of the data seen so far
+// finalize appends the length bytes and complements, giving the value the cksum utility prints
+class Cksum
+{
+public:
+	enum Kernel { AUTO, TABLE, SLICE8, SLICE16, CLMUL };
+private:
+	uint32_t raw;
+	uint64_t len;
+public:
+	Cksum();
+	void reset();
+	void update(const void* data, size_t size);
+	void parallelUpdate(const void* data, size_t size, unsigned threads);
+	void append(uint32_t rawB, uint64_t lenB);
+	uint32_t finalize() const;
+	uint32_t state() const;
+	uint64_t length() const;
+	static uint32_t finalize(uint32_t raw, uint64_t len);
+	static uint32_t combine(uint32_t rawA, uint32_t rawB, uint64_t lenB);
+	static uint32_t compute(uint32_t raw, const void* data, size_t size);
+	static bool setKernel(Kernel k);
+	static Kernel getKernel();
+	static const char* kernelName(Kernel k);
+};
+
+// Cksum of a whole stream plus one cksum per fixed size chunk of it, from a single pass over the data
+// each chunk is checksummed on its own and folded into the total with combine, so the total costs nothing extra
+class ChunkedCksum
+{
+private:
+	Cksum whole;
+	Cksum part; // chunk currently being filled
+	std::vector<uint32_t> chunks; // finalized cksum of every completed chunk
+	uint64_t chunkSize;
+public:
+	ChunkedCksum(uint64_t chunkSize);
+	void update(const void* data, size_t size);
+	void finish();
+	uint32_t finalize() const;
+	const std::vector<uint32_t>& getChunks() const;
+};
@@ -1,16 +1,15 @@
 // implements all timeout functionality of socket reading
+// reads are asynchronous with a steady_timer deadline, both driven by the session's io_context,
+// so a read completes the moment its bytes arrive instead of on the next polling tick
 
+#include <stdexcept>
 #include "boost/asio.hpp"
 #include <boost/asio/write.hpp>
 #include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include "defs.hpp"
 #include "Session.hpp"
-#ifdef _WIN32
-#include <windows.h>
-#define sleep(x) Sleep(1000*x)
-#else
-#include <unistd.h>
-#endif
+#include "Metrics.hpp"
 
 class ServerHeader;
 Client::Client(Session* s)
@@ -22,75 +21,108 @@ void Client::connect()
 {
 	try
 	{
+		Metrics::Timer timer(Metrics::IO_SECONDS, "connect");
+		Metrics::count(Metrics::SYSCALLS, "connect");
 		boost::asio::connect(*(s->getSocket()), (*(s->getResolver())).resolve(s->getConfig()->getIP(), s->getConfig()->getPort()));
+		s->getRing()->clear(); // nothing left over from an earlier connection belongs to this one
+		s->getSender()->configure();
 	}
 	catch (std::exception const& error) // nothing to be done if server is unreachable
 	{
-		std::cout << "Fatal Error:" << error.what() << std::endl;
-		std::cout << "Program will now terminate" << std::endl;
-		exit(-1);
+		throw FatalError(std::string("Couldn't connect to server:") + error.what());
 	}
 }
 
-// reads header from socket into session member
-void Client::readHeader()
+// reads until at least need bytes are buffered or throws once the configured timeout passes
+// every read takes all the ring has room for, so whatever else the server sent already comes along
+void Client::fill(size_t need)
 {
-	int patience = 5;
-	while (s->getSocket()->available() < SERVER_HEADER_SIZE and patience > 0)
+	RecvRing* ring = s->getRing();
+	if (ring->pending() >= need) return;
+	boost::system::error_code result;
+	bool expired = false;
+	s->timer.expires_after(s->getConfig()->getTimeout());
+	s->timer.async_wait([this, &expired](const boost::system::error_code& ec)
+		{
+			if (ec) return; // timer cancelled - read finished in time
+			expired = true;
+			s->socket.cancel(); // aborts the pending read
+		});
+	s->io_context.restart();
+	while (!result and ring->pending() < need)
 	{
-		patience--;
-		sleep(1);
+		Metrics::Timer timer(Metrics::IO_SECONDS, "read");
+		result = boost::asio::error::would_block;
+		size_t got = 0;
+		s->socket.async_read_some(ring->space(need - ring->pending()),
+			[&result, &got](const boost::system::error_code& ec, size_t bytes) { result = ec; got = bytes; });
+		while (result == boost::asio::error::would_block)
+			s->io_context.run_one();
+		ring->filled(got);
+		Metrics::observe(Metrics::IO_BYTES, "read", (double)got);
+		Metrics::count(Metrics::SYSCALLS, "read");
+		Metrics::count(Metrics::BYTES, "received", got);
 	}
-	if (patience == 0) throw std::exception("timeout");
-	boost::asio::streambuf buffer;
-	size_t transferred = boost::asio::read(*(s->getSocket()), buffer, boost::asio::transfer_exactly(SERVER_HEADER_SIZE));
-	std::string buf;
-	buf.resize(transferred);
-	buffer.sgetn(&buf[0], buf.size()); // transfer header into string
-	memcpy(s->getHeaderRecieved(), buf.data(), SERVER_HEADER_SIZE); // transfer header from string to headerReceived session member
+	s->timer.cancel();
+	s->io_context.run(); // let the cancelled timer's handler complete
+	if (expired) throw std::runtime_error("timeout");
+	if (result) throw boost::system::system_error(result);
+}
+
+// starts the next message and parses its header where it landed
+void Client::readHeader()
+{
+	RecvRing* ring = s->getRing();
+	ring->next();
+	fill(SERVER_HEADER_SIZE);
+	ring->take(SERVER_HEADER_SIZE); // header struct is packed, read in place through getHeaderRecieved
+	s->setVersion(s->getHeaderRecieved()->version);
 }
 
-// reads paayload into session buffer
+// makes the payload of the current message available as a view through getPayload
 void Client::readPayload()
 {
-	int patience = 5;
 	size_t size = s->getHeaderRecieved()->size;
-	while (s->getSocket()->available() < size and patience > 0)
-	{
-		patience--;
-		sleep(1);
-	}
-	if (patience == 0) throw std::exception("timeout");
-	boost::asio::streambuf buffer;
-	size_t transferred = boost::asio::read(*(s->getSocket()), buffer, boost::asio::transfer_exactly(size));
-	(s->getBuffer())->resize(transferred);
-	buffer.sgetn(&(*(s->getBuffer()))[0], s->getBuffer()->size()); // transfer payload into session buffer
+	fill(size);
+	s->setPayload(std::string_view(s->getRing()->take(size), size));
 }
 
-// flushes socket contents
+// discards b_count bytes of the stream, buffered ones first
 void Client::flush(size_t b_count)
 {
-	int patience = 5;
-	while (s->getSocket()->available() < b_count and patience > 0)
+	RecvRing* ring = s->getRing();
+	while (b_count)
 	{
-		patience--;
-		sleep(1);
+		fill(1);
+		size_t req = std::min(b_count, ring->pending());
+		ring->take(req);
+		b_count -= req;
 	}
-	if (patience == 0) throw std::exception("timeout");
-	boost::asio::streambuf buffer;
-	boost::asio::read(*(s->getSocket()), buffer, boost::asio::transfer_exactly(b_count));
 }
 
+// discards what is buffered and what the socket already holds, without waiting for more - used after a bad response
+void Client::drain()
+{
+	flush(s->getRing()->pending() + s->getSocket()->available());
+}
 
 // write vector of buffers into socket
 void Client::write(std::vector<boost::asio::mutable_buffer> out)
 {
 	//Note that client will crash due to win exception if server dies here
-	boost::asio::write(*(s->getSocket()), out);
+	Metrics::Timer timer(Metrics::IO_SECONDS, "write");
+	size_t bytes = boost::asio::write(*(s->getSocket()), out);
+	Metrics::observe(Metrics::IO_BYTES, "write", (double)bytes);
+	Metrics::count(Metrics::SYSCALLS, "write");
+	Metrics::count(Metrics::BYTES, "sent", bytes);
 }
 
-// unused
+// write raw chunk into socket (used for streaming file contents)
 void Client::write_some(const char* data, size_t size)
 {
+	Metrics::Timer timer(Metrics::IO_SECONDS, "write");
 	boost::asio::write(*(s->getSocket()), boost::asio::buffer(data,size));
+	Metrics::observe(Metrics::IO_BYTES, "write", (double)size);
+	Metrics::count(Metrics::SYSCALLS, "write");
+	Metrics::count(Metrics::BYTES, "sent", size);
 }
\ No newline at end of file
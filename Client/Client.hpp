@@ -1,4 +1,19 @@
 class Session;
+
+// thrown when retrying can't help - the session gives up instead of the whole process exiting
+class FatalError : public std::runtime_error
+{
+public:
+    FatalError(const std::string& what) : std::runtime_error(what) {}
+};
+
+// the server no longer accepts our UID - registering anew would swap it under sessions still using it
+class RefusedError : public FatalError
+{
+public:
+    RefusedError(const std::string& what) : FatalError(what) {}
+};
+
 class Client
 {
 public:
@@ -8,6 +23,8 @@ public:
     void readHeader();
     void readPayload();
     void flush(size_t b_count);
+    void drain();
+    void fill(size_t need);
     void write(std::vector<boost::asio::mutable_buffer> out);
     void write_some(const char*, size_t);
 };
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include "Compress.hpp"
+#include "Metrics.hpp"
+#include "filters.h"
+#include "zlib.h"
+
+// extensions of formats that are compressed already
+static const char* const packedFormats[] = { ".zip", ".gz", ".tgz", ".bz2", ".xz", ".zst", ".7z", ".rar", ".jar", ".apk",
+	".jpg", ".jpeg", ".png", ".gif", ".webp", ".heic", ".mp3", ".aac", ".ogg", ".flac", ".mp4", ".mkv", ".avi", ".mov", ".webm",
+	".pdf", ".docx", ".xlsx", ".pptx" };
+
+// true if the extension says deflating would be a waste of time
+bool Compressor::skipped(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos or path.find_first_of("\\/", dot) != std::string::npos) return false;
+	std::string ext = path.substr(dot);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	for (const char* packed : packedFormats)
+		if (ext == packed) return true;
+	return false;
+}
+
+// deflates COMPRESS_SAMPLES pieces of COMPRESS_SAMPLE bytes at the fastest level
+// the file is worth compressing if they shrink below COMPRESS_RATIO percent - never past COMPRESS_MAX, which would hold
+// that much in memory and delay the first byte on the wire by the whole deflate, where the pipeline streams it
+bool Compressor::sample(MappedFile& fin)
+{
+	uint64_t size = fin.size();
+	if (size < COMPRESS_MIN or size > COMPRESS_MAX) return false;
+	std::string out;
+	CryptoPP::ZlibCompressor zlib(new CryptoPP::StringSink(out), CryptoPP::Deflator::MIN_DEFLATE_LEVEL + 1);
+	uint64_t taken = 0;
+	for (unsigned i = 0; i < COMPRESS_SAMPLES; i++)
+	{
+		size_t available;
+		const char* p = fin.map(size / COMPRESS_SAMPLES * i, available);
+		size_t req = (size_t)std::min((uint64_t)std::min(available, (size_t)COMPRESS_SAMPLE), size - taken);
+		zlib.Put(reinterpret_cast<const CryptoPP::byte*>(p), req);
+		taken += req;
+	}
+	zlib.MessageEnd();
+	return out.size() * 100 < taken * COMPRESS_RATIO;
+}
+
+// deflates the whole file into out and checksums the plaintext on the way
+// gives up as soon as the output passes COMPRESS_RATIO percent of the input, crc is only complete when true is returned
+bool Compressor::compress(MappedFile& fin, std::string& out, ChunkedCksum& crc)
+{
+	Metrics::Timer timer(Metrics::CPU_SECONDS, "deflate");
+	uint64_t size = fin.size();
+	out.clear();
+	CryptoPP::ZlibCompressor zlib(new CryptoPP::StringSink(out), COMPRESS_LEVEL);
+	uint64_t offset = 0;
+	while (offset < size)
+	{
+		size_t available;
+		const char* p = fin.map(offset, available);
+		size_t req = (size_t)std::min((uint64_t)std::min(available, (size_t)CHECK_CHUNK), size - offset);
+		crc.update(p, req);
+		zlib.Put(reinterpret_cast<const CryptoPP::byte*>(p), req);
+		offset += req;
+		if (out.size() * 100 >= offset * COMPRESS_RATIO + CHECK_CHUNK * 100) // the deflater holds back up to a window
+		{
+			out.clear();
+			return false;
+		}
+	}
+	zlib.MessageEnd();
+	crc.finish();
+	if (out.size() * 100 >= size * COMPRESS_RATIO)
+	{
+		out.clear();
+		return false;
+	}
+	std::cout << "Compressed " << size << " bytes to " << out.size() << std::endl;
+	return true;
+}
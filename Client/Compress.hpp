@@ -0,0 +1,16 @@
+// Deflate stage run ahead of encryption
+#pragma once
+#include <string>
+#include "Cksum.hpp"
+#include "MappedFile.hpp"
+
+// Media and archives are skipped by extension, everything else is judged by deflating a few samples spread over the file
+// the whole file is then deflated into memory so its length is known before the SEND_FILE header goes out,
+// which is why files past COMPRESS_MAX are never sampled and always go out as they are
+class Compressor
+{
+public:
+	static bool skipped(const std::string& path);
+	static bool sample(MappedFile& fin);
+	static bool compress(MappedFile& fin, std::string& out, ChunkedCksum& crc);
+};
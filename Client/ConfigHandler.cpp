@@ -4,13 +4,24 @@
 #include "boost/asio.hpp"
 #include "cryptlib.h"
 #include <base64.h>
+#include <sha.h>
+#include <algorithm>
 #include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include "FileUtil.hpp"
+#include "Metrics.hpp"
+
+#define MAX_MANIFEST_DEPTH 8 // manifests may list other manifests, this stops include loops
 
-unsigned char hexToUID(unsigned char);
 bool FileExists(const std::string&);
+std::string keyDigest(const std::string&);
 
 // sets up all config info
-ConfigHandler::ConfigHandler()
+// the key itself is only decoded once a session needs it, see getKey
+ConfigHandler::ConfigHandler() : keyLoaded(false), keyCache(true), dirty(false), timeout(READ_TIMEOUT), sendChunk(0), sendBuffer(0),
+	compress(true), dedup(false), keyPool(NULL)
 {
 	HandleTransfer(); // Extract prime config from transfer.info
 	if (!FileExists("me.info"))
@@ -31,26 +42,16 @@ ConfigHandler::ConfigHandler()
 		hex.reserve(UID_SIZE * 2);
 		std::getline(fin, hex);
 		if (fin.eof()) throw std::exception("Bad file format");
-		if (!(hex.length() == UID_SIZE * 2)) throw std::exception("Bad UID format");
-		for (int i =0; i < UID_SIZE; i++)
-		{
-			unsigned char c = hexToUID(hex[i*2]);
-			c = (c << 4) + hexToUID(hex[i*2+1]);
-			UID.push_back(c);
-		}
-		std::string key;
+		char raw[UID_SIZE];
+		if (!fromHex(hex, raw, UID_SIZE)) throw std::exception("Bad UID format");
+		UID.assign(raw, UID_SIZE);
 		std::string line;
 		while (!fin.eof())
 		{
 			std::getline(fin, line);
-			key.append(line);
+			keyText.append(line);
 		}
-		CryptoPP::Base64Decoder d;
-		d.Put((CryptoPP::byte*)key.data(), key.size());
-		d.MessageEnd();
-		CryptoPP::RSA::PrivateKey k;
-		k.Load(d);
-		setKey(k);
+		if (keyText.empty()) throw std::exception("Bad key format");
 		keyFlag = true;
 	}
 
@@ -65,74 +66,67 @@ ConfigHandler::ConfigHandler()
 	}
 }
 
-// util function converts hex to UID
-unsigned char hexToUID(unsigned char c)
+// writeback to me.info if registration or key exchange changed what it holds
+ConfigHandler::~ConfigHandler()
 {
-	if ('0' <= c && c <= '9')
-		return c - '0';
-	else if ('a' <= c && c <= 'f')
-		return c - 'a' + 10;
-	else if ('A' <= c && c <= 'F')
-		return c - 'A' + 10;
-	else throw std::exception("Bad UID format");
+	save();
 }
 
-// util function converts UID to hex representation
-void UIDToHex(const char* UID, std::string& hex)
+// rewrites me.info, and the DER cache after it, if key exchange succeeded and the UID or key differ from what was loaded
+// a run that only reconnected writes nothing, and a failed write leaves the previous me.info whole
+void ConfigHandler::save()
 {
-	for (int i = 0; i < UID_SIZE; i++)
+	std::lock_guard<std::mutex> guard(stateLock);
+	if (!keyFlag or !dirty) return;
+	std::cout << "Attempting to create me.info file" << std::endl;
+	std::string der;
+	CryptoPP::StringSink ss(der);
+	privKey.Save(ss);
+	std::string encoded;
+	CryptoPP::Base64Encoder e(new CryptoPP::StringSink(encoded));
+	e.Put((const CryptoPP::byte*)der.data(), der.size());
+	e.MessageEnd();
+	if (!replaceFile("me.info", name + "\n" + toHex(UID.data(), UID_SIZE) + "\n" + encoded)) // null char of the name isn't written
 	{
-		unsigned char c = UID[i], lo;
-		lo = c % 16;
-		if (lo < 10) lo += '0';
-		else lo = lo + 'A' - 10;
-		c /= 16;
-		if (c < 10) c += '0';
-		else c = c + 'A' - 10;
-		hex.push_back(c);
-		hex.push_back(lo);
+		std::cout << "Warning: Couldn't write registration info back to me.info" << std::endl;
+		return;
 	}
+	dirty = false;
+	std::error_code ec;
+	if (keyCache and !replaceFile(KEY_CACHE_FILE, keyDigest(encoded) + der)) std::filesystem::remove(KEY_CACHE_FILE, ec); // never leave one older than the key
+	std::cout << "Successfully created me.info file" << std::endl;
 }
 
-// writeback to me.info if registration and key exchange succeed
-ConfigHandler::~ConfigHandler()
+// decodes the key from the DER cache when the SHA-256 heading it matches me.info's base64 text, from that text otherwise,
+// refreshing the cache - a damaged cache or one made from another key is ignored
+void ConfigHandler::loadKey()
 {
-	
-	if (keyFlag)
+	Metrics::Timer timer(Metrics::CPU_SECONDS, "key load");
+	std::string digest = keyDigest(keyText);
+	if (keyCache)
 	{
-		std::cout << "Attempting to create me.info file" << std::endl;
-		std::ofstream out;
-		out.open("me.info", std::ios::out | std::ios::trunc | std::ios::binary);
-		if (!out.is_open()) // can't write me.info
+		std::ifstream in(KEY_CACHE_FILE, std::ios::in | std::ios::binary);
+		std::string cached((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (cached.size() > DIGEST_SIZE and !cached.compare(0, DIGEST_SIZE, digest)) // made from this very key text
 		{
-			std::cout << "Failed to open me.info" << std::endl;
 			try
 			{
-				std::remove("me.info"); // Try to cleanup file so next run is more smooth
+				CryptoPP::StringSource source((const CryptoPP::byte*)cached.data() + DIGEST_SIZE, cached.size() - DIGEST_SIZE, true);
+				privKey.Load(source);
+				keyLoaded = true;
+				return;
 			}
-			catch (std::exception const& e)
+			catch (CryptoPP::Exception const&)
 			{
-				std::cout << "Failed to delete me.info file" << std::endl;
 			}
-			throw std::exception("Non-fatal: Couldn't write registration info back to me.info");
 		}
-		out.write(this->getName().data(), this->getName().length()); // null char isn't written
-		out.write("\n", 1);
-		std::string hex;
-		UIDToHex(this->getUID().data(), hex);
-		out.write(hex.data(), hex.length());
-		out.write("\n", 1);
-		std::string key;
-		std::string encoded;
-		CryptoPP::Base64Encoder e;
-		CryptoPP::StringSink ss(key);
-		this->getKey().Save(ss);
-		e.Attach(new CryptoPP::StringSink(encoded));
-		e.Put((CryptoPP::byte*)key.data(), key.size());
-		e.MessageEnd();
-		out.write(encoded.data(), encoded.length());
-		std::cout << "Successfully created me.info file" << std::endl;
 	}
+	std::string der;
+	CryptoPP::StringSource decoded(keyText, true, new CryptoPP::Base64Decoder(new CryptoPP::StringSink(der)));
+	CryptoPP::StringSource source(der, true);
+	privKey.Load(source);
+	keyLoaded = true;
+	if (keyCache) replaceFile(KEY_CACHE_FILE, digest + der);
 }
 
 //util used to convert port as string to integer
@@ -173,8 +167,56 @@ void ConfigHandler::HandleTransfer()
 		err += " characters long";
 		throw std::invalid_argument(err);
 	}
-	std::getline(transfer, path);
+	// every remaining line is a file, a directory (uploaded recursively) or @manifest - a file listing more of the same
+	std::string line;
+	while (std::getline(transfer, line))
+		addPath(line, 0);
 	transfer.close();
+	if (paths.empty()) throw std::invalid_argument("No files to transfer listed in transfer.info");
+	checkNames();
+}
+
+// every file has to fit its name field and no two may be stored under the same name, the later one would replace the other
+void ConfigHandler::checkNames() const
+{
+	std::map<std::string, std::filesystem::path> stored;
+	for (const std::string& p : paths)
+	{
+		std::string name = storedName(p);
+		if (name.length() >= NAME_SIZE) throw std::invalid_argument(p + " is stored as " + name + ", longer than " + std::to_string(NAME_SIZE - 1) + " characters");
+		std::error_code ec;
+		std::filesystem::path full = std::filesystem::absolute(p, ec).lexically_normal();
+		auto it = stored.emplace(name, full);
+		if (!it.second and it.first->second != full) throw std::invalid_argument(p + " and " + it.first->second.string() + " would both be stored as " + name);
+	}
+}
+
+// expands a single transfer.info entry into the files it refers to
+void ConfigHandler::addPath(const std::string& entry, int depth)
+{
+	std::string p = entry;
+	while (!p.empty() and (p.back() == '\r' or p.back() == ' ')) p.pop_back(); // tolerate CRLF and trailing spaces
+	if (p.empty()) return;
+	if (p[0] == '@')
+	{
+		if (depth >= MAX_MANIFEST_DEPTH) throw std::invalid_argument("Manifests nested too deep: " + p);
+		std::ifstream manifest(p.substr(1));
+		if (!manifest.is_open()) throw std::runtime_error("Local Failure: Couldn't open manifest " + p.substr(1));
+		std::string line;
+		while (std::getline(manifest, line))
+			addPath(line, depth + 1);
+		return;
+	}
+	roots.push_back(p);
+	std::error_code ec;
+	if (std::filesystem::is_directory(p, ec))
+	{
+		directories.push_back(p);
+		for (const auto& f : std::filesystem::recursive_directory_iterator(p, std::filesystem::directory_options::skip_permission_denied, ec))
+			if (f.is_regular_file(ec)) paths.push_back(f.path().string());
+		return;
+	}
+	paths.push_back(p); // plain files are kept even if missing, the session reports and skips them when their turn comes
 }
 
 // ip getter
@@ -198,48 +240,178 @@ std::string ConfigHandler::getName() const
 // UID getter
 std::string ConfigHandler::getUID() const
 {
+	std::lock_guard<std::mutex> guard(stateLock);
 	return UID;
 }
 
-// path getter
-std::string ConfigHandler::getPath() const
+// paths getter
+const std::vector<std::string>& ConfigHandler::getPaths() const
+{
+	return paths;
+}
+
+// watch roots getter
+const std::vector<std::string>& ConfigHandler::getRoots() const
 {
-	return path;
+	return roots;
+}
+
+// name a file is stored under on the server - its own name for listed files, the listed directory's name and the path below it
+// for files found in one, with %2F for the separators since the server keeps all of a client's files in a single directory
+std::string ConfigHandler::storedName(const std::string& path) const
+{
+	std::error_code ec;
+	std::filesystem::path full = std::filesystem::absolute(path, ec).lexically_normal();
+	if (std::find(roots.begin(), roots.end(), path) != roots.end()) return full.filename().string(); // listed on its own
+	for (const std::string& dir : directories)
+	{
+		std::filesystem::path base = std::filesystem::absolute(dir, ec).lexically_normal();
+		if (!base.has_filename()) base = base.parent_path(); // listed with a trailing separator
+		std::filesystem::path relative = full.lexically_relative(base);
+		if (relative.empty() or *relative.begin() == "..") continue;
+		std::string name = base.filename().string();
+		for (const auto& part : relative)
+			name += "%2F" + part.string();
+		return name;
+	}
+	return full.filename().string();
 }
 
-// privkey getter
-CryptoPP::RSA::PrivateKey ConfigHandler::getKey() const
+// privkey getter - loads the key on first use, so runs that resume a ticket or register anew never decode it
+const CryptoPP::RSA::PrivateKey& ConfigHandler::getKey()
 {
+	std::lock_guard<std::mutex> guard(keyLock);
+	if (!keyLoaded) loadKey();
 	return privKey;
 }
 
+// key cache getter
+bool ConfigHandler::getKeyCache() const
+{
+	return keyCache;
+}
+
+// key cache setter - off always decodes me.info and leaves KEY_CACHE_FILE alone
+void ConfigHandler::setKeyCache(bool on)
+{
+	keyCache = on;
+}
+
 // regFlag - represents successful registeration (or reconnect)
 bool ConfigHandler::getFlag() const
 {
+	std::lock_guard<std::mutex> guard(stateLock);
 	return regFlag;
 }
 
+// read timeout getter
+std::chrono::milliseconds ConfigHandler::getTimeout() const
+{
+	return timeout;
+}
+
+// read timeout setter
+void ConfigHandler::setTimeout(std::chrono::milliseconds t)
+{
+	timeout = t;
+}
+
+// socket write size getter
+size_t ConfigHandler::getSendChunk() const
+{
+	return sendChunk;
+}
+
+// socket write size setter - 0 lets the send engine pick
+void ConfigHandler::setSendChunk(size_t size)
+{
+	sendChunk = size;
+}
+
+// socket send buffer getter
+size_t ConfigHandler::getSendBuffer() const
+{
+	return sendBuffer;
+}
+
+// socket send buffer setter - 0 keeps the system default
+void ConfigHandler::setSendBuffer(size_t size)
+{
+	sendBuffer = size;
+}
+
+// compression getter
+bool ConfigHandler::getCompress() const
+{
+	return compress;
+}
+
+// compression setter - off sends every file as is
+void ConfigHandler::setCompress(bool on)
+{
+	compress = on;
+}
+
+// deduplication getter
+bool ConfigHandler::getDedup() const
+{
+	return dedup;
+}
+
+// deduplication setter - on splits large files into chunks and only uploads those the server lacks
+void ConfigHandler::setDedup(bool on)
+{
+	dedup = on;
+}
+
+// key pool getter
+KeyPool* ConfigHandler::getKeyPool() const
+{
+	return keyPool;
+}
+
+// resumption ticket getter
+TicketStore* ConfigHandler::getTickets()
+{
+	return &tickets;
+}
+
+// key pool setter - NULL generates keys during registration
+void ConfigHandler::setKeyPool(KeyPool* pool)
+{
+	keyPool = pool;
+}
+
 // flip bool value of regflag
 void ConfigHandler::flipFlag()
 {
+	std::lock_guard<std::mutex> guard(stateLock);
 	regFlag = !regFlag;
 }
 
 // UID setter
 void ConfigHandler::setUID(const std::string& UID)
 {
-	this->UID = std::string(UID.data(), UID.data() + UID_SIZE);
+	std::string next(UID.data(), UID.data() + UID_SIZE);
+	std::lock_guard<std::mutex> guard(stateLock);
+	if (next != this->UID) dirty = true;
+	this->UID = next;
 }
 
 // privkey setter
 void ConfigHandler::setKey(CryptoPP::RSA::PrivateKey k)
 {
+	std::lock_guard<std::mutex> guard(keyLock);
 	privKey = CryptoPP::RSA::PrivateKey(k);
+	keyLoaded = true;
+	std::lock_guard<std::mutex> state(stateLock);
+	dirty = true;
 }
 
 // sets keyFlag - key exchange success
 void ConfigHandler::keySuccess()
 {
+	std::lock_guard<std::mutex> guard(stateLock);
 	keyFlag = true;
 }
 
@@ -256,3 +428,13 @@ bool FileExists(const std::string& filename)
 	}
 }
 
+// SHA-256 of the base64 key text as me.info holds it, line breaks left out - heads KEY_CACHE_FILE so the copy is only
+// used for the key it was made from
+std::string keyDigest(const std::string& text)
+{
+	std::string joined;
+	std::remove_copy(text.begin(), text.end(), std::back_inserter(joined), '\n');
+	CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+	CryptoPP::SHA256().CalculateDigest(digest, (const CryptoPP::byte*)joined.data(), joined.size());
+	return std::string((const char*)digest, sizeof(digest));
+}
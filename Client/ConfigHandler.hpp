@@ -2,10 +2,15 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
 #include "cryptlib.h"
 #include "rsa.h"
+#include "Ticket.hpp"
 
 class Session;
+class KeyPool;
 
 class ConfigHandler
 {
@@ -15,25 +20,61 @@ private:
 	std::fstream me;
 	std::string IP;
 	std::string name;
-	std::string path;
+	std::vector<std::string> paths; // every file to upload, directories and manifests already expanded
+	std::vector<std::string> roots; // files and directories as listed, manifests expanded - what the daemon watches
+	std::vector<std::string> directories; // those of them that are directories, files found under one are named after their path in it
 	std::string port;
 	std::string UID;
 	CryptoPP::RSA::PrivateKey privKey;
+	std::string keyText; // base64 key as read from me.info, only decoded once a session needs the key
+	bool keyLoaded; // privKey holds the key
+	bool keyCache; // keep KEY_CACHE_FILE next to me.info
+	bool dirty; // UID or key differ from what me.info holds
+	std::mutex keyLock; // sessions unwrapping their AES keys at once, the first one loads it
+	mutable std::mutex stateLock; // UID and the flags - a daemon's restarted lead reconnects while other sessions send requests
+	std::chrono::milliseconds timeout; // how long reads wait for the server
+	size_t sendChunk; // bytes per socket write, 0 adapts it to the measured throughput
+	size_t sendBuffer; // SO_SNDBUF, 0 keeps the system default
+	bool compress; // deflate files that shrink before encrypting them
+	bool dedup; // upload large files as content defined chunks the server may already hold
+	KeyPool* keyPool; // where sendKey takes its key from, NULL generates one on the spot
+	TicketStore tickets; // lets reconnects skip RSA
 
 	bool regFlag;
 	bool keyFlag;
 	void HandleTransfer();
+	void addPath(const std::string&, int depth);
+	void loadKey();
+	void checkNames() const;
 public:
 	ConfigHandler();
 	~ConfigHandler();
 	std::string getName() const;
 	std::string getIP() const;
 	std::string getPort() const;
-	std::string getPath() const;
+	const std::vector<std::string>& getPaths() const;
+	const std::vector<std::string>& getRoots() const;
+	std::string storedName(const std::string& path) const;
 	std::string getUID() const;
-	CryptoPP::RSA::PrivateKey getKey() const;
+	const CryptoPP::RSA::PrivateKey& getKey();
 	void setKey(CryptoPP::RSA::PrivateKey);
+	bool getKeyCache() const;
+	void setKeyCache(bool);
+	void save();
 	bool getFlag() const;
+	std::chrono::milliseconds getTimeout() const;
+	void setTimeout(std::chrono::milliseconds);
+	size_t getSendChunk() const;
+	void setSendChunk(size_t);
+	size_t getSendBuffer() const;
+	void setSendBuffer(size_t);
+	bool getCompress() const;
+	void setCompress(bool);
+	bool getDedup() const;
+	void setDedup(bool);
+	KeyPool* getKeyPool() const;
+	void setKeyPool(KeyPool*);
+	TicketStore* getTickets();
 	void flipFlag();
 	void setUID(const std::string&);
 	void keySuccess();
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include "Delta.hpp"
+#include "MappedFile.hpp"
+#include "sha.h"
+
+#define ADLER_MOD 65521
+
+// a byte wise view of a mapped file, remapping as the position leaves the current window
+// the scan keeps one for each edge of the rolling window so neither keeps evicting the other
+struct Cursor
+{
+	MappedFile file;
+	const char* view;
+	uint64_t start;
+	uint64_t end;
+	Cursor(const std::string& path) : file(path), view(NULL), start(0), end(0) {}
+	const unsigned char* at(uint64_t pos, size_t& available)
+	{
+		if (pos < start or pos >= end)
+		{
+			view = file.map(pos, available);
+			start = pos;
+			end = pos + available;
+		}
+		available = (size_t)(end - pos);
+		return reinterpret_cast<const unsigned char*>(view + (pos - start));
+	}
+	unsigned char at(uint64_t pos)
+	{
+		if (pos - start < end - start) return (unsigned char)view[pos - start]; // the common case, no call
+		size_t available;
+		return *at(pos, available);
+	}
+	// size bytes at pos in one piece, copied into stage if they cross a window
+	const unsigned char* range(uint64_t pos, size_t size, std::vector<unsigned char>& stage)
+	{
+		size_t available;
+		const unsigned char* p = at(pos, available);
+		if (available >= size) return p;
+		stage.resize(size);
+		for (size_t copied = 0; copied < size; copied += available)
+		{
+			p = at(pos + copied, available);
+			available = std::min(available, size - copied);
+			memcpy(stage.data() + copied, p, available);
+		}
+		return stage.data();
+	}
+};
+
+// Adler-32 as zlib computes it - b in the high half, a in the low one
+uint32_t Delta::weak(const unsigned char* data, size_t size)
+{
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		a = (a + data[i]) % ADLER_MOD;
+		b = (b + a) % ADLER_MOD;
+	}
+	return (b << 16) | a;
+}
+
+// first STRONG_SIZE bytes of the SHA-256
+void Delta::strong(const unsigned char* data, size_t size, unsigned char* out)
+{
+	CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+	CryptoPP::SHA256().CalculateDigest(digest, data, size);
+	memcpy(out, digest, STRONG_SIZE);
+}
+
+// scans the new file for blocks the server already has, consecutive matching blocks become a single copy run
+// a window that matches nothing rolls on by one byte: a' = a - out + in, b' = b - block * out + a' - 1
+// both are kept exact so the roll is three additions, only the lookup reduces them modulo 65521
+void Delta::diff(const std::string& path, uint32_t block, const std::vector<Signature>& signatures, std::vector<Op>& ops, ChunkedCksum& crc)
+{
+	ops.clear();
+	Cursor tail(path), head(path); // first byte of the window, first byte past it
+	uint64_t size = tail.file.size();
+	for (uint64_t offset = 0; offset < size;) // checksum pass, the scan jumps over matched blocks
+	{
+		size_t available;
+		const unsigned char* p = head.at(offset, available);
+		crc.update(p, available);
+		offset += available;
+	}
+	crc.finish();
+	std::unordered_map<uint32_t, std::vector<uint32_t>> table; // weak checksum to block indexes
+	std::vector<uint64_t> filter(((size_t)1 << DELTA_FILTER_BITS) / 64); // cheap first test, most windows fail it
+	auto slot = [](uint32_t sum) { return (sum * 0x9E3779B1u) >> (32 - DELTA_FILTER_BITS); }; // spreads both halves over the filter
+	for (uint32_t i = 0; i < signatures.size(); i++)
+	{
+		table[signatures[i].weak].push_back(i);
+		filter[slot(signatures[i].weak) / 64] |= 1ULL << (slot(signatures[i].weak) % 64);
+	}
+	std::vector<unsigned char> stage;
+	uint64_t literal = 0; // start of the bytes not covered by a copy yet
+	uint64_t pos = 0;
+	bool fresh = true; // the window has to be summed from scratch
+	uint64_t a = 0, b = 0; // exact sums, never reduced - b stays below block squared times 255
+	auto emit = [&ops](bool copy, uint64_t start, uint64_t length)
+	{
+		if (!length) return;
+		if (!ops.empty() and ops.back().copy == copy and ops.back().start + ops.back().length == start)
+			ops.back().length += length; // literals and copies both merge with a directly preceding neighbour
+		else
+			ops.push_back({ copy, start, length });
+	};
+	while (pos + block <= size)
+	{
+		if (fresh)
+		{
+			const unsigned char* p = tail.range(pos, block, stage);
+			a = 1;
+			b = 0;
+			for (uint32_t i = 0; i < block; i++)
+			{
+				a += p[i];
+				b += a;
+			}
+			fresh = false;
+		}
+		uint32_t sum = (uint32_t)(b % ADLER_MOD << 16 | a % ADLER_MOD); // off the a and b dependency chain
+		if (filter[slot(sum) / 64] >> (slot(sum) % 64) & 1)
+		{
+			auto found = table.find(sum);
+			if (found != table.end())
+			{
+				unsigned char digest[STRONG_SIZE];
+				strong(tail.range(pos, block, stage), block, digest);
+				auto match = std::find_if(found->second.begin(), found->second.end(),
+					[&](uint32_t i) { return !memcmp(signatures[i].strong, digest, STRONG_SIZE); });
+				if (match != found->second.end())
+				{
+					emit(false, literal, pos - literal);
+					emit(true, *match, 1);
+					pos += block;
+					literal = pos;
+					fresh = true;
+					continue;
+				}
+			}
+		}
+		if (pos + block == size) break;
+		uint64_t out = tail.at(pos), in = head.at(pos + block);
+		a = a + in - out;
+		b = b + a - 1 - block * out;
+		pos++;
+	}
+	emit(false, literal, size - literal);
+}
+
+// bytes the instruction stream takes on the wire
+uint64_t Delta::encodedSize(const std::vector<Op>& ops)
+{
+	uint64_t size = 0;
+	for (const Op& op : ops)
+		size += op.copy ? OP_SIZE + INDEX_SIZE + COUNT_SIZE : OP_SIZE + LENGTH_SIZE + op.length;
+	return size;
+}
+
+// new bytes the delta carries
+uint64_t Delta::literalSize(const std::vector<Op>& ops)
+{
+	uint64_t size = 0;
+	for (const Op& op : ops)
+		if (!op.copy) size += op.length;
+	return size;
+}
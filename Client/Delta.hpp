@@ -0,0 +1,32 @@
+// rsync style delta of a file against block signatures of the copy the server holds
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "defs.hpp"
+#include "Cksum.hpp"
+
+// The server cuts its copy into fixed blocks and sends an Adler-32 and a truncated SHA-256 of each
+// the new file is scanned with the rolling Adler-32, a block only matches if the strong hash agrees too
+// the result is a list of copy runs of whole blocks and literal ranges of the new file, in file order
+class Delta
+{
+public:
+	struct Signature
+	{
+		uint32_t weak;
+		unsigned char strong[STRONG_SIZE];
+	};
+	struct Op
+	{
+		bool copy;
+		uint64_t start; // first block for a copy, file offset for a literal
+		uint64_t length; // blocks for a copy, bytes for a literal
+	};
+	static uint32_t weak(const unsigned char* data, size_t size);
+	static void strong(const unsigned char* data, size_t size, unsigned char* out);
+	static void diff(const std::string& path, uint32_t block, const std::vector<Signature>& signatures, std::vector<Op>& ops, ChunkedCksum& crc);
+	static uint64_t encodedSize(const std::vector<Op>& ops);
+	static uint64_t literalSize(const std::vector<Op>& ops);
+};
@@ -0,0 +1,98 @@
+#include <filesystem>
+#include <fstream>
+#include "FileUtil.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// flushes path's data to the disk - on POSIX a directory works too, making a rename in it durable
+static bool sync(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	bool done = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return done;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	bool done = fsync(fd) == 0;
+	close(fd);
+	return done;
+#endif
+}
+
+// writes contents to path through path.tmp - ownerOnly limits the permissions before anything is written
+// the temporary file reaches the disk before it's renamed, and the rename before we return, so after a crash path
+// holds either the old contents or the new ones - false if it couldn't be written, the old file is left as it was
+bool replaceFile(const std::string& path, const std::string& contents, bool ownerOnly)
+{
+	std::string temp = path + ".tmp";
+	std::error_code ec;
+	{
+		std::ofstream out(temp, std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!out.is_open()) return false;
+		if (ownerOnly) std::filesystem::permissions(temp, std::filesystem::perms::owner_read | std::filesystem::perms::owner_write, ec);
+		out.write(contents.data(), contents.size());
+		out.close();
+		if (!out or !sync(temp))
+		{
+			std::filesystem::remove(temp, ec);
+			return false;
+		}
+	}
+#ifdef _WIN32
+	if (MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) return true;
+#else
+	std::filesystem::rename(temp, path, ec);
+	if (!ec)
+	{
+		std::string dir = std::filesystem::path(path).parent_path().string();
+		sync(dir.empty() ? "." : dir); // the file is in place either way, this only makes the rename itself durable
+		return true;
+	}
+#endif
+	std::filesystem::remove(temp, ec);
+	return false;
+}
+
+// lowercase hex of len bytes
+std::string toHex(const void* data, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	const unsigned char* bytes = (const unsigned char*)data;
+	std::string hex;
+	hex.reserve(len * 2);
+	for (size_t i = 0; i < len; i++)
+	{
+		hex.push_back(digits[bytes[i] >> 4]);
+		hex.push_back(digits[bytes[i] & 15]);
+	}
+	return hex;
+}
+
+static int nibble(char c)
+{
+	if ('0' <= c and c <= '9') return c - '0';
+	if ('a' <= c and c <= 'f') return c - 'a' + 10;
+	if ('A' <= c and c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// parses exactly len bytes of hex in either case, false on anything else
+bool fromHex(const std::string& hex, void* data, size_t len)
+{
+	if (hex.size() != len * 2) return false;
+	unsigned char* bytes = (unsigned char*)data;
+	for (size_t i = 0; i < len; i++)
+	{
+		int hi = nibble(hex[i * 2]), lo = nibble(hex[i * 2 + 1]);
+		if (hi < 0 or lo < 0) return false;
+		bytes[i] = (unsigned char)(hi << 4 | lo);
+	}
+	return true;
+}
@@ -0,0 +1,10 @@
+// Small file and encoding helpers shared by the state files the client keeps next to me.info
+#pragma once
+#include <cstddef>
+#include <string>
+
+// every state file (me.info, me.der, the journal, the ticket, the key pool, the metrics export) is replaced as a whole:
+// written to a temporary file next to it and renamed over it, so a crash never leaves half of one behind
+bool replaceFile(const std::string& path, const std::string& contents, bool ownerOnly = true);
+std::string toHex(const void* data, size_t len);
+bool fromHex(const std::string& hex, void* data, size_t len);
@@ -4,13 +4,13 @@
 #include <string.h>
 
 // creates Client Header with given params
-Header generateHeader(const char* UID, uint16_t code, uint32_t size)
+Header generateHeader(const char* UID, uint16_t code, uint32_t size, uint8_t version)
 {
 	Header header;
 	strncpy(header.UID, UID, UID_SIZE);
 	header.code = code;
 	header.size = size;
-	header.version = CLIENT_VER;
+	header.version = version;
 	return header;
 }
 #undef _CRT_SECURE_NO_WARNINGS
\ No newline at end of file
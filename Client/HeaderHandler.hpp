@@ -22,4 +22,4 @@ struct ServerHeader
 };
 #pragma pack(pop)
 
-Header generateHeader(const char*, uint16_t , uint32_t);
\ No newline at end of file
+Header generateHeader(const char*, uint16_t , uint32_t, uint8_t);
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "FileUtil.hpp"
+#include "Journal.hpp"
+
+// loads whatever a previous run left behind - a missing or damaged journal just means nothing to resume
+Journal::Journal(const std::string& file) : file(file)
+{
+	std::ifstream in(file);
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		Entry entry;
+		std::string nonce, path;
+		if (!(fields >> entry.size >> entry.mtime >> nonce >> entry.sent)) continue;
+		fields.get(); // single separator before the path, which may itself hold spaces
+		if (!std::getline(fields, path) or path.empty()) continue;
+		if (fromHex(nonce, entry.nonce, NONCE_SIZE)) entries[path] = entry;
+	}
+}
+
+// rewrites the journal through a temporary file so a crash mid write can't lose older entries
+void Journal::save()
+{
+	std::ostringstream out;
+	for (auto& e : entries)
+		out << e.second.size << ' ' << e.second.mtime << ' ' << toHex(e.second.nonce, NONCE_SIZE) << ' ' << e.second.sent << ' ' << e.first << '\n';
+	if (!replaceFile(file, out.str())) std::cout << "Warning: Couldn't write " << file << ", interrupted transfers will restart" << std::endl;
+}
+
+// entry for path, only if the file still has the size and mtime it had when the transfer started
+bool Journal::find(const std::string& path, Entry& entry)
+{
+	Entry current;
+	if (!identify(path, current)) return false;
+	std::lock_guard<std::mutex> guard(lock);
+	auto it = entries.find(path);
+	if (it == entries.end()) return false;
+	if (it->second.size != current.size or it->second.mtime != current.mtime) return false; // file changed since
+	entry = it->second;
+	return true;
+}
+
+void Journal::record(const std::string& path, const Entry& entry)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	entries[path] = entry;
+	save();
+}
+
+void Journal::remove(const std::string& path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (entries.erase(path)) save();
+}
+
+// fills in size and modification time of path
+bool Journal::identify(const std::string& path, Entry& entry)
+{
+	std::error_code ec;
+	entry.size = std::filesystem::file_size(path, ec);
+	if (ec) return false;
+	auto time = std::filesystem::last_write_time(path, ec);
+	if (ec) return false;
+	entry.mtime = (int64_t)time.time_since_epoch().count();
+	entry.sent = 0;
+	return true;
+}
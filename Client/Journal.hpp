@@ -0,0 +1,33 @@
+// Local record of partially sent files so an interrupted upload can pick up where it stopped
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include "defs.hpp"
+
+// One line per file in progress: size, modification time, CTR nonce, bytes handed to the socket and the path
+// size and mtime identify the file, nonce and offset are the whole CTR cipher state at a block boundary
+// the server has the final say on how much it persisted, the journal only tells us which nonce to continue under
+class Journal
+{
+public:
+	struct Entry
+	{
+		uint64_t size;
+		int64_t mtime;
+		unsigned char nonce[NONCE_SIZE];
+		uint64_t sent;
+	};
+private:
+	std::string file;
+	std::mutex lock; // shared by all sessions of a run
+	std::map<std::string, Entry> entries;
+	void save();
+public:
+	Journal(const std::string& file = JOURNAL_FILE);
+	bool find(const std::string& path, Entry& entry);
+	void record(const std::string& path, const Entry& entry);
+	void remove(const std::string& path);
+	static bool identify(const std::string& path, Entry& entry);
+};
@@ -0,0 +1,172 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include "FileUtil.hpp"
+#include "KeyPool.hpp"
+#include "base64.h"
+#include "osrng.h"
+
+// Exclusive lock file next to the pool - held for the few microseconds a pop or push takes
+// a lock left behind by a crashed process is broken once it is older than KEY_POOL_LOCK_STALE
+class PoolLock
+{
+private:
+	std::string path;
+	bool held;
+public:
+	PoolLock(const std::string& pool) : path(pool + ".lock"), held(false)
+	{
+		auto start = std::chrono::steady_clock::now();
+		while (true)
+		{
+			FILE* f = fopen(path.c_str(), "wx"); // fails if the file already exists
+			if (f)
+			{
+				fclose(f);
+				held = true;
+				return;
+			}
+			std::error_code ec;
+			auto written = std::filesystem::last_write_time(path, ec);
+			if (!ec and std::filesystem::file_time_type::clock::now() - written > std::chrono::milliseconds(KEY_POOL_LOCK_STALE))
+				std::filesystem::remove(path, ec);
+			if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(KEY_POOL_LOCK_STALE * 2))
+				throw std::runtime_error("Couldn't lock the key pool");
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	~PoolLock()
+	{
+		std::error_code ec;
+		if (held) std::filesystem::remove(path, ec);
+	}
+};
+
+KeyPool::KeyPool(const std::string& file) : file(file), refilling(false)
+{
+}
+
+// waits for a running refill so it never leaves a half written pool behind
+KeyPool::~KeyPool()
+{
+	if (refiller.joinable()) refiller.join();
+}
+
+bool KeyPool::exists(const std::string& file)
+{
+	std::error_code ec;
+	return std::filesystem::exists(file, ec);
+}
+
+// a fresh keypair, the slow path the pool exists to avoid
+CryptoPP::RSA::PrivateKey KeyPool::generate()
+{
+	CryptoPP::AutoSeededRandomPool rng;
+	CryptoPP::InvertibleRSAFunction params;
+	params.GenerateRandomWithKeySize(rng, RSA_SIZE);
+	return CryptoPP::RSA::PrivateKey(params);
+}
+
+size_t KeyPool::count()
+{
+	std::ifstream in(file);
+	std::string line;
+	size_t n = 0;
+	while (std::getline(in, line))
+		if (!line.empty()) n++;
+	return n;
+}
+
+// replaces the pool in one rename, with permissions limited to the owner before any key is written
+void KeyPool::rewrite(const std::string& contents)
+{
+	if (!replaceFile(file, contents)) throw std::runtime_error("Couldn't write the key pool");
+}
+
+// takes the first stored key - false if the pool is empty or unusable
+bool KeyPool::pop(CryptoPP::RSA::PrivateKey& key)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	try
+	{
+		PoolLock fileLock(file);
+		std::ifstream in(file);
+		std::string first, line;
+		while (first.empty() and std::getline(in, line))
+			first = line;
+		if (first.empty()) return false;
+		std::string remaining((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		in.close();
+		CryptoPP::Base64Decoder d;
+		d.Put((CryptoPP::byte*)first.data(), first.size());
+		d.MessageEnd();
+		key.Load(d);
+		rewrite(remaining); // gone from the pool before anyone uses it
+		return true;
+	}
+	catch (std::exception const& error)
+	{
+		std::cout << "Warning: Key pool unusable, generating a key instead:" << error.what() << std::endl;
+		return false;
+	}
+}
+
+// appends a key to the pool
+void KeyPool::push(const CryptoPP::RSA::PrivateKey& key)
+{
+	std::string der, encoded;
+	CryptoPP::StringSink ss(der);
+	key.Save(ss);
+	CryptoPP::Base64Encoder e(new CryptoPP::StringSink(encoded), false); // no line breaks - one key per line
+	e.Put((CryptoPP::byte*)der.data(), der.size());
+	e.MessageEnd();
+	std::lock_guard<std::mutex> guard(lock);
+	PoolLock fileLock(file);
+	std::ifstream in(file, std::ios::in | std::ios::binary); // may not exist yet
+	std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	contents.append(encoded).push_back('\n');
+	rewrite(contents);
+}
+
+size_t KeyPool::size()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return count();
+}
+
+// generates keys until the pool holds target of them, returns how many were added
+size_t KeyPool::fill(size_t target)
+{
+	size_t added = 0;
+	while (size() < target)
+	{
+		push(generate()); // keygen runs without any lock held
+		added++;
+	}
+	return added;
+}
+
+// tops the pool back up on a background thread - a refill already running is left to finish the job
+void KeyPool::refillAsync(size_t target)
+{
+	if (refilling.exchange(true)) return;
+	if (refiller.joinable()) refiller.join(); // the last refill is done, only its thread is left
+	refiller = std::thread([this, target]()
+	{
+		try
+		{
+			fill(target);
+		}
+		catch (std::exception const& error)
+		{
+			std::cout << "Warning: Couldn't refill the key pool:" << error.what() << std::endl;
+		}
+		refilling = false;
+	});
+}
+#undef _CRT_SECURE_NO_WARNINGS
@@ -0,0 +1,36 @@
+// Pre-generated RSA keypairs so registration doesn't wait on keygen
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "cryptlib.h"
+#include "rsa.h"
+#include "defs.hpp"
+
+// Keys live in KEY_POOL_FILE, one base64 DER private key per line, readable by the owner only
+// every change rewrites the file through a temporary one while holding a lock file,
+// so clients provisioned side by side never pop the same key
+class KeyPool
+{
+private:
+	std::string file;
+	std::mutex lock; // the refill thread and pop within this process
+	std::thread refiller;
+	std::atomic<bool> refilling;
+	size_t count(); // keys currently stored, caller holds both locks
+	void rewrite(const std::string& contents);
+public:
+	KeyPool(const std::string& file = KEY_POOL_FILE);
+	~KeyPool();
+	KeyPool(const KeyPool&) = delete;
+	KeyPool& operator=(const KeyPool&) = delete;
+	bool pop(CryptoPP::RSA::PrivateKey& key);
+	void push(const CryptoPP::RSA::PrivateKey& key);
+	size_t fill(size_t target);
+	void refillAsync(size_t target);
+	size_t size();
+	static CryptoPP::RSA::PrivateKey generate();
+	static bool exists(const std::string& file = KEY_POOL_FILE);
+};
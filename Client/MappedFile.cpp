@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include "MappedFile.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+bool MappedFile::copying = false;
+#endif
+
+// opens the file and learns its size - nothing is mapped until the first call to map
+MappedFile::MappedFile(const std::string& path) : fileSize(0), view(NULL), viewOffset(0), viewSize(0)
+{
+	std::string error = "Couldn't open file:" + path;
+#ifdef _WIN32
+	mapping = NULL;
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) throw std::runtime_error(error.c_str());
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		throw std::runtime_error(error.c_str());
+	}
+	fileSize = (uint64_t)size.QuadPart;
+	if (fileSize) mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (fileSize && !mapping)
+	{
+		CloseHandle(file);
+		throw std::runtime_error(error.c_str());
+	}
+#else
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error(error.c_str());
+	struct stat st;
+	if (fstat(fd, &st))
+	{
+		close(fd);
+		throw std::runtime_error(error.c_str());
+	}
+	fileSize = (uint64_t)st.st_size;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	unmap();
+#ifdef _WIN32
+	if (mapping) CloseHandle(mapping);
+	CloseHandle(file);
+#else
+	close(fd);
+#endif
+}
+
+void MappedFile::unmap()
+{
+	if (!view) return;
+#ifdef _WIN32
+	UnmapViewOfFile(view);
+#else
+	if (view != buffer.data()) munmap((void*)view, viewSize);
+#endif
+	view = NULL;
+}
+
+// read windows into a buffer rather than mapping them, for files that may change while they're sent - set before
+// any MappedFile is opened
+void MappedFile::setCopying(bool on)
+{
+#ifndef _WIN32
+	copying = on;
+#endif
+}
+
+// file size as of opening it
+uint64_t MappedFile::size() const
+{
+	return fileSize;
+}
+
+// returns a pointer to the byte at offset and sets available to how many bytes can be read from it
+// the window containing offset is mapped (or read) if it isn't already, replacing the previous one
+const char* MappedFile::map(uint64_t offset, size_t& available)
+{
+	if (offset >= fileSize)
+	{
+		available = 0;
+		return NULL;
+	}
+#ifdef _WIN32
+	uint64_t window = MAP_WINDOW;
+#else
+	uint64_t window = copying ? READ_WINDOW : MAP_WINDOW;
+#endif
+	uint64_t base = offset - offset % window;
+	if (!view || base != viewOffset)
+	{
+		unmap();
+		viewOffset = base;
+		viewSize = (size_t)std::min<uint64_t>(window, fileSize - base);
+#ifdef _WIN32
+		view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(base >> 32), (DWORD)base, viewSize);
+		if (!view) throw std::runtime_error("Couldn't map file");
+#else
+		if (copying)
+		{
+			buffer.resize(viewSize);
+			for (size_t got = 0; got < viewSize;)
+			{
+				ssize_t read = pread(fd, buffer.data() + got, viewSize - got, (off_t)(base + got));
+				if (read < 0 and errno == EINTR) continue;
+				if (read <= 0) throw std::runtime_error("File changed while reading it"); // truncated, shorter than when opened
+				got += (size_t)read;
+			}
+			view = buffer.data();
+		}
+		else
+		{
+			void* p = mmap(NULL, viewSize, PROT_READ, MAP_PRIVATE, fd, (off_t)base);
+			if (p == MAP_FAILED) throw std::runtime_error("Couldn't map file");
+			view = (const char*)p;
+			madvise(p, viewSize, MADV_SEQUENTIAL); // aggressive readahead, pages behind us can be dropped early
+#ifdef MADV_HUGEPAGE
+			madvise(p, viewSize, MADV_HUGEPAGE);
+#endif
+		}
+#endif
+	}
+	available = (size_t)(viewOffset + viewSize - offset);
+	return view + (offset - viewOffset);
+}
@@ -0,0 +1,37 @@
+// Read only memory mapped view of a file, mapped one window at a time
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "defs.hpp"
+
+// windows are MAP_WINDOW bytes at MAP_WINDOW aligned offsets - a multiple of 2Mb so the kernel can back them with huge pages
+// and files larger than the address space we're willing to spend still stream through
+// with copying set windows of READ_WINDOW bytes are read into a buffer instead - a mapped file truncated under us
+// raises SIGBUS on POSIX, a short read only throws (Windows refuses to truncate a mapped file, it always maps)
+class MappedFile
+{
+private:
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int fd;
+	std::vector<char> buffer; // the window, when copying
+	static bool copying;
+#endif
+	uint64_t fileSize;
+	const char* view; // currently mapped window
+	uint64_t viewOffset;
+	size_t viewSize;
+	void unmap();
+public:
+	MappedFile(const std::string& path);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	uint64_t size() const;
+	const char* map(uint64_t offset, size_t& available);
+	static void setCopying(bool on);
+};
@@ -0,0 +1,202 @@
+#include "Metrics.hpp"
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "defs.hpp"
+#include "FileUtil.hpp"
+
+namespace
+{
+	struct Histogram
+	{
+		std::vector<uint64_t> buckets; // one per bound, not cumulative, the last one past every bound
+		double sum = 0;
+		uint64_t count = 0;
+	};
+
+	struct Description
+	{
+		const char* name;
+		const char* help;
+		const char* label;
+	};
+
+	const std::vector<double> SECONDS = { 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 60 };
+	const std::vector<double> SIZES = { 1024, 16384, 65536, 262144, 1048576, 4194304, 16777216, 67108864, 268435456, 1073741824, 4294967296 };
+	const std::vector<double> TRIES = { 0, 1, 2, 3, 5, 10 };
+
+	// in the order of Metrics::Family and Metrics::Counter
+	const Description families[Metrics::FAMILIES] = {
+		{ "step_seconds", "Time spent in each protocol step, waiting for the answer included", "step" },
+		{ "io_seconds", "Time blocked in socket calls", "call" },
+		{ "io_bytes", "Bytes moved per socket call", "call" },
+		{ "cpu_seconds", "Time spent on keygen, key unwrap, encryption and checksums", "task" },
+		{ "file_bytes", "Size of every file sent", "mode" },
+		{ "file_retries", "Retries spent on every file", "kind" } };
+	const std::vector<double>* bounds[Metrics::FAMILIES] = { &SECONDS, &SECONDS, &SIZES, &SECONDS, &SIZES, &TRIES };
+	const Description counters[Metrics::COUNTERS] = {
+		{ "retries_total", "Steps retried after an error or timeout", "step" },
+		{ "syscalls_total", "Socket calls made", "call" },
+		{ "bytes_total", "Bytes moved over the socket", "direction" },
+		{ "files_total", "Files by outcome", "outcome" } };
+
+	std::mutex lock;
+	std::map<std::string, Histogram> histograms[Metrics::FAMILIES];
+	std::map<std::string, uint64_t> totals[Metrics::COUNTERS];
+	std::chrono::system_clock::time_point started = std::chrono::system_clock::now();
+
+	std::string escape(const std::string& value)
+	{
+		std::string out;
+		for (char c : value)
+		{
+			if (c == '"' or c == '\\') out.push_back('\\');
+			out.push_back(c);
+		}
+		return out;
+	}
+
+	std::string number(double value)
+	{
+		std::ostringstream out;
+		out.precision(12);
+		out << value;
+		return out.str();
+	}
+
+	double elapsed()
+	{
+		return std::chrono::duration<double>(std::chrono::system_clock::now() - started).count();
+	}
+
+	double startTime()
+	{
+		return std::chrono::duration<double>(started.time_since_epoch()).count();
+	}
+}
+
+Metrics::Timer::Timer(Family family, const char* label) : family(family), label(label), start(std::chrono::steady_clock::now())
+{
+}
+
+Metrics::Timer::~Timer()
+{
+	std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+	observe(family, label, took.count());
+}
+
+void Metrics::observe(Family family, const std::string& label, double value)
+{
+	const std::vector<double>& b = *bounds[family];
+	size_t bucket = 0;
+	while (bucket < b.size() and value > b[bucket]) bucket++;
+	std::lock_guard<std::mutex> guard(lock);
+	Histogram& h = histograms[family][label];
+	if (h.buckets.empty()) h.buckets.resize(b.size() + 1);
+	h.buckets[bucket]++;
+	h.sum += value;
+	h.count++;
+}
+
+void Metrics::count(Counter counter, const std::string& label, uint64_t n)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	totals[counter][label] += n;
+}
+
+// forget everything recorded so far and start timing a new run
+void Metrics::reset()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& family : histograms)
+		family.clear();
+	for (auto& counter : totals)
+		counter.clear();
+	started = std::chrono::system_clock::now();
+}
+
+// Prometheus text exposition format, as read by node_exporter's textfile collector
+std::string Metrics::prometheus()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::ostringstream out;
+	out << "# HELP " METRICS_PREFIX "run_start_seconds Unix time the run started\n# TYPE " METRICS_PREFIX "run_start_seconds gauge\n"
+		<< METRICS_PREFIX "run_start_seconds " << number(startTime()) << "\n";
+	out << "# HELP " METRICS_PREFIX "run_seconds Length of the run\n# TYPE " METRICS_PREFIX "run_seconds gauge\n"
+		<< METRICS_PREFIX "run_seconds " << number(elapsed()) << "\n";
+	for (int c = 0; c < COUNTERS; c++)
+	{
+		std::string name = std::string(METRICS_PREFIX) + counters[c].name;
+		out << "# HELP " << name << " " << counters[c].help << "\n# TYPE " << name << " counter\n";
+		for (auto& total : totals[c])
+			out << name << "{" << counters[c].label << "=\"" << escape(total.first) << "\"} " << total.second << "\n";
+	}
+	for (int f = 0; f < FAMILIES; f++)
+	{
+		std::string name = std::string(METRICS_PREFIX) + families[f].name;
+		out << "# HELP " << name << " " << families[f].help << "\n# TYPE " << name << " histogram\n";
+		for (auto& entry : histograms[f])
+		{
+			std::string label = std::string(families[f].label) + "=\"" + escape(entry.first) + "\"";
+			uint64_t cumulative = 0;
+			for (size_t i = 0; i < entry.second.buckets.size(); i++)
+			{
+				cumulative += entry.second.buckets[i];
+				std::string le = i < bounds[f]->size() ? number((*bounds[f])[i]) : "+Inf";
+				out << name << "_bucket{" << label << ",le=\"" << le << "\"} " << cumulative << "\n";
+			}
+			out << name << "_sum{" << label << "} " << number(entry.second.sum) << "\n";
+			out << name << "_count{" << label << "} " << entry.second.count << "\n";
+		}
+	}
+	return out.str();
+}
+
+// the same numbers as one JSON object - buckets hold [upper bound, cumulative count] pairs, the last bound being null for +Inf
+std::string Metrics::json()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::ostringstream out;
+	out << "{\"run\":{\"start\":" << number(startTime()) << ",\"seconds\":" << number(elapsed()) << "},\"counters\":{";
+	for (int c = 0; c < COUNTERS; c++)
+	{
+		out << (c ? "," : "") << "\"" << counters[c].name << "\":{";
+		bool first = true;
+		for (auto& total : totals[c])
+		{
+			out << (first ? "" : ",") << "\"" << escape(total.first) << "\":" << total.second;
+			first = false;
+		}
+		out << "}";
+	}
+	out << "},\"histograms\":{";
+	for (int f = 0; f < FAMILIES; f++)
+	{
+		out << (f ? "," : "") << "\"" << families[f].name << "\":{";
+		bool first = true;
+		for (auto& entry : histograms[f])
+		{
+			out << (first ? "" : ",") << "\"" << escape(entry.first) << "\":{\"count\":" << entry.second.count
+				<< ",\"sum\":" << number(entry.second.sum) << ",\"buckets\":[";
+			uint64_t cumulative = 0;
+			for (size_t i = 0; i < entry.second.buckets.size(); i++)
+			{
+				cumulative += entry.second.buckets[i];
+				out << (i ? "," : "") << "[" << (i < bounds[f]->size() ? number((*bounds[f])[i]) : "null") << "," << cumulative << "]";
+			}
+			out << "]}";
+			first = false;
+		}
+		out << "}";
+	}
+	out << "}}\n";
+	return out.str();
+}
+
+// writes the export next to its final name and renames it into place, so a collector never reads half a file
+bool Metrics::write(const std::string& path)
+{
+	bool asJson = path.size() >= 5 and path.compare(path.size() - 5, 5, ".json") == 0;
+	return replaceFile(path, asJson ? json() : prometheus(), false); // collectors may run as another user
+}
@@ -0,0 +1,50 @@
+// Process wide counters and histograms of where a run spends its time, exported once the run is over
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Histograms have fixed bucket bounds per family and are keyed by a label within it, e.g. the protocol step
+// recording takes a lock, so it belongs around whole steps and socket calls, not around single blocks
+// the export is a Prometheus textfile, or JSON when the path ends in .json, written through a temporary and renamed
+class Metrics
+{
+public:
+	enum Family
+	{
+		STEP_SECONDS, // each protocol step in runProtocol, reads of the answer included
+		IO_SECONDS, // time blocked in a socket call
+		IO_BYTES, // bytes moved per socket call
+		CPU_SECONDS, // keygen, key unwrap, encryption and checksums
+		FILE_BYTES, // size of every file sent
+		FILE_RETRIES, // retries spent on every file
+		FAMILIES
+	};
+	enum Counter
+	{
+		STEP_RETRIES, // per protocol step
+		SYSCALLS, // socket calls per kind
+		BYTES, // bytes per direction
+		FILES, // files per outcome
+		COUNTERS
+	};
+	// adds the time from construction to destruction to a histogram
+	class Timer
+	{
+	private:
+		Family family;
+		const char* label;
+		std::chrono::steady_clock::time_point start;
+	public:
+		Timer(Family family, const char* label);
+		~Timer();
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+	};
+	static void observe(Family family, const std::string& label, double value);
+	static void count(Counter counter, const std::string& label, uint64_t n = 1);
+	static void reset();
+	static std::string prometheus();
+	static std::string json();
+	static bool write(const std::string& path);
+};
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include "MultiCBC.hpp"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define MULTI_CBC_X86
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AESNI_TARGET
+#else
+#include <cpuid.h>
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+#endif
+
+namespace
+{
+	// blocks of one stream waiting to be encrypted, done once a thread has taken care of them
+	struct Job
+	{
+		MultiCBC::Stream* stream;
+		const char* in;
+		char* out;
+		size_t blocks;
+		bool done;
+	};
+
+	std::mutex lock; // pending and every done flag
+	std::condition_variable finished;
+	std::deque<Job*> pending;
+
+#ifdef MULTI_CBC_X86
+	// AES-NI, checked once
+	bool haveAESNI()
+	{
+		unsigned int ecx;
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuid(regs, 1);
+		ecx = (unsigned int)regs[2];
+#else
+		unsigned int eax, ebx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+#endif
+		return (ecx & (1 << 25)) != 0;
+	}
+
+	// next round key from the previous one and the keygen assist of it
+	AESNI_TARGET inline __m128i expandStep(__m128i key, __m128i assist)
+	{
+		assist = _mm_shuffle_epi32(assist, 0xff);
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		return _mm_xor_si128(key, assist);
+	}
+
+	AESNI_TARGET void expand(const unsigned char* key, unsigned char* schedule)
+	{
+		__m128i* rk = (__m128i*)schedule;
+		rk[0] = _mm_loadu_si128((const __m128i*)key);
+		// the round constant has to be an immediate
+		rk[1] = expandStep(rk[0], _mm_aeskeygenassist_si128(rk[0], 0x01));
+		rk[2] = expandStep(rk[1], _mm_aeskeygenassist_si128(rk[1], 0x02));
+		rk[3] = expandStep(rk[2], _mm_aeskeygenassist_si128(rk[2], 0x04));
+		rk[4] = expandStep(rk[3], _mm_aeskeygenassist_si128(rk[3], 0x08));
+		rk[5] = expandStep(rk[4], _mm_aeskeygenassist_si128(rk[4], 0x10));
+		rk[6] = expandStep(rk[5], _mm_aeskeygenassist_si128(rk[5], 0x20));
+		rk[7] = expandStep(rk[6], _mm_aeskeygenassist_si128(rk[6], 0x40));
+		rk[8] = expandStep(rk[7], _mm_aeskeygenassist_si128(rk[7], 0x80));
+		rk[9] = expandStep(rk[8], _mm_aeskeygenassist_si128(rk[8], 0x1b));
+		rk[10] = expandStep(rk[9], _mm_aeskeygenassist_si128(rk[9], 0x36));
+	}
+
+	// N streams, a block of each per step - every round is issued for all of them before the next round starts
+	// the lanes are spelled out as separate variables, which keeps them in registers whatever the optimizer makes of loops,
+	// and the lanes past N fold away as N is a constant
+#define EACH_LANE(OP) OP(0) OP(1) OP(2) OP(3) OP(4) OP(5) OP(6) OP(7)
+#define DECLARE(l) __m128i c##l = _mm_setzero_si128(), x##l = _mm_setzero_si128(); const __m128i* k##l = NULL;
+#define LOAD(l) if (N > l) { c##l = _mm_load_si128((const __m128i*)streams[l]->chain); k##l = (const __m128i*)streams[l]->schedule; }
+#define WHITEN(l) if (N > l) x##l = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)in[l] + b), c##l), k##l[0]);
+#define ROUND(l) if (N > l) x##l = _mm_aesenc_si128(x##l, k##l[r]);
+#define LAST(l) if (N > l) { c##l = _mm_aesenclast_si128(x##l, k##l[AES_ROUNDS]); _mm_storeu_si128((__m128i*)out[l] + b, c##l); }
+#define STORE(l) if (N > l) _mm_store_si128((__m128i*)streams[l]->chain, c##l);
+	template<unsigned N>
+	AESNI_TARGET void lockstep(MultiCBC::Stream* const* streams, const char* const* in, char* const* out, size_t blocks)
+	{
+		static_assert(N >= 1 and N <= MULTI_CBC_LANES and MULTI_CBC_LANES <= 8, "EACH_LANE spells out eight lanes");
+		EACH_LANE(DECLARE)
+		EACH_LANE(LOAD)
+		for (size_t b = 0; b < blocks; b++)
+		{
+			EACH_LANE(WHITEN)
+			for (unsigned r = 1; r < AES_ROUNDS; r++)
+			{
+				EACH_LANE(ROUND)
+			}
+			EACH_LANE(LAST)
+		}
+		EACH_LANE(STORE)
+	}
+#undef EACH_LANE
+#undef DECLARE
+#undef LOAD
+#undef WHITEN
+#undef ROUND
+#undef LAST
+#undef STORE
+#endif
+
+	// the jobs in lockstep as far as the shortest goes, then the rest of the longer ones
+	void run(Job* const* jobs, unsigned count)
+	{
+		MultiCBC::Stream* streams[MULTI_CBC_LANES];
+		const char* in[MULTI_CBC_LANES];
+		char* out[MULTI_CBC_LANES];
+		size_t left[MULTI_CBC_LANES];
+		for (unsigned l = 0; l < count; l++)
+		{
+			streams[l] = jobs[l]->stream;
+			in[l] = jobs[l]->in;
+			out[l] = jobs[l]->out;
+			left[l] = jobs[l]->blocks;
+		}
+		while (count)
+		{
+			size_t step = left[0];
+			for (unsigned l = 1; l < count; l++)
+				step = std::min(step, left[l]);
+			MultiCBC::encrypt(streams, in, out, step, count);
+			unsigned kept = 0;
+			for (unsigned l = 0; l < count; l++)
+			{
+				if (left[l] == step) continue;
+				streams[kept] = streams[l];
+				in[kept] = in[l] + step * AES_BLOCK;
+				out[kept] = out[l] + step * AES_BLOCK;
+				left[kept] = left[l] - step;
+				kept++;
+			}
+			count = kept;
+		}
+	}
+}
+
+bool MultiCBC::available()
+{
+#ifdef MULTI_CBC_X86
+	static const bool aesni = haveAESNI();
+	return aesni;
+#else
+	return false;
+#endif
+}
+
+// expands an AES_SIZE key and sets the chain to the iv - only once available() says so
+void MultiCBC::init(Stream& stream, const unsigned char* key, const unsigned char* iv)
+{
+	if (!available()) throw std::runtime_error("AES-NI isn't available");
+#ifdef MULTI_CBC_X86
+	expand(key, stream.schedule);
+#endif
+	memcpy(stream.chain, iv, AES_BLOCK);
+}
+
+// the kernel: blocks whole blocks of each of count streams, in[l] to out[l] - out may equal in
+void MultiCBC::encrypt(Stream* const* streams, const char* const* in, char* const* out, size_t blocks, unsigned count)
+{
+#ifdef MULTI_CBC_X86
+	switch (count)
+	{
+	case 1: lockstep<1>(streams, in, out, blocks); break;
+	case 2: lockstep<2>(streams, in, out, blocks); break;
+	case 3: lockstep<3>(streams, in, out, blocks); break;
+	case 4: lockstep<4>(streams, in, out, blocks); break;
+	case 5: lockstep<5>(streams, in, out, blocks); break;
+	case 6: lockstep<6>(streams, in, out, blocks); break;
+	case 7: lockstep<7>(streams, in, out, blocks); break;
+	case 8: lockstep<8>(streams, in, out, blocks); break;
+	default: throw std::invalid_argument("Lane count out of range");
+	}
+#else
+	throw std::runtime_error("AES-NI isn't available");
+#endif
+}
+
+// the batching front end: encrypts len bytes (whole blocks) of the stream and returns once they're done
+// the caller queues its job, then takes up to MULTI_CBC_LANES waiting jobs at a time - its own among them or not -
+// until some thread has finished its own, so no thread sits idle while work it could share is queued
+void MultiCBC::submit(Stream& stream, const char* in, char* out, size_t len)
+{
+	if (len % AES_BLOCK) throw std::invalid_argument("CBC input has to be whole blocks");
+	Job job = { &stream, in, out, len / AES_BLOCK, false };
+	std::unique_lock<std::mutex> guard(lock);
+	pending.push_back(&job);
+	while (!job.done)
+	{
+		if (pending.empty())
+		{
+			finished.wait(guard); // another thread has ours
+			continue;
+		}
+		Job* batch[MULTI_CBC_LANES];
+		unsigned count = 0;
+		while (count < MULTI_CBC_LANES and !pending.empty())
+		{
+			batch[count++] = pending.front();
+			pending.pop_front();
+		}
+		guard.unlock();
+		run(batch, count);
+		guard.lock();
+		for (unsigned i = 0; i < count; i++)
+			batch[i]->done = true;
+		finished.notify_all();
+	}
+}
@@ -0,0 +1,25 @@
+// Interleaved AES-128-CBC over independent streams
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "defs.hpp"
+
+// CBC can't be split within a stream, every block waits for the one before it, but blocks of different streams don't
+// depend on each other - encrypting up to MULTI_CBC_LANES streams in lockstep, each with its own key schedule and chain,
+// keeps AES-NI busy through the latency of every round instead of idling on a single chain
+// the streams come from concurrent uploads: a thread submitting blocks takes whatever other submissions are waiting
+// along with its own, so batches form whenever sessions queue up, and several threads still work side by side
+// the ciphertext is the same as a lone CBC stream's, so nothing changes on the wire
+class MultiCBC
+{
+public:
+	struct Stream
+	{
+		alignas(16) unsigned char schedule[(AES_ROUNDS + 1) * AES_BLOCK]; // round keys
+		alignas(16) unsigned char chain[AES_BLOCK]; // last ciphertext block, the iv to begin with
+	};
+	static bool available();
+	static void init(Stream& stream, const unsigned char* key, const unsigned char* iv);
+	static void encrypt(Stream* const* streams, const char* const* in, char* const* out, size_t blocks, unsigned count);
+	static void submit(Stream& stream, const char* in, char* out, size_t len);
+};
@@ -0,0 +1,197 @@
+#include "Pipeline.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	double since(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+Pipeline::Pipeline(MappedFile& fin, SendEngine* sender, size_t block)
+	: fin(fin), sender(sender), block(block), failed(false), reading(0), checksumming(0), encrypting(0)
+{
+}
+
+// keeps the first error, the stages that stop because of it throw too
+void Pipeline::fail(std::exception_ptr e)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!error) error = e;
+	failed = true;
+}
+
+// copies the file from..to out of the mapping into recycled buffers - the only stage touching the mapping
+void Pipeline::read(SpscRing<Block>& free, SpscRing<Block>& out, uint64_t from, uint64_t to)
+{
+	uint64_t offset = from;
+	while (offset < to)
+	{
+		Block b;
+		wait([&]() { return free.pop(b); });
+		auto start = std::chrono::steady_clock::now();
+		size_t available;
+		const char* p = fin.map(offset, available);
+		size_t req = (size_t)std::min<uint64_t>(std::min(available, block), to - offset);
+		memcpy(b.buffer->data(), p, req);
+		reading += since(start);
+		b.offset = offset;
+		b.length = req;
+		offset += req;
+		wait([&]() { return out.push(b); });
+	}
+	Block end;
+	wait([&]() { return out.push(end); });
+}
+
+void Pipeline::checksum(SpscRing<Block>& in, SpscRing<Block>& out, const Checksum& update)
+{
+	while (true)
+	{
+		Block b;
+		wait([&]() { return in.pop(b); });
+		bool last = !b.length;
+		if (!last)
+		{
+			auto start = std::chrono::steady_clock::now();
+			update(b.buffer->data(), b.length);
+			checksumming += since(start);
+		}
+		wait([&]() { return out.push(b); });
+		if (last) return;
+	}
+}
+
+// encrypts in place, the plaintext has been checksummed by now
+void Pipeline::encrypt(SpscRing<Block>& in, SpscRing<Block>& out, const Encrypt& process)
+{
+	while (true)
+	{
+		Block b;
+		wait([&]() { return in.pop(b); });
+		bool last = !b.length;
+		if (!last)
+		{
+			auto start = std::chrono::steady_clock::now();
+			process(b.offset, b.buffer->data(), b.length);
+			encrypting += since(start);
+		}
+		wait([&]() { return out.push(b); });
+		if (last) return;
+	}
+}
+
+// hands the ciphertext to the send engine, which keeps the buffer until its next write,
+// and feeds the reader a buffer out of the engine's pool in its place
+void Pipeline::write(SpscRing<Block>& in, SpscRing<Block>& free, const Progress& progress)
+{
+	while (true)
+	{
+		Block b;
+		wait([&]() { return in.pop(b); });
+		if (!b.length) return;
+		uint64_t sent = b.offset + b.length;
+		sender->send(std::move(b.buffer), b.length);
+		progress(sent);
+		Block back;
+		back.buffer = sender->acquire(block);
+		wait([&]() { return free.push(back); });
+	}
+}
+
+// the same stages back to back, one block at a time
+void Pipeline::serial(uint64_t from, uint64_t to, const Checksum& update, const Encrypt& process, const Progress& progress)
+{
+	uint64_t offset = from;
+	while (offset < to)
+	{
+		auto start = std::chrono::steady_clock::now();
+		size_t available;
+		const char* p = fin.map(offset, available);
+		size_t req = (size_t)std::min<uint64_t>(std::min(available, block), to - offset);
+		BufferPool::Buffer buffer = sender->acquire(req);
+		memcpy(buffer->data(), p, req);
+		auto middle = std::chrono::steady_clock::now();
+		reading += std::chrono::duration<double>(middle - start).count();
+		update(buffer->data(), req);
+		start = std::chrono::steady_clock::now();
+		checksumming += std::chrono::duration<double>(start - middle).count();
+		process(offset, buffer->data(), req);
+		encrypting += since(start);
+		sender->send(std::move(buffer), req);
+		offset += req;
+		progress(offset);
+	}
+}
+
+// uploads the file from..to, from and block being multiples of the cipher's block size
+// rethrows the first error any stage hit once all of them have stopped
+void Pipeline::run(uint64_t from, uint64_t to, const Checksum& update, const Encrypt& process, const Progress& progress)
+{
+	reading = checksumming = encrypting = 0;
+	if (to - from < PIPELINE_MIN)
+	{
+		serial(from, to, update, process, progress);
+		return;
+	}
+	failed = false;
+	error = nullptr;
+	// every ring has room for all buffers and the end of the stream, so the last stage alone decides when the reader waits
+	SpscRing<Block> free(PIPELINE_DEPTH + 1), plain(PIPELINE_DEPTH + 1), summed(PIPELINE_DEPTH + 1), ciphered(PIPELINE_DEPTH + 1);
+	for (unsigned i = 0; i < PIPELINE_DEPTH; i++)
+	{
+		Block b;
+		b.buffer = sender->acquire(block);
+		free.push(b);
+	}
+	auto stage = [this](const std::function<void()>& body)
+	{
+		return std::thread([this, body]()
+		{
+			try
+			{
+				body();
+			}
+			catch (...)
+			{
+				fail(std::current_exception());
+			}
+		});
+	};
+	std::thread reader = stage([&]() { read(free, plain, from, to); });
+	std::thread checksummer = stage([&]() { checksum(plain, summed, update); });
+	std::thread encryptor = stage([&]() { encrypt(summed, ciphered, process); });
+	try
+	{
+		write(ciphered, free, progress);
+	}
+	catch (...)
+	{
+		fail(std::current_exception());
+	}
+	reader.join();
+	checksummer.join();
+	encryptor.join();
+	Block b;
+	while (free.pop(b)) // idle buffers go back to the engine's pool for the next file
+		if (b.buffer) sender->release(std::move(b.buffer));
+	if (error) std::rethrow_exception(error);
+}
+
+double Pipeline::getReading() const
+{
+	return reading;
+}
+
+double Pipeline::getChecksumming() const
+{
+	return checksumming;
+}
+
+double Pipeline::getEncrypting() const
+{
+	return encrypting;
+}
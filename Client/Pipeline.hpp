@@ -0,0 +1,107 @@
+// Staged upload of a file: read, checksum, encrypt and send each on their own thread
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "defs.hpp"
+#include "MappedFile.hpp"
+#include "SendEngine.hpp"
+
+// Bounded single producer single consumer queue - one thread pushes, one other thread pops, neither ever blocks or locks
+// capacity is rounded up to a power of two, head and tail sit on separate cache lines so the two sides don't share one
+template<typename T>
+class SpscRing
+{
+private:
+	std::vector<T> slots;
+	size_t mask;
+	alignas(64) std::atomic<size_t> head; // next slot to pop, only the consumer writes it
+	alignas(64) std::atomic<size_t> tail; // next slot to push, only the producer writes it
+public:
+	SpscRing(size_t capacity) : head(0), tail(0)
+	{
+		size_t size = 1;
+		while (size < capacity) size <<= 1;
+		slots.resize(size);
+		mask = size - 1;
+	}
+	// moves value in unless the ring is full
+	bool push(T& value)
+	{
+		size_t at = tail.load(std::memory_order_relaxed);
+		if (at - head.load(std::memory_order_acquire) == slots.size()) return false;
+		slots[at & mask] = std::move(value);
+		tail.store(at + 1, std::memory_order_release);
+		return true;
+	}
+	// moves the oldest value out unless the ring is empty
+	bool pop(T& value)
+	{
+		size_t at = head.load(std::memory_order_relaxed);
+		if (at == tail.load(std::memory_order_acquire)) return false;
+		value = std::move(slots[at & mask]);
+		head.store(at + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+// Four stages connected by SPSC rings, each stage a thread: the reader copies a block of the mapped file into a buffer,
+// the checksummer runs the plaintext through checksum, the encryptor encrypts it in place and the calling thread
+// hands it to the send engine - the whole file is in flight in at most PIPELINE_DEPTH buffers of block bytes,
+// which the writer recycles back to the reader, so a full ring makes the stage before it wait and nothing else grows
+// throughput is that of the slowest stage instead of the sum of all four
+// files below PIPELINE_MIN run the same stages one block at a time on the calling thread, starting threads costs more
+class Pipeline
+{
+public:
+	typedef std::function<void(const char* data, size_t length)> Checksum;
+	typedef std::function<void(uint64_t offset, char* data, size_t length)> Encrypt;
+	typedef std::function<void(uint64_t sent)> Progress;
+private:
+	struct Block
+	{
+		BufferPool::Buffer buffer;
+		uint64_t offset = 0;
+		size_t length = 0; // 0 ends the stream
+	};
+	MappedFile& fin;
+	SendEngine* sender;
+	size_t block;
+	std::atomic<bool> failed; // a stage threw, the others stop waiting
+	std::mutex lock; // error
+	std::exception_ptr error;
+	double reading, checksumming, encrypting; // seconds each stage was busy
+	void fail(std::exception_ptr e);
+	// spins until done says the pop or push went through - briefly, then yielding, then sleeping,
+	// so a stage held up by a slow socket doesn't keep a core busy
+	template<typename Done>
+	void wait(Done done)
+	{
+		for (unsigned spins = 0; !done(); spins++)
+		{
+			if (failed) throw std::runtime_error("Pipeline stopped");
+			if (spins < 64) continue;
+			if (spins < 1024) std::this_thread::yield();
+			else std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+	void read(SpscRing<Block>& free, SpscRing<Block>& out, uint64_t from, uint64_t to);
+	void checksum(SpscRing<Block>& in, SpscRing<Block>& out, const Checksum& update);
+	void encrypt(SpscRing<Block>& in, SpscRing<Block>& out, const Encrypt& process);
+	void write(SpscRing<Block>& in, SpscRing<Block>& free, const Progress& progress);
+	void serial(uint64_t from, uint64_t to, const Checksum& update, const Encrypt& process, const Progress& progress);
+public:
+	Pipeline(MappedFile& fin, SendEngine* sender, size_t block);
+	void run(uint64_t from, uint64_t to, const Checksum& update, const Encrypt& process, const Progress& progress);
+	double getReading() const;
+	double getChecksumming() const;
+	double getEncrypting() const;
+};
@@ -3,12 +3,22 @@
 #include "defs.hpp"
 #include "boost/lambda/lambda.hpp"
 #include "Request.hpp"
-#include "Packer.hpp"
 #include "Session.hpp"
+#include "MappedFile.hpp"
+#include "Cksum.hpp"
+#include "Cipher.hpp"
+#include "SendEngine.hpp"
+#include "KeyPool.hpp"
+#include "Compress.hpp"
+#include "Chunker.hpp"
+#include "Delta.hpp"
+#include "Metrics.hpp"
+#include "Pipeline.hpp"
 #include <map>
 #include <limits>
+#include <functional>
+#include <thread>
 #include "rijndael.h"
-#include "files.h"
 #include "modes.h"
 #include "osrng.h"
 #include "rsa.h"
@@ -20,29 +30,36 @@
 #define TRY(LABEL,FUNC)\
 	LABEL:try\
 	{\
+		Metrics::Timer timer(Metrics::STEP_SECONDS, #FUNC);\
 		FUNC(s);\
 	}\
 	catch (std::exception const& error)\
 	{\
 		std::cout << error.what();\
-		throw error;\
+		throw;\
 	}
 
 #define READ(LABEL,FUNC) \
 	try\
 	{\
+		Metrics::Timer timer(Metrics::STEP_SECONDS, #FUNC);\
 		FUNC(s);\
 	}\
+	catch (FatalError const&)\
+	{\
+		throw;\
+	}\
 	catch (std::exception const& error)\
 	{\
 		if(retry)\
 		{\
 			std::cout << "Server responded with error:" << error.what() << std::endl;\
+			Metrics::count(Metrics::STEP_RETRIES, #FUNC);\
 			retry--;\
 			goto LABEL;\
 		}\
 		std::cout << "Fatal error: too many fails giving up:" << error.what() << std::endl;\
-		throw error;\
+		throw;\
 	}
 
 
@@ -53,11 +70,11 @@ using namespace boost::posix_time;
 // code map - contains mapping of request to respone and response to next request
 // negative responses use the default behavior of retrying hence they aren't mapped
 std::map<int, int> codes{ {REGISTER, REGISTER_GOOD}, {RECONNECT, RECONNECT_GOOD}, {SEND_KEY, GOOD_KEY }, {SEND_FILE, GET_CRC},
-	{GET_CRC, CRC_ACK},  {REGISTER_GOOD, SEND_KEY}, {RECONNECT_GOOD, SEND_FILE}, {CRC_ACK, ACK}, {GOOD_KEY, SEND_FILE}, {ACK, END} };
-
-std::map<int, int> errcodes{ {REGISTER, REGISTER_BAD}, {RECONNECT, RECONNECT_BAD}, {SEND_KEY, GENERIC_ERROR }, {SEND_FILE, GENERIC_ERROR} };
+	{GET_CRC, CRC_ACK},  {REGISTER_GOOD, SEND_KEY}, {RECONNECT_GOOD, SEND_FILE}, {CRC_ACK, ACK}, {CRC_FAIL, ACK}, {GOOD_KEY, SEND_FILE}, {ACK, END},
+	{RESUME, RESUME_OFFSET}, {CHUNK_CRCS, BAD_CHUNKS}, {RESEND_CHUNKS, GET_CRC}, {RESUME_SESSION, SESSION_RESUMED}, {GET_TICKET, TICKET},
+	{CHUNK_LIST, MISSING_CHUNKS}, {DEDUP_FILE, GET_CRC}, {GET_SIGNATURES, SIGNATURES}, {DELTA_FILE, GET_CRC} };
 
-int packingIndex = 0; // used by packer template
+std::map<int, int> errcodes{ {REGISTER, REGISTER_BAD}, {RECONNECT, RECONNECT_BAD}, {SEND_KEY, GENERIC_ERROR }, {SEND_FILE, GENERIC_ERROR}, {RESUME_SESSION, TICKET_BAD} };
 
 void connect(Session*);
 void reconnect(Session*);
@@ -69,7 +86,20 @@ void sendKeyAck(Session*);
 void sendFile(Session*);
 void sendFileAck(Session*);
 void sendCRC(Session*);
-inline CryptoPP::lword FileSize(const CryptoPP::FileSource&);
+void sendResume(Session*);
+void resumeAck(Session*);
+void badChunksAck(Session*);
+void sendChunks(Session*);
+void resumeSession(Session*);
+void resumeSessionAck(Session*);
+void requestTicket(Session*);
+void ticketAck(Session*);
+void sendChunkList(Session*);
+void missingChunksAck(Session*);
+void sendDedupFile(Session*);
+void sendSignatureRequest(Session*);
+void signaturesAck(Session*);
+void sendDeltaFile(Session*);
 
 // driving function of protocol, handles retries calling the sequence of comm functions
 void runProtocol(Session* s)
@@ -77,23 +107,55 @@ void runProtocol(Session* s)
 	Client c = Client(s); 
 	s->to = &c;
 	unsigned char retry = RETRIES;
+	// other sessions only ever reconnect, using the UID and key the lead session settled
+	if (!s->isLead() and !s->getQueue()->waitOpen()) return;
 	// Macro blocks that handle retries in case of a timeout - if the error is not a timeout it is rethrown
 	// Write timeouts are handled by the server's read timing out which is why a sleep is added to the retry handling
-	if (s->getConfig()->getFlag())
+	if (!s->isLead() or s->getConfig()->getFlag())
 	{
+		TRY(L_TICKET,resumeSession); // both do nothing unless a ticket is stored
+		READ(L_TICKET,resumeSessionAck); // a refused ticket falls through to the full reconnect
+		if (s->getTicketUsed()) goto TRANSFER;
 		TRY(L_RECONNECT,reconnect);
 		READ(L_RECONNECT,reconnectAck);
-		if (s->getConfig()->getFlag()) goto SENDFILE;
+		if (!s->isLead() or s->getConfig()->getFlag()) goto TRANSFER;
 	}
 	TRY(CONNECT,connect);
 	READ(CONNECT,connectAck);
 	TRY(SENDKEY,sendKey);
 	READ(SENDKEY,sendKeyAck);
-	TRY(SENDFILE,sendFile);
-	READ(SENDFILE,sendFileAck);
-	TRY(SENDCRC,sendCRC);
-	if (s->getRetry()) goto SENDFILE; // Bad Cksum - try re-sending the file
-	READ(SENDCRC,sendCRCAck);
+TRANSFER:
+	if (s->isLead())
+	{
+		s->getQueue()->open();
+		TRY(L_GETTICKET,requestTicket); // so the next run can skip RSA - failing to get one isn't an error
+		TRY(L_TICKETACK,ticketAck);
+	}
+	// every file goes over the same connection and AES key, the server waits for the next SEND_FILE after each ACK
+	while (s->nextFile())
+	{
+		retry = RETRIES;
+		TRY(QUERY,sendResume); // both do nothing unless the journal has the file
+		READ(QUERY,resumeAck);
+		TRY(DELTA,sendSignatureRequest); // both do nothing unless the server may have an older copy
+		READ(DELTA,signaturesAck);
+		TRY(DEDUP,sendChunkList); // both do nothing unless the file is deduplicated
+		READ(DEDUP,missingChunksAck);
+		TRY(SENDFILE,sendFile);
+		READ(SENDFILE,sendFileAck);
+		TRY(SENDCRC,sendCRC);
+		if (s->getRetry()) // Bad Cksum
+		{
+			if (s->getHeaderSent()->code == CRC_NACK) goto SENDFILE; // try re-sending the file
+			READ(SENDFILE,badChunksAck); // only the chunks the server flagged go out again, the whole file if that fails
+			TRY(REPAIR,sendChunks);
+			READ(SENDFILE,sendFileAck);
+			goto SENDCRC;
+		}
+		READ(SENDCRC,sendCRCAck);
+		Metrics::observe(Metrics::FILE_RETRIES, "error", RETRIES - retry);
+		s->fileDone();
+	}
 }
 
 // Ack functions read response
@@ -105,16 +167,13 @@ void connect(Session* s)
 	std::cout << "Attempting to register" << std::endl;
 	s->to->connect();
 	char UID[UID_SIZE] = { '\0' }; // using an array initialized to 0 just in case
-	Header header = generateHeader(UID, REGISTER, NAME_SIZE);
+	Header header = generateHeader(UID, REGISTER, NameRequest::fixed, s->getVersion());
 	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
-	char name[NAME_SIZE];
-	strncpy(name, s->getConfig()->getName().data(), NAME_SIZE); // guaranteed to be NULL padded
-	void* args[REGISTER_ARGS];
-	packArgs(args, REGISTER_ARGS, name);
-	std::string request = generateRequest(REGISTER, args, REGISTER_ARGS);
+	char request[NameRequest::fixed];
+	NameRequest::write(request, sizeof(request), s->getConfig()->getName().data());
 	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
 	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
-	buffers.push_back(boost::asio::buffer(request, NAME_SIZE));
+	buffers.push_back(boost::asio::buffer(request));
 	s->to->write(buffers);
 }
 
@@ -123,16 +182,13 @@ void reconnect(Session* s)
 {
 	std::cout << "Attempting to reconnect" << std::endl;
 	s->to->connect();
-	Header header = generateHeader(s->getConfig()->getUID().data(), RECONNECT, NAME_SIZE);
+	Header header = generateHeader(s->getConfig()->getUID().data(), RECONNECT, NameRequest::fixed, s->getVersion());
 	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
-	char name[NAME_SIZE];
-	strncpy(name, s->getConfig()->getName().data(), NAME_SIZE); // guaranteed to be NULL padded
-	void* args[REGISTER_ARGS];
-	packArgs(args, REGISTER_ARGS, name);
-	std::string request = generateRequest(RECONNECT , args, REGISTER_ARGS);
+	char request[NameRequest::fixed];
+	NameRequest::write(request, sizeof(request), s->getConfig()->getName().data());
 	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
 	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
-	buffers.push_back(boost::asio::buffer(request, NAME_SIZE));
+	buffers.push_back(boost::asio::buffer(request));
 	s->to->write(buffers);
 }
 
@@ -144,13 +200,9 @@ void reconnectAck(Session* s)
 		s->to->readHeader();
 		if (s->getHeaderRecieved()->code == errcodes[s->getHeaderSent()->code])
 		{
-			size_t rem = s->getSocket()->available();
-			while (rem)
-			{
-				size_t req = std::min(rem, (size_t)MAX_SIZE);
-				s->to->flush(req);
-				rem -= req;
-			}
+			// only a lead that hasn't opened the queue may register instead - once it has, other sessions work under the UID
+			if (!s->isLead() or s->getQueue()->isOpen()) throw RefusedError("Server refused reconnect");
+			s->to->drain();
 			s->getConfig()->flipFlag();
 			s->getSocket()->close();
 			return;
@@ -159,24 +211,115 @@ void reconnectAck(Session* s)
 		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
 		if (s->getHeaderRecieved()->size > SIZE_MAX) throw std::runtime_error("Bad messasge size");
 		s->to->readPayload();
-		const char* name = s->getBuffer()->data();
+		const char* name = s->getPayload().data();
 		if (strncmp(name, s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
-		s->getConfig()->setUID(*(s->getBuffer())); //Set UID to value recieved from server
-		const char* key = s->getBuffer()->data() + UID_SIZE;
+		if (s->isLead()) s->getConfig()->setUID(std::string(s->getPayload().substr(0, UID_SIZE))); //Set UID to value recieved from server
+		const char* key = s->getPayload().data() + UID_SIZE;
 		CryptoPP::SecByteBlock block(reinterpret_cast<const CryptoPP::byte*>(key), s->getHeaderRecieved()->size - UID_SIZE);
 		s->setAES(block);
 		std::cout << "Reconnect success" << std::endl;
 	}
 	catch (std::exception const& error)
 	{
-		size_t rem = s->getSocket()->available();
-		while (rem)
-		{
-			size_t req = std::min(rem, (size_t)MAX_SIZE);
-			s->to->flush(req);
-			rem -= req;
-		}
-		throw error;
+		s->to->drain();
+		throw;
+	}
+}
+
+// connect and present the stored resumption ticket instead of a reconnect request
+// the header carries TICKET_VER since the ticket can only have come from a server speaking it
+void resumeSession(Session* s)
+{
+	CryptoPP::byte id[TICKET_ID_SIZE];
+	CryptoPP::SecByteBlock secret;
+	if (!s->getConfig()->getTickets()->get(id, secret)) return;
+	std::cout << "Attempting to resume session" << std::endl;
+	s->to->connect();
+	s->setTicketUsed(true); // until resumeSessionAck says otherwise
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(s->getTicketNonce(), NONCE_SIZE);
+	Header header = generateHeader(s->getConfig()->getUID().data(), RESUME_SESSION, ResumeSessionRequest::fixed, TICKET_VER);
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	char request[ResumeSessionRequest::fixed];
+	ResumeSessionRequest::write(request, sizeof(request), s->getConfig()->getName().data(), id, s->getTicketNonce());
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request));
+	s->to->write(buffers);
+}
+
+// get response to a ticket - if accepted derive the session key from both nonces, otherwise drop the ticket
+// and let the regular reconnect run on a fresh connection
+void resumeSessionAck(Session* s)
+{
+	if (!s->getTicketUsed()) return;
+	try
+	{
+		s->to->readHeader();
+		if (s->getHeaderRecieved()->code == errcodes[s->getHeaderSent()->code]) throw std::runtime_error("Server refused ticket");
+		if (s->getHeaderRecieved()->code == GENERIC_ERROR) throw std::runtime_error("Server responded with generic error");
+		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
+		if (s->getHeaderRecieved()->size != UID_SIZE + NONCE_SIZE) throw std::runtime_error("Bad messasge size");
+		s->to->readPayload();
+		if (strncmp(s->getPayload().data(), s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
+		CryptoPP::byte id[TICKET_ID_SIZE];
+		CryptoPP::SecByteBlock secret;
+		if (!s->getConfig()->getTickets()->get(id, secret)) throw std::runtime_error("Ticket expired");
+		const CryptoPP::byte* serverNonce = reinterpret_cast<const CryptoPP::byte*>(s->getPayload().data() + UID_SIZE);
+		s->setSessionKey(TicketStore::derive(secret, id, s->getTicketNonce(), serverNonce));
+		std::cout << "Session resumed" << std::endl;
+	}
+	catch (FatalError const&)
+	{
+		throw;
+	}
+	catch (std::exception const& error)
+	{
+		std::cout << "Resuming session failed:" << error.what() << std::endl;
+		s->getConfig()->getTickets()->clear();
+		s->setTicketUsed(false);
+		s->getSocket()->close(); // reconnect starts over on a new connection
+	}
+}
+
+// ask for a resumption ticket - only the lead does so, and only when it authenticated with RSA
+void requestTicket(Session* s)
+{
+	if (s->getTicketUsed() or s->getVersion() < TICKET_VER) return;
+	Header header = generateHeader(s->getConfig()->getUID().data(), GET_TICKET, 0, s->getVersion());
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	std::vector<boost::asio::mutable_buffer> buffers;
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	s->to->write(buffers);
+}
+
+// store the ticket - its secret comes encrypted in CTR mode under the session key, with the ticket id as nonce
+void ticketAck(Session* s)
+{
+	if (s->getTicketUsed() or s->getVersion() < TICKET_VER) return;
+	try
+	{
+		s->to->readHeader();
+		if (s->getHeaderRecieved()->code == GENERIC_ERROR) throw std::runtime_error("Server responded with generic error");
+		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
+		if (s->getHeaderRecieved()->size != UID_SIZE + TICKET_ID_SIZE + TICKET_SECRET_SIZE + LIFETIME_SIZE) throw std::runtime_error("Bad messasge size");
+		s->to->readPayload();
+		if (strncmp(s->getPayload().data(), s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
+		const CryptoPP::byte* id = reinterpret_cast<const CryptoPP::byte*>(s->getPayload().data() + UID_SIZE);
+		const char* sealed = s->getPayload().data() + UID_SIZE + TICKET_ID_SIZE;
+		uint32_t lifetime = *(uint32_t*)(sealed + TICKET_SECRET_SIZE);
+		CryptoPP::SecByteBlock secret(TICKET_SECRET_SIZE);
+		ParallelCTR(s->getAES(), id, 1).process(0, sealed, reinterpret_cast<char*>(secret.data()), TICKET_SECRET_SIZE);
+		s->getConfig()->getTickets()->set(id, secret.data(), lifetime);
+	}
+	catch (FatalError const&)
+	{
+		throw;
+	}
+	catch (std::exception const& error)
+	{
+		std::cout << "No resumption ticket:" << error.what() << std::endl;
+		s->to->drain();
 	}
 }
 
@@ -187,67 +330,47 @@ void connectAck(Session* s)
 	{
 		s->to->readHeader();
 		if (s->getHeaderRecieved()->code == errcodes[s->getHeaderSent()->code])
-		{
-			std::cout << "Fatal error: Server responded with registration error, program terminating" << std::endl;
-			exit(-1);
-		}
+			throw FatalError("Server responded with registration error");
 		if (s->getHeaderRecieved()->code == GENERIC_ERROR) throw std::runtime_error("Server responded with generic error");
 		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
 		if (s->getHeaderRecieved()->size != UID_SIZE) throw std::runtime_error("Bad messasge size");
 		s->to->readPayload();
-		s->getConfig()->setUID(*(s->getBuffer())); //Set UID to value recieved from server
+		s->getConfig()->setUID(std::string(s->getPayload().substr(0, UID_SIZE))); //Set UID to value recieved from server
 		std::cout << "Register success" << std::endl;
 	}
 	catch (std::exception const& error)
 	{
-		size_t rem = s->getSocket()->available();
-		while (rem)
-		{
-			size_t req = std::min(rem, (size_t)MAX_SIZE);
-			s->to->flush(req);
-			rem -= req;
-		}
-		throw error;
+		s->to->drain();
+		throw;
 	}
 }
 
 // generate RSA public private key pair and send public key to server
 void sendKey(Session* s)
 {
-	CryptoPP::AutoSeededRandomPool rng;
-	CryptoPP::InvertibleRSAFunction params;
-	params.GenerateRandomWithKeySize(rng, RSA_SIZE);
-	CryptoPP::RSA::PrivateKey privateKey(params);
-	CryptoPP::RSA::PublicKey publicKey(params);
+	KeyPool* pool = s->getConfig()->getKeyPool();
+	CryptoPP::RSA::PrivateKey privateKey;
+	{
+		Metrics::Timer timer(Metrics::CPU_SECONDS, pool ? "rsa key pool" : "rsa keygen");
+		if (!pool or !pool->pop(privateKey)) privateKey = KeyPool::generate(); // no pool or it ran dry
+	}
+	if (pool) pool->refillAsync(KEY_POOL_TARGET); // replace the key while the server works on ours
+	CryptoPP::RSA::PublicKey publicKey(privateKey);
 	s->getConfig()->setKey(privateKey); // set private key
 	std::string spki;
 	CryptoPP::StringSink ss(spki);
 	// Use Save to DER encode the Subject Public Key Info (SPKI)
 	publicKey.DEREncode(ss);
+	if (spki.size() != KEY_SIZE) throw std::runtime_error("Public key doesn't fit the key field");
 	std::cout << "Generating RSA and sending it over to server" << std::endl;
-	Header header = generateHeader(s->getConfig()->getUID().data(), SEND_KEY, NAME_SIZE + KEY_SIZE);
+	Header header = generateHeader(s->getConfig()->getUID().data(), SEND_KEY, KeyRequest::fixed, s->getVersion());
 	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
-	char name[NAME_SIZE];
-	strncpy(name, s->getConfig()->getName().data(), NAME_SIZE); // guaranteed to be NULL padded
-	void* args[SEND_KEY_ARGS];
-	char* spki_cstr = new char[spki.length()];
-	try
-	{
-		memcpy(spki_cstr, spki.data(), spki.length());
-		packArgs(args, SEND_KEY_ARGS, name, spki_cstr);
-		std::string request = generateRequest(SEND_KEY, args, SEND_KEY_ARGS);
-		std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
-		buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
-		buffers.push_back(boost::asio::buffer(request, NAME_SIZE + KEY_SIZE));
-		s->to->write(buffers);
-	}
-	catch (std::exception const& error) // dispose of dynamic allocation and rethrow exception
-	{
-		delete[] spki_cstr;
-		spki_cstr = NULL;
-		throw error;
-	}
-	delete[] spki_cstr;
+	char request[KeyRequest::fixed];
+	KeyRequest::write(request, sizeof(request), s->getConfig()->getName().data(), (const unsigned char*)spki.data());
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request));
+	s->to->write(buffers);
 }
 
 // receive encrypted AES key decrypt and save it
@@ -260,9 +383,9 @@ void sendKeyAck(Session* s)
 		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
 		if (s->getHeaderRecieved()->size > SIZE_MAX) throw std::runtime_error("Bad messasge size");
 		s->to->readPayload();
-		const char* name = s->getBuffer()->data();
+		const char* name = s->getPayload().data();
 		if(strncmp(name, s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
-		const char* key = s->getBuffer()->data() + UID_SIZE;
+		const char* key = s->getPayload().data() + UID_SIZE;
 		CryptoPP::SecByteBlock block(reinterpret_cast<const CryptoPP::byte*>(key), s->getHeaderRecieved()->size - UID_SIZE);
 		s->setAES(block);
 		s->getConfig()->keySuccess();
@@ -270,60 +393,438 @@ void sendKeyAck(Session* s)
 	}
 	catch (std::exception const& error)
 	{
-		size_t rem = s->getSocket()->available();
-		while (rem)
-		{
-			size_t req = std::min(rem, (size_t)MAX_SIZE);
-			s->to->flush(req);
-			rem -= req;
-		}
-		throw error;
+		s->to->drain();
+		throw;
 	}
 }
 
-void encryptFile(CryptoPP::SecByteBlock, std::ifstream&);
+void encryptFile(CryptoPP::SecByteBlock, MappedFile&, SendEngine*, Cksum&);
+void encryptFileCTR(const ParallelCTR&, MappedFile&, SendEngine*, ChunkedCksum&, uint64_t, const std::function<void(uint64_t)>&);
+void encryptBufferCTR(const ParallelCTR&, const std::string&, SendEngine*);
 bool crcCmp(Session* s);
 
-// encrypt file using AES key and send it to server
+// name the current file is stored under on the server - nextFile made sure it fits
+void fileName(Session* s, char* name)
+{
+	strncpy(name, s->getConfig()->storedName(s->getPath()).c_str(), NAME_SIZE);
+	s->setFname(name);
+}
+
+// ask the server how much of an upload an earlier run got across - only sent if the journal has the file
+void sendResume(Session* s)
+{
+	if (!s->getResumable() or s->getVersion() < RESUME_VER) return;
+	Header header = generateHeader(s->getConfig()->getUID().data(), RESUME, ResumeRequest::fixed, s->getVersion());
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	char name[NAME_SIZE];
+	fileName(s, name);
+	char request[ResumeRequest::fixed];
+	ResumeRequest::write(request, sizeof(request), name, s->getProgress()->nonce);
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request));
+	s->to->write(buffers);
+}
+
+// read the offset the server has persisted, whole AES blocks only so the CTR counter continues right there
+void resumeAck(Session* s)
+{
+	if (!s->getResumable() or s->getVersion() < RESUME_VER) return;
+	try
+	{
+		s->to->readHeader();
+		if (s->getHeaderRecieved()->code == GENERIC_ERROR) throw std::runtime_error("Server responded with generic error");
+		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
+		if (s->getHeaderRecieved()->size != UID_SIZE + OFFSET_SIZE) throw std::runtime_error("Bad messasge size");
+		s->to->readPayload();
+		if (strncmp(s->getPayload().data(), s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
+		uint32_t offset = *(uint32_t*)(s->getPayload().data() + UID_SIZE);
+		if (offset % CryptoPP::AES::BLOCKSIZE or offset > s->getProgress()->size) throw std::runtime_error("Bad resume offset");
+		s->getProgress()->sent = offset;
+		if (offset) std::cout << "Resuming " << s->getPath() << " at byte " << offset << std::endl;
+	}
+	catch (std::exception const& error)
+	{
+		s->to->drain();
+		throw;
+	}
+}
+
+// encrypt file using AES key and stream it to server
+// the ciphertext length is known in advance so the header goes out before encryption starts
+// from CTR_VER on the file goes out in CTR mode under a fresh nonce, otherwise in CBC with PKCS padding
+// from RESUME_VER on the nonce and progress are journaled, and a file resumeAck found on the server continues past what it has
+// from COMPRESS_VER on a file that deflates well goes out deflated - such uploads always start over, so they aren't journaled
 void sendFile(Session* s)
 {
-	std::ifstream f;
-	f.open(s->getConfig()->getPath(), std::ios::binary | std::ios::in);
-	std::string error = "Couldn't open file:" + s->getConfig()->getPath();
-	if (!f.is_open()) throw std::runtime_error(error.c_str());
-	encryptFile(s->getAES(), f);
-	f.close();
-	f.open("out.info", std::ios::binary | std::ios::in);
-	size_t len = FileSize(CryptoPP::FileSource(f, false)); // calculate file length after encryption
-	if (len > (MAX_FILE_SIZE - NAME_SIZE - SIZE_SIZE)) throw std::runtime_error("File is larger than the allowed maximum (4Gb)");
-	if (!f.is_open()) throw std::runtime_error("Couldn't read output file");
-	s->setLen(len);
-	Header header = generateHeader(s->getConfig()->getUID().data(), SEND_FILE, SIZE_SIZE + NAME_SIZE + len);
+	if (s->getDelta())
+	{
+		sendDeltaFile(s);
+		return;
+	}
+	if (s->getDedup())
+	{
+		sendDedupFile(s);
+		return;
+	}
+	MappedFile f(s->getPath()); // throws if the file can't be opened
+	CryptoPP::lword plain = f.size();
+	bool ctr = s->getVersion() >= CTR_VER;
+	bool journaled = s->getVersion() >= RESUME_VER;
+	bool coded = s->getVersion() >= COMPRESS_VER;
+	Journal::Entry* progress = s->getProgress();
+	uint32_t offset = journaled and s->getResumable() ? (uint32_t)progress->sent : 0;
+	s->setResumable(FALSE); // a retry after a bad CRC starts over
+	std::string packed; // deflated file
+	ChunkedCksum packedCrc(CHECK_CHUNK); // plaintext checksums taken while deflating
+	uint8_t codec = CODEC_NONE;
+	if (coded and !offset and s->getConfig()->getCompress() and !Compressor::skipped(s->getPath())
+		and Compressor::sample(f) and Compressor::compress(f, packed, packedCrc))
+		codec = CODEC_ZLIB;
+	uint32_t original = (uint32_t)plain; // only sent along with deflated files, which are below 4Gb
+	// PKCS padding always adds between 1 and BLOCKSIZE bytes, CTR output is as long as its input
+	CryptoPP::lword padded = ctr ? plain : (plain / CryptoPP::AES::BLOCKSIZE + 1) * CryptoPP::AES::BLOCKSIZE;
+	if (codec != CODEC_NONE) padded = packed.size();
+	size_t meta = coded ? FileCodecRequest::fixed : journaled ? FileResumeRequest::fixed : ctr ? FileCTRRequest::fixed : FileRequest::fixed;
+	if (padded > (MAX_FILE_SIZE - meta)) throw std::runtime_error("File is larger than the allowed maximum (4Gb)");
+	size_t len = (size_t)padded;
+	s->setLen(codec != CODEC_NONE ? (uint32_t)plain : (uint32_t)len); // the server reports the size of what it stored
+	Header header = generateHeader(s->getConfig()->getUID().data(), SEND_FILE, meta + len - offset, s->getVersion());
 	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
 	char name[NAME_SIZE];
-	size_t pos = s->getConfig()->getPath().find_last_of('\\'); // find beginning of filename
-	if (pos == std::string::npos) pos = -1; // if file is in current directory - path is name
-	strncpy(name, s->getConfig()->getPath().data() + pos + 1, NAME_SIZE);
-	s->setFname(name);
-	void* args[SEND_FILE_ARGS];
-	packArgs(args, SEND_FILE_ARGS, &len, name);
-	std::string request = generateRequest(SEND_FILE, args, SEND_FILE_ARGS);
+	fileName(s, name);
+	uint8_t cipher = CIPHER_CTR;
+	if (ctr and !offset)
+	{
+		CryptoPP::AutoSeededRandomPool rng;
+		rng.GenerateBlock(progress->nonce, NONCE_SIZE); // never reuse a counter under the same key, even on retries
+		if (journaled and codec == CODEC_NONE and Journal::identify(s->getPath(), *progress))
+			s->getJournal()->record(s->getPath(), *progress);
+	}
+	char request[FileCodecRequest::fixed]; // the longest of the four
+	if (coded)
+		FileCodecRequest::write(request, sizeof(request), (uint32_t)len, name, cipher, progress->nonce, offset, codec, original);
+	else if (journaled)
+		FileResumeRequest::write(request, sizeof(request), (uint32_t)len, name, cipher, progress->nonce, offset);
+	else if (ctr)
+		FileCTRRequest::write(request, sizeof(request), (uint32_t)len, name, cipher, progress->nonce);
+	else
+		FileRequest::write(request, sizeof(request), (uint32_t)len, name);
 	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
 	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
-	buffers.push_back(boost::asio::buffer(request, SIZE_SIZE + NAME_SIZE));
+	buffers.push_back(boost::asio::buffer(request, meta));
+	s->getSender()->begin(buffers); // goes out together with the first chunk of the file
+	Metrics::observe(Metrics::FILE_BYTES, codec != CODEC_NONE ? "zlib" : ctr ? "ctr" : "cbc", (double)(len - offset));
+	std::cout << "Sending file with size:" << len << std::endl;
+	s->getChunkCRCs()->clear();
+	if (codec != CODEC_NONE)
+	{
+		ParallelCTR engine(s->getAES(), progress->nonce, std::thread::hardware_concurrency());
+		encryptBufferCTR(engine, packed, s->getSender());
+		*s->getChunkCRCs() = packedCrc.getChunks();
+		s->setCRC(packedCrc.finalize()); // the cksum is over the original file, the server compares it after inflating
+	}
+	else if (ctr)
+	{
+		ChunkedCksum crc(CHECK_CHUNK); // chunk cksums let a bad upload be repaired piecemeal from CHUNK_VER on
+		ParallelCTR engine(s->getAES(), progress->nonce, std::thread::hardware_concurrency());
+		uint64_t journaledAt = offset;
+		// the journal trails the socket by up to JOURNAL_STEP - the server's answer to RESUME is what counts anyway
+		encryptFileCTR(engine, f, s->getSender(), crc, offset, [s, progress, journaled, &journaledAt](uint64_t sent)
+		{
+			if (!journaled or sent - journaledAt < JOURNAL_STEP) return;
+			progress->sent = journaledAt = sent;
+			s->getJournal()->record(s->getPath(), *progress);
+		});
+		crc.finish();
+		*s->getChunkCRCs() = crc.getChunks();
+		s->setCRC(crc.finalize()); // plaintext checksum from the same read pass, compared once the server answers
+	}
+	else
+	{
+		Cksum crc;
+		encryptFile(s->getAES(), f, s->getSender(), crc);
+		s->setCRC(crc.finalize());
+	}
+	s->getSender()->end();
+}
+
+// gathers plaintext from anywhere into whole batches, encrypts each at its place in the CTR stream and queues it for sending
+// batches are a multiple of the block size, so pieces that don't start on a block boundary still line up with the counter
+class CTRBatcher
+{
+private:
+	const ParallelCTR& engine;
+	SendEngine* sender;
+	size_t batch;
+	BufferPool::Buffer out;
+	size_t filled;
+	uint64_t stream; // position of the current batch in the CTR stream
+public:
+	CTRBatcher(const ParallelCTR& engine, SendEngine* sender)
+		: engine(engine), sender(sender), batch((size_t)CTR_SEGMENT * engine.getThreads()), filled(0), stream(0) {}
+	void put(const char* p, size_t len)
+	{
+		while (len)
+		{
+			if (!out)
+			{
+				out = sender->acquire(batch);
+				filled = 0;
+			}
+			size_t req = std::min(len, batch - filled);
+			memcpy(out->data() + filled, p, req);
+			filled += req;
+			p += req;
+			len -= req;
+			if (filled == batch) flush();
+		}
+	}
+	// len bytes of the file from offset on
+	void put(MappedFile& f, uint64_t offset, uint64_t len)
+	{
+		while (len)
+		{
+			size_t available;
+			const char* p = f.map(offset, available);
+			size_t req = (size_t)std::min((uint64_t)available, len);
+			put(p, req);
+			offset += req;
+			len -= req;
+		}
+	}
+	void flush()
+	{
+		if (!out or !filled) return;
+		engine.process(stream, out->data(), out->data(), filled);
+		stream += filled;
+		sender->send(std::move(out), filled);
+	}
+};
+
+// offer the server the digest of every content defined chunk of the file, in dedup mode from DEDUP_VER on
+// the split pass also takes the plaintext cksums, a deduplicated upload never reads the file as a whole again
+void sendChunkList(Session* s)
+{
+	s->setDedup(FALSE);
+	std::vector<Chunker::Chunk>* chunks = s->getDedupChunks();
+	chunks->clear();
+	if (s->getDelta() or !s->getConfig()->getDedup() or s->getVersion() < DEDUP_VER or (s->getResumable() and s->getProgress()->sent)) return;
+	MappedFile f(s->getPath());
+	if (f.size() < DEDUP_MIN_FILE or f.size() >= MAX_FILE_SIZE) return;
+	ChunkedCksum crc(CHECK_CHUNK);
+	{
+		Metrics::Timer timer(Metrics::CPU_SECONDS, "chunking");
+		Chunker::split(f, *chunks, crc);
+	}
+	*s->getChunkCRCs() = crc.getChunks();
+	s->setCRC(crc.finalize());
+	s->setLen((uint32_t)f.size());
+	char name[NAME_SIZE];
+	fileName(s, name);
+	size_t size = ChunkListRequest::size(name, *chunks);
+	Header header = generateHeader(s->getConfig()->getUID().data(), CHUNK_LIST, size, s->getVersion());
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	char* request = s->getRequest(size);
+	ChunkListRequest::write(request, size, name, *chunks);
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request, size));
 	s->to->write(buffers);
-	char out[MAX_SIZE] = { '\0' };
-	CryptoPP::FileSource fs(f, false);
-	CryptoPP::lword remaining = FileSize(fs); // recalculate FileSize of file after encryption
-	std::cout << "Sending file with size:" << remaining << std::endl;
-	while (remaining && !f.eof()) // send over file in chunks of at most 1Kb
+}
+
+// read which chunks the server doesn't hold yet - the indexes come in increasing order
+void missingChunksAck(Session* s)
+{
+	std::vector<Chunker::Chunk>* chunks = s->getDedupChunks();
+	if (chunks->empty()) return;
+	try
 	{
-		unsigned int req = std::min(remaining, (CryptoPP::lword)MAX_SIZE);
-		f.read(out, req);
-		remaining -= req;
-		s->to->write_some(out, req);
+		s->to->readHeader();
+		if (s->getHeaderRecieved()->code == GENERIC_ERROR) throw std::runtime_error("Server responded with generic error");
+		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
+		if (s->getHeaderRecieved()->size < UID_SIZE + COUNT_SIZE) throw std::runtime_error("Bad messasge size");
+		s->to->readPayload();
+		if (strncmp(s->getPayload().data(), s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
+		uint32_t count = *(uint32_t*)(s->getPayload().data() + UID_SIZE);
+		if (s->getHeaderRecieved()->size != UID_SIZE + COUNT_SIZE + (uint64_t)count * INDEX_SIZE) throw std::runtime_error("Bad messasge size");
+		std::vector<uint32_t>* missing = s->getMissingChunks();
+		missing->resize(count);
+		memcpy(missing->data(), s->getPayload().data() + UID_SIZE + COUNT_SIZE, (size_t)count * INDEX_SIZE);
+		for (uint32_t i = 0; i < count; i++)
+			if ((*missing)[i] >= chunks->size() or (i and (*missing)[i] <= (*missing)[i - 1])) throw std::runtime_error("Bad chunk index");
+		s->setDedup(TRUE);
+		std::cout << "Server lacks " << count << " of " << chunks->size() << " chunks" << std::endl;
+	}
+	catch (std::exception const& error)
+	{
+		s->to->drain();
+		throw;
 	}
-	f.close();
+}
+
+// upload only the missing chunks, back to back in one CTR stream under a fresh nonce, for the server to put the file together
+void sendDedupFile(Session* s)
+{
+	s->setDedup(FALSE); // a retry after a bad CRC sends the whole file
+	MappedFile f(s->getPath());
+	std::vector<Chunker::Chunk>* chunks = s->getDedupChunks();
+	std::vector<uint32_t>* missing = s->getMissingChunks();
+	uint64_t data = 0;
+	for (uint32_t index : *missing)
+		data += (*chunks)[index].length;
+	char name[NAME_SIZE];
+	fileName(s, name);
+	CryptoPP::byte nonce[NONCE_SIZE];
+	size_t meta = ChunksRequest::size(name, nonce, *missing);
+	if (data > MAX_FILE_SIZE - meta) throw std::runtime_error("File is larger than the allowed maximum (4Gb)");
+	Header header = generateHeader(s->getConfig()->getUID().data(), DEDUP_FILE, meta + data, s->getVersion());
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(nonce, NONCE_SIZE);
+	char* request = s->getRequest(meta);
+	ChunksRequest::write(request, meta, name, nonce, *missing);
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request, meta));
+	SendEngine* sender = s->getSender();
+	sender->begin(buffers);
+	Metrics::observe(Metrics::FILE_BYTES, "dedup", (double)data);
+	std::cout << "Sending " << data << " of " << f.size() << " bytes" << std::endl;
+	ParallelCTR engine(s->getAES(), nonce, std::thread::hardware_concurrency());
+	CTRBatcher stream(engine, sender);
+	for (uint32_t index : *missing)
+		stream.put(f, (*chunks)[index].offset, (*chunks)[index].length);
+	stream.flush();
+	sender->end();
+}
+
+// ask the server for block signatures of its copy of the file, from DELTA_VER on
+// not for small files, nor for uploads that continue from a journaled offset
+void sendSignatureRequest(Session* s)
+{
+	s->setDelta(FALSE);
+	s->setDeltaBlock(0);
+	if (s->getVersion() < DELTA_VER or (s->getResumable() and s->getProgress()->sent)) return;
+	{
+		MappedFile f(s->getPath());
+		if (f.size() < DELTA_MIN_FILE or f.size() >= MAX_FILE_SIZE) return;
+	}
+	Header header = generateHeader(s->getConfig()->getUID().data(), GET_SIGNATURES, NameRequest::fixed, s->getVersion());
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	char name[NAME_SIZE];
+	fileName(s, name);
+	char request[NameRequest::fixed];
+	NameRequest::write(request, sizeof(request), name);
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request));
+	s->to->write(buffers);
+	s->setDeltaBlock(1); // a request is outstanding, signaturesAck sets the real size
+}
+
+// read the signatures and diff the file against them - no signatures means the server has no copy
+// the delta is only used if it comes out below DELTA_RATIO percent of the file
+void signaturesAck(Session* s)
+{
+	if (!s->getDeltaBlock()) return;
+	try
+	{
+		s->to->readHeader();
+		if (s->getHeaderRecieved()->code == GENERIC_ERROR) throw std::runtime_error("Server responded with generic error");
+		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
+		if (s->getHeaderRecieved()->size < UID_SIZE + BLOCK_SIZE + COUNT_SIZE) throw std::runtime_error("Bad messasge size");
+		s->to->readPayload();
+		const char* payload = s->getPayload().data();
+		if (strncmp(payload, s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
+		uint32_t block = *(uint32_t*)(payload + UID_SIZE);
+		uint32_t count = *(uint32_t*)(payload + UID_SIZE + BLOCK_SIZE);
+		if (s->getHeaderRecieved()->size != UID_SIZE + BLOCK_SIZE + COUNT_SIZE + (uint64_t)count * (WEAK_SIZE + STRONG_SIZE))
+			throw std::runtime_error("Bad messasge size");
+		s->setDeltaBlock(0);
+		if (!count) return;
+		if (!block) throw std::runtime_error("Bad block size");
+		std::vector<Delta::Signature> signatures(count);
+		const char* entry = payload + UID_SIZE + BLOCK_SIZE + COUNT_SIZE;
+		for (Delta::Signature& signature : signatures)
+		{
+			memcpy(&signature.weak, entry, WEAK_SIZE);
+			memcpy(signature.strong, entry + WEAK_SIZE, STRONG_SIZE);
+			entry += WEAK_SIZE + STRONG_SIZE;
+		}
+		ChunkedCksum crc(CHECK_CHUNK);
+		std::vector<Delta::Op>* ops = s->getDeltaOps();
+		{
+			Metrics::Timer timer(Metrics::CPU_SECONDS, "delta diff");
+			Delta::diff(s->getPath(), block, signatures, *ops, crc);
+		}
+		uint64_t size = 0;
+		for (const Delta::Op& op : *ops)
+			size += op.copy ? op.length * block : op.length;
+		uint64_t encoded = Delta::encodedSize(*ops);
+		std::cout << "Delta of " << s->getPath() << " carries " << Delta::literalSize(*ops) << " of " << size << " bytes" << std::endl;
+		if (encoded * 100 >= size * DELTA_RATIO) return; // mostly new, a plain upload is as cheap
+		*s->getChunkCRCs() = crc.getChunks();
+		s->setCRC(crc.finalize());
+		s->setLen((uint32_t)size);
+		s->setDeltaBlock(block);
+		s->setDelta(TRUE);
+	}
+	catch (std::exception const& error)
+	{
+		s->to->drain();
+		throw;
+	}
+}
+
+// upload the delta as one CTR stream under a fresh nonce - copy runs are an index and a count of blocks,
+// literals a length followed by the bytes themselves
+void sendDeltaFile(Session* s)
+{
+	s->setDelta(FALSE); // a retry after a bad CRC sends the whole file
+	MappedFile f(s->getPath());
+	std::vector<Delta::Op>* ops = s->getDeltaOps();
+	uint64_t data = Delta::encodedSize(*ops);
+	size_t meta = DeltaRequest::fixed;
+	if (data > MAX_FILE_SIZE - meta) throw std::runtime_error("File is larger than the allowed maximum (4Gb)");
+	Header header = generateHeader(s->getConfig()->getUID().data(), DELTA_FILE, meta + data, s->getVersion());
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	char name[NAME_SIZE];
+	fileName(s, name);
+	CryptoPP::byte nonce[NONCE_SIZE];
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(nonce, NONCE_SIZE);
+	char request[DeltaRequest::fixed];
+	DeltaRequest::write(request, sizeof(request), name, nonce);
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request));
+	SendEngine* sender = s->getSender();
+	sender->begin(buffers);
+	Metrics::observe(Metrics::FILE_BYTES, "delta", (double)data);
+	std::cout << "Sending delta with size:" << data << std::endl;
+	ParallelCTR engine(s->getAES(), nonce, std::thread::hardware_concurrency());
+	CTRBatcher stream(engine, sender);
+	for (const Delta::Op& op : *ops)
+	{
+		char instruction[OP_SIZE + INDEX_SIZE + COUNT_SIZE];
+		instruction[0] = op.copy ? DELTA_COPY : DELTA_LITERAL;
+		uint32_t first = (uint32_t)op.start, length = (uint32_t)op.length;
+		if (op.copy)
+		{
+			memcpy(instruction + OP_SIZE, &first, INDEX_SIZE);
+			memcpy(instruction + OP_SIZE + INDEX_SIZE, &length, COUNT_SIZE);
+			stream.put(instruction, OP_SIZE + INDEX_SIZE + COUNT_SIZE);
+		}
+		else
+		{
+			memcpy(instruction + OP_SIZE, &length, LENGTH_SIZE);
+			stream.put(instruction, OP_SIZE + LENGTH_SIZE);
+			stream.put(f, op.start, op.length);
+		}
+	}
+	stream.flush();
+	sender->end();
 }
 
 // read server response to sent file
@@ -336,38 +837,111 @@ void sendFileAck(Session* s)
 		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
 		if (s->getHeaderRecieved()->size != UID_SIZE + SIZE_SIZE + NAME_SIZE + CRC_SIZE) throw std::runtime_error("Bad messasge size");
 		s->to->readPayload();
-		const char* name = s->getBuffer()->data();
+		const char* name = s->getPayload().data();
 		if (strncmp(name, s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
-		size_t size = *(size_t*)(s->getBuffer()->data() + UID_SIZE);
+		uint32_t size = *(uint32_t*)(s->getPayload().data() + UID_SIZE); // SIZE_SIZE bytes, the name follows
 		if (size != s->getLen()) throw std::runtime_error("Wrong file size");
-		const char* fname = s->getBuffer()->data() + UID_SIZE + SIZE_SIZE;
+		const char* fname = s->getPayload().data() + UID_SIZE + SIZE_SIZE;
 	}
 	catch (std::exception const& error)
 	{
-		size_t rem = s->getSocket()->available();
-		while (rem)
-		{
-			size_t req = std::min(rem, (size_t)MAX_SIZE);
-			s->to->flush(req);
-			rem -= req;
-		}
-		throw error;
+		s->to->drain();
+		throw;
+	}
+}
+
+
+// send the cksum of every chunk so the server can tell which ones arrived damaged
+void sendChunkCRCs(Session* s, char* name)
+{
+	std::vector<uint32_t>* crcs = s->getChunkCRCs();
+	size_t size = ChunkCRCsRequest::size(name, *crcs);
+	Header header = generateHeader(s->getConfig()->getUID().data(), CHUNK_CRCS, size, s->getVersion());
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	char* request = s->getRequest(size);
+	ChunkCRCsRequest::write(request, size, name, *crcs);
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request, size));
+	s->to->write(buffers);
+}
+
+// read the list of chunks whose cksum didn't match on the server
+// an empty or nonsensical list throws, which falls back to resending the whole file
+void badChunksAck(Session* s)
+{
+	try
+	{
+		s->to->readHeader();
+		if (s->getHeaderRecieved()->code == GENERIC_ERROR) throw std::runtime_error("Server responded with generic error");
+		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
+		if (s->getHeaderRecieved()->size < UID_SIZE + COUNT_SIZE) throw std::runtime_error("Bad messasge size");
+		s->to->readPayload();
+		if (strncmp(s->getPayload().data(), s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
+		uint32_t count = *(uint32_t*)(s->getPayload().data() + UID_SIZE);
+		if (s->getHeaderRecieved()->size != UID_SIZE + COUNT_SIZE + (uint64_t)count * INDEX_SIZE) throw std::runtime_error("Bad messasge size");
+		if (count == 0) throw std::runtime_error("Server found no bad chunk");
+		std::vector<uint32_t>* bad = s->getBadChunks();
+		bad->resize(count);
+		memcpy(bad->data(), s->getPayload().data() + UID_SIZE + COUNT_SIZE, (size_t)count * INDEX_SIZE);
+		for (uint32_t index : *bad)
+			if (index >= s->getChunkCRCs()->size()) throw std::runtime_error("Bad chunk index");
+		std::cout << "Resending " << count << " of " << s->getChunkCRCs()->size() << " chunks" << std::endl;
+	}
+	catch (std::exception const& error)
+	{
+		s->to->drain();
+		throw;
 	}
 }
 
+// resend the flagged chunks under a fresh nonce, each encrypted with the counter of its place in the file
+void sendChunks(Session* s)
+{
+	MappedFile f(s->getPath());
+	std::vector<uint32_t>* bad = s->getBadChunks();
+	uint64_t data = 0;
+	for (uint32_t index : *bad)
+		data += CryptoPP::STDMIN((uint64_t)CHECK_CHUNK, f.size() - (uint64_t)index * CHECK_CHUNK);
+	char name[NAME_SIZE];
+	memcpy(name, s->getFname()->data(), NAME_SIZE);
+	CryptoPP::byte nonce[NONCE_SIZE];
+	size_t meta = ChunksRequest::size(name, nonce, *bad);
+	Header header = generateHeader(s->getConfig()->getUID().data(), RESEND_CHUNKS, meta + data, s->getVersion());
+	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
+	CryptoPP::AutoSeededRandomPool rng;
+	rng.GenerateBlock(nonce, NONCE_SIZE);
+	char* request = s->getRequest(meta);
+	ChunksRequest::write(request, meta, name, nonce, *bad);
+	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
+	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
+	buffers.push_back(boost::asio::buffer(request, meta));
+	SendEngine* sender = s->getSender();
+	sender->begin(buffers);
+	ParallelCTR engine(s->getAES(), nonce, std::thread::hardware_concurrency());
+	for (uint32_t index : *bad)
+	{
+		uint64_t offset = (uint64_t)index * CHECK_CHUNK;
+		size_t available;
+		const char* p = f.map(offset, available); // chunks never straddle a window
+		size_t req = (size_t)CryptoPP::STDMIN((uint64_t)CHECK_CHUNK, f.size() - offset);
+		BufferPool::Buffer out = sender->acquire(req);
+		engine.process(offset, p, out->data(), req);
+		sender->send(std::move(out), req);
+	}
+	sender->end();
+}
 
 // calculate CRC and compare it to the CRC sent by the server - send CRC_ACK if they are equal, CRC_NACK if not
 // if sending the file is retried too many times CRC_FAIL
 void sendCRC(Session* s)
 {
-	if (memcmp(s->getConfig()->getUID().data(), s->getBuffer()->data(), UID_SIZE)) throw std::runtime_error("UID mismatch");
+	if (memcmp(s->getConfig()->getUID().data(), s->getPayload().data(), UID_SIZE)) throw std::runtime_error("UID mismatch");
 	// The following line compares in packet length field to the length of the file sent to the server
-	if (s->getLen() != *((int*)(s->getBuffer()->data() + UID_SIZE))) throw std::runtime_error("Length mismatch");
-	int pos = s->getConfig()->getPath().find_last_of('\\'); // find beginning of filename
-	if (pos == std::string::npos) pos = -1; // if file is in current directory - path is name
+	if (s->getLen() != *((uint32_t*)(s->getPayload().data() + UID_SIZE))) throw std::runtime_error("Length mismatch");
 	char name[NAME_SIZE];
-	strcpy(name, s->getConfig()->getPath().data() + pos + 1);
-	if (strncmp(s->getConfig()->getPath().data(), s->getBuffer()->data() + UID_SIZE + SIZE_SIZE, NAME_SIZE)) throw std::runtime_error("File name mismatch");
+	memcpy(name, s->getFname()->data(), NAME_SIZE); // name as it was sent along with the file
+	if (strncmp(name, s->getPayload().data() + UID_SIZE + SIZE_SIZE, NAME_SIZE)) throw std::runtime_error("File name mismatch");
 	std::cout << "Calculating cksum" << std::endl;
 	uint16_t success = crcCmp(s) ? CRC_ACK : CRC_NACK ; // cmp Cksum
 	if (success == CRC_NACK)
@@ -376,7 +950,7 @@ void sendCRC(Session* s)
 		s->decFail();
 		if (s->getFail() == 0)
 		{
-			std::cout << "Fatal error: 4th bad CRC, terminating" << std::endl;
+			std::cout << "Error: 4th bad CRC, giving up on " << s->getPath() << std::endl;
 			success = CRC_FAIL;
 			s->setRetry(FALSE);
 		}
@@ -384,14 +958,18 @@ void sendCRC(Session* s)
 			s->setRetry(TRUE);
 	}
 	else std::cout << "Alert: CRC match" << std::endl;
-	Header header = generateHeader(s->getConfig()->getUID().data(), success , NAME_SIZE);
+	if (success == CRC_NACK and s->getVersion() >= CHUNK_VER and !s->getChunkCRCs()->empty())
+	{
+		sendChunkCRCs(s, name); // let the server find the bad chunks instead of resending everything
+		return;
+	}
+	Header header = generateHeader(s->getConfig()->getUID().data(), success , NameRequest::fixed, s->getVersion());
 	memcpy(s->getHeaderSent(), &header, HEADER_SIZE);
-	void* args[SEND_CRC_ARGS];
-	packArgs(args, SEND_CRC_ARGS, name);
-	std::string request = generateRequest(success, args, REGISTER_ARGS);
+	char request[NameRequest::fixed];
+	NameRequest::write(request, sizeof(request), name);
 	std::vector<boost::asio::mutable_buffer> buffers; // Vector of buffers used to avoid copying overhead needed to combine header and payload into one buffer
 	buffers.push_back(boost::asio::buffer(&header, HEADER_SIZE));
-	buffers.push_back(boost::asio::buffer(request,NAME_SIZE));
+	buffers.push_back(boost::asio::buffer(request));
 	s->to->write(buffers);
 }
 
@@ -406,160 +984,107 @@ void sendCRCAck(Session* s)
 		if (s->getHeaderRecieved()->code != codes[s->getHeaderSent()->code]) throw std::runtime_error("Unexpected code in header");
 		if (s->getHeaderRecieved()->size != UID_SIZE) throw std::runtime_error("Bad messasge size");
 		s->to->readPayload();
-		const char* name = s->getBuffer()->data();
+		const char* name = s->getPayload().data();
 		if (strncmp(name, s->getConfig()->getUID().data(), UID_SIZE)) throw std::runtime_error("Wrong UID");
 		std::cout << "Got final ack, file is verified" << std::endl;
 	}
 	catch (std::exception const& error)
 	{
-		size_t rem = s->getSocket()->available();
-		while (rem)
-		{
-			size_t req = std::min(rem, (size_t)MAX_SIZE);
-			s->to->flush(req);
-			rem -= req;
-		}
-		throw error;
+		s->to->drain();
+		throw;
 	}
 }
 
 // util function used for AES encrypting a given file with a given key
-void encryptFile(CryptoPP::SecByteBlock key, std::ifstream& fin)
-{
-	std::ofstream fout;
-	fout.open("out.info", std::ios::out | std::ios::binary);
-	if (!fout.is_open()) throw std::runtime_error("Couldn't generate output file");
-	char zero[CryptoPP::AES::BLOCKSIZE] = { '\0' }; // zeroed iv
-	CryptoPP::SecByteBlock iv(reinterpret_cast<const CryptoPP::byte*>(&zero[0]), CryptoPP::AES::BLOCKSIZE);
-	CryptoPP::CBC_Mode< CryptoPP::AES >::Encryption e;
-	e.SetKeyWithIV(key, key.size(), iv);
-	CryptoPP::byte encrypted[CryptoPP::AES::BLOCKSIZE] = { '\0' }; // zero plain text just in case
-	// Setting up pipeline from read text to encrypted and encoded text in file
-	CryptoPP::FileSource fs(fin, false);
-	CryptoPP::StreamTransformationFilter encryptor(e,
-		new CryptoPP::FileSink(fout), // mid buffer
-		CryptoPP::StreamTransformationFilter::DEFAULT_PADDING); // padding style;
-	fs.Attach(new CryptoPP::Redirector(encryptor));
-	CryptoPP::lword remaining = FileSize(fs);
+// the whole blocks go through the pipeline - read, cksum, CBC and send each on a thread of their own - and only
+// the padded tail is encrypted here afterwards, through a block on the stack
+void encryptFile(CryptoPP::SecByteBlock key, MappedFile& fin, SendEngine* sender, Cksum& crc)
+{
+	CryptoPP::byte zero[CryptoPP::AES::BLOCKSIZE] = { 0 }; // zeroed iv
+	BulkCBC engine(key, zero);
+	CryptoPP::lword remaining = fin.size();
 	std::cout << "Encrypting file with size:" << remaining << std::endl;
-	while (remaining && !fs.SourceExhausted())
+	uint64_t whole = remaining - remaining % CryptoPP::AES::BLOCKSIZE;
+	Pipeline pipeline(fin, sender, PIPELINE_BLOCK);
+	pipeline.run(0, whole, [&crc](const char* data, size_t length) { crc.update(data, length); },
+		[&engine](uint64_t, char* data, size_t length) { engine.process(data, data, length); }, [](uint64_t) {});
+	remaining -= whole;
+	BufferPool::Buffer out = sender->acquire(CryptoPP::AES::BLOCKSIZE);
+	const char* tail = out->data(); // nothing left over, the tail is pure padding
+	if (remaining)
 	{
-		unsigned int req = CryptoPP::STDMIN(remaining, (CryptoPP::lword)CryptoPP::AES::BLOCKSIZE);
-		fs.Pump(CryptoPP::AES::BLOCKSIZE);
-		encryptor.Flush(false);
-		remaining -= req;
+		size_t available;
+		tail = fin.map(whole, available);
+		crc.update(tail, (size_t)remaining);
 	}
-	encryptor.MessageEnd();
-	fout.close();
+	size_t last = engine.finish(tail, (size_t)remaining, out->data());
+	sender->send(std::move(out), last);
+	Metrics::observe(Metrics::CPU_SECONDS, "file read", pipeline.getReading());
+	Metrics::observe(Metrics::CPU_SECONDS, "cksum", pipeline.getChecksumming());
+	Metrics::observe(Metrics::CPU_SECONDS, "cbc encrypt", pipeline.getEncrypting());
 }
 
-unsigned long memcrc(std::ifstream& fin);
-//Calculate POSIX compliant Cksum and compare to value received from server
-bool crcCmp(Session* s)
-{
-	std::ifstream fin(s->getConfig()->getPath(), std::ios::in | std::ios::binary);
-	unsigned long res = memcrc(fin);
-	std::cout << "Checksum is:" << res << std::endl;
-	return *(unsigned int*)(s->getBuffer()->data() + UID_SIZE + SIZE_SIZE + NAME_SIZE) == res;
-}
-
-// start of implementation of POSIX cksum
-static unsigned long crctab[] = {
-0x00000000,
-0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
-0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6,
-0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
-0x4c11db70, 0x48d0c6c7, 0x4593e01e, 0x4152fda9, 0x5f15adac,
-0x5bd4b01b, 0x569796c2, 0x52568b75, 0x6a1936c8, 0x6ed82b7f,
-0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3, 0x709f7b7a,
-0x745e66cd, 0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
-0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5, 0xbe2b5b58,
-0xbaea46ef, 0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033,
-0xa4ad16ea, 0xa06c0b5d, 0xd4326d90, 0xd0f37027, 0xddb056fe,
-0xd9714b49, 0xc7361b4c, 0xc3f706fb, 0xceb42022, 0xca753d95,
-0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1, 0xe13ef6f4,
-0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d, 0x34867077, 0x30476dc0,
-0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5,
-0x2ac12072, 0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16,
-0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca, 0x7897ab07,
-0x7c56b6b0, 0x71159069, 0x75d48dde, 0x6b93dddb, 0x6f52c06c,
-0x6211e6b5, 0x66d0fb02, 0x5e9f46bf, 0x5a5e5b08, 0x571d7dd1,
-0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
-0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b,
-0xbb60adfc, 0xb6238b25, 0xb2e29692, 0x8aad2b2f, 0x8e6c3698,
-0x832f1041, 0x87ee0df6, 0x99a95df3, 0x9d684044, 0x902b669d,
-0x94ea7b2a, 0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e,
-0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2, 0xc6bcf05f,
-0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34,
-0xdc3abded, 0xd8fba05a, 0x690ce0ee, 0x6dcdfd59, 0x608edb80,
-0x644fc637, 0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb,
-0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f, 0x5c007b8a,
-0x58c1663d, 0x558240e4, 0x51435d53, 0x251d3b9e, 0x21dc2629,
-0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5, 0x3f9b762c,
-0x3b5a6b9b, 0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff,
-0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623, 0xf12f560e,
-0xf5ee4bb9, 0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65,
-0xeba91bbc, 0xef68060b, 0xd727bbb6, 0xd3e6a601, 0xdea580d8,
-0xda649d6f, 0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3,
-0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7, 0xae3afba2,
-0xaafbe615, 0xa7b8c0cc, 0xa379dd7b, 0x9b3660c6, 0x9ff77d71,
-0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74,
-0x857130c3, 0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640,
-0x4e8ee645, 0x4a4ffbf2, 0x470cdd2b, 0x43cdc09c, 0x7b827d21,
-0x7f436096, 0x7200464f, 0x76c15bf8, 0x68860bfd, 0x6c47164a,
-0x61043093, 0x65c52d24, 0x119b4be9, 0x155a565e, 0x18197087,
-0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
-0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d,
-0x2056cd3a, 0x2d15ebe3, 0x29d4f654, 0xc5a92679, 0xc1683bce,
-0xcc2b1d17, 0xc8ea00a0, 0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb,
-0xdbee767c, 0xe3a1cbc1, 0xe760d676, 0xea23f0af, 0xeee2ed18,
-0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4, 0x89b8fd09,
-0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662,
-0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf,
-0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
-};
-
-
-unsigned long memcrc(std::ifstream& fin)
+// encrypts the file from start on through the pipeline, start being a multiple of the block size - each block holds
+// one CTR_SEGMENT per thread, as far as PIPELINE_MEMORY allows, which the encryptor stage spreads over the threads
+// the part before start only goes through the checksum, progress hears how far the file has been handed to the send engine
+void encryptFileCTR(const ParallelCTR& engine, MappedFile& fin, SendEngine* sender, ChunkedCksum& crc, uint64_t start, const std::function<void(uint64_t)>& progress)
 {
-	register unsigned i, c, s = 0;
-	int pos;
-	fin.seekg(-1, std::ios::end);
-	pos = fin.tellg();
-	fin.seekg(0);
-	size_t n = (size_t)pos + 1;
-	char arr[12093];
-	fin.read(arr, 12093);
-	char* b = arr;
-	int count = 0;
-	for (i = n; i > 0; --i) {
-		count++;
-		c = (unsigned char)(*b++);
-		s = (s << 8) ^ crctab[(s >> 24) ^ c];
+	size_t block = std::min((size_t)CTR_SEGMENT * engine.getThreads(), (size_t)(PIPELINE_MEMORY / PIPELINE_DEPTH));
+	std::chrono::duration<double> checksumming(0);
+	std::cout << "Encrypting file with size:" << fin.size() << " on " << engine.getThreads() << " threads" << std::endl;
+	uint64_t offset = 0;
+	while (offset < start) // server already has this part, the checksum still covers the whole file
+	{
+		size_t available;
+		const char* p = fin.map(offset, available);
+		size_t req = (size_t)CryptoPP::STDMIN((CryptoPP::lword)available, (CryptoPP::lword)(start - offset));
+		auto begin = std::chrono::steady_clock::now();
+		crc.update(p, req);
+		checksumming += std::chrono::steady_clock::now() - begin;
+		offset += req;
 	}
+	Pipeline pipeline(fin, sender, block);
+	pipeline.run(start, fin.size(), [&crc](const char* data, size_t length) { crc.update(data, length); },
+		[&engine](uint64_t at, char* data, size_t length) { engine.process(at, data, data, length); }, progress);
+	Metrics::observe(Metrics::CPU_SECONDS, "file read", pipeline.getReading());
+	Metrics::observe(Metrics::CPU_SECONDS, "cksum", checksumming.count() + pipeline.getChecksumming());
+	Metrics::observe(Metrics::CPU_SECONDS, "ctr encrypt", pipeline.getEncrypting());
+}
 
-
-	/* Extend with the length of the string. */
-	while (n != 0) {
-		c = n & 0377;
-		n >>= 8;
-		s = (s << 8) ^ crctab[(s >> 24) ^ c];
+// encrypts an in memory buffer in batches of one CTR_SEGMENT per thread and queues it for sending
+void encryptBufferCTR(const ParallelCTR& engine, const std::string& in, SendEngine* sender)
+{
+	size_t batch = (size_t)CTR_SEGMENT * engine.getThreads();
+	std::cout << "Encrypting deflated file with size:" << in.size() << " on " << engine.getThreads() << " threads" << std::endl;
+	for (size_t offset = 0; offset < in.size(); offset += batch)
+	{
+		size_t req = std::min(batch, in.size() - offset);
+		BufferPool::Buffer out = sender->acquire(req);
+		engine.process(offset, in.data() + offset, out->data(), req);
+		sender->send(std::move(out), req);
 	}
-
-
-	return ~s;
 }
-// end of implementation of POSIX cksum
 
-// util function that calculates filesize
-inline CryptoPP::lword FileSize(const CryptoPP::FileSource& file)
+uint32_t memcrc(MappedFile& fin);
+//Compare POSIX compliant Cksum computed while sending to value received from server
+bool crcCmp(Session* s)
 {
-	std::istream* stream = const_cast<CryptoPP::FileSource&>(file).GetStream();
-
-	std::ifstream::pos_type old = stream->tellg();
-	std::ifstream::pos_type end = stream->seekg(0, std::ios_base::end).tellg();
-	stream->seekg(old);
+	uint32_t res = s->getCRC();
+	std::cout << "Checksum is:" << res << std::endl;
+	return *(uint32_t*)(s->getPayload().data() + UID_SIZE + SIZE_SIZE + NAME_SIZE) == res;
+}
 
-	return static_cast<CryptoPP::lword>(end);
+// util function that calculates the POSIX Cksum of a whole mapped file
+uint32_t memcrc(MappedFile& fin)
+{
+	Cksum crc;
+	uint64_t offset = 0;
+	size_t available;
+	while (const char* p = fin.map(offset, available))
+	{
+		crc.update(p, available);
+		offset += available;
+	}
+	return crc.finalize();
 }
-#undef _CRT_SECURE_NO_WARNINGS
\ No newline at end of file
+#undef _CRT_SECURE_NO_WARNINGS
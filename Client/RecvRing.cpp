@@ -0,0 +1,58 @@
+#include "RecvRing.hpp"
+#include <cstring>
+
+RecvRing::RecvRing(size_t capacity) : ring(capacity), head(0), cursor(0), tail(0)
+{
+}
+
+// bytes read but not handed out yet
+size_t RecvRing::pending() const
+{
+	return tail - cursor;
+}
+
+// free space for the next read, at least more bytes of it - the current message moves to the front if it has to
+boost::asio::mutable_buffer RecvRing::space(size_t more)
+{
+	if (tail + more > ring.size())
+	{
+		memmove(ring.data(), ring.data() + head, tail - head);
+		cursor -= head;
+		tail -= head;
+		head = 0;
+		if (tail + more > ring.size()) ring.resize(tail + more);
+	}
+	return boost::asio::buffer(ring.data() + tail, ring.size() - tail);
+}
+
+void RecvRing::filled(size_t bytes)
+{
+	tail += bytes;
+}
+
+// hands out the next bytes of the current message, valid until the message after it is started
+const char* RecvRing::take(size_t bytes)
+{
+	const char* at = ring.data() + cursor;
+	cursor += bytes;
+	return at;
+}
+
+// first byte of the current message, where its header sits
+const char* RecvRing::message() const
+{
+	return ring.data() + head;
+}
+
+// everything handed out so far is done with, the next message starts at the cursor
+void RecvRing::next()
+{
+	head = cursor;
+	if (head == tail) head = cursor = tail = 0; // nothing buffered, start over at the front
+}
+
+// drops whatever is buffered, for a fresh connection
+void RecvRing::clear()
+{
+	head = cursor = tail = 0;
+}
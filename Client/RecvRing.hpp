@@ -0,0 +1,28 @@
+// Receive buffer the responses of a session are framed in
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include "defs.hpp"
+
+// Reads land in the free space behind the buffered bytes, as much as the kernel has ready, so a header usually
+// brings its payload along in the same read - messages are parsed where they landed and consumed by moving a cursor
+// the current message only moves back to the front when the rest of it wouldn't fit behind it, and the buffer only
+// grows for a message larger than all of it, so once warmed up reading allocates nothing and copies only out of the kernel
+class RecvRing
+{
+private:
+	std::vector<char> ring;
+	size_t head; // first byte of the current message
+	size_t cursor; // first byte not handed out yet
+	size_t tail; // end of the bytes read
+public:
+	RecvRing(size_t capacity = RECV_RING_SIZE);
+	size_t pending() const;
+	boost::asio::mutable_buffer space(size_t more);
+	void filled(size_t bytes);
+	const char* take(size_t bytes);
+	const char* message() const;
+	void next();
+	void clear();
+};
@@ -1,3 +1,141 @@
+// Request payload layouts - one typed field list per request, serialized straight into a buffer the caller sized
+#pragma once
+#include <cstddef>
 #include <cstdint>
-#include <string>
-std::string generateRequest(uint16_t code, void* args, unsigned int argc);
\ No newline at end of file
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "defs.hpp"
+#include "Chunker.hpp"
+
+// A field knows how it is passed (Arg), the bytes it takes at least (fixed) and how to write itself at a position,
+// returning the position after it - integers are written byte by byte in little endian whatever the host
+// nothing here allocates or keeps state, so any number of sessions can build requests at once
+namespace Wire
+{
+	// text padded with NULs to N bytes, cut short so that the last byte is always a NUL
+	template<size_t N>
+	struct Text
+	{
+		typedef const char* Arg;
+		static constexpr size_t fixed = N;
+		static size_t size(Arg) { return N; }
+		static char* put(char* out, Arg text)
+		{
+			size_t len = strnlen(text, N - 1);
+			memcpy(out, text, len);
+			memset(out + len, 0, N - len);
+			return out + N;
+		}
+	};
+
+	// N bytes copied as they are - nonces, ticket ids, digests and keys
+	template<size_t N>
+	struct Bytes
+	{
+		typedef const unsigned char* Arg;
+		static constexpr size_t fixed = N;
+		static size_t size(Arg) { return N; }
+		static char* put(char* out, Arg bytes)
+		{
+			memcpy(out, bytes, N);
+			return out + N;
+		}
+	};
+
+	// unsigned integer of Size bytes, narrower than its type when the wire says so
+	template<typename T, size_t Size = sizeof(T)>
+	struct Int
+	{
+		static_assert(std::is_unsigned<T>::value and Size <= sizeof(T), "Int fields hold unsigned integers that fit their type");
+		typedef T Arg;
+		static constexpr size_t fixed = Size;
+		static size_t size(Arg) { return Size; }
+		static char* put(char* out, Arg value)
+		{
+			for (size_t i = 0; i < Size; i++)
+				out[i] = (char)(unsigned char)(value >> (8 * i));
+			return out + Size;
+		}
+	};
+
+	// COUNT_SIZE byte element count followed by the elements, each written as the field Element
+	template<typename Element>
+	struct List
+	{
+		typedef typename std::decay<typename Element::Arg>::type Value;
+		typedef const std::vector<Value>& Arg;
+		static constexpr size_t fixed = COUNT_SIZE;
+		static size_t size(Arg values) { return COUNT_SIZE + values.size() * Element::fixed; }
+		static char* put(char* out, Arg values)
+		{
+			out = Int<uint32_t, COUNT_SIZE>::put(out, (uint32_t)values.size());
+			for (const Value& value : values)
+				out = Element::put(out, value);
+			return out;
+		}
+	};
+
+	// content defined chunk as listed in CHUNK_LIST - its SHA-256 and length
+	struct ChunkEntry
+	{
+		typedef const Chunker::Chunk& Arg;
+		static constexpr size_t fixed = DIGEST_SIZE + LENGTH_SIZE;
+		static size_t size(Arg) { return fixed; }
+		static char* put(char* out, Arg chunk)
+		{
+			out = Bytes<DIGEST_SIZE>::put(out, chunk.digest);
+			return Int<uint32_t, LENGTH_SIZE>::put(out, chunk.length);
+		}
+	};
+
+	// fields in wire order - fixed is the whole payload for layouts without a List
+	template<typename... Fields>
+	struct Layout
+	{
+		static constexpr size_t fixed = (size_t(0) + ... + Fields::fixed);
+		static size_t size(typename Fields::Arg... args)
+		{
+			return (size_t(0) + ... + Fields::size(args));
+		}
+		// writes the payload to out, which holds capacity bytes, and returns its size
+		static size_t write(char* out, size_t capacity, typename Fields::Arg... args)
+		{
+			if (capacity < size(args...)) throw std::length_error("Request doesn't fit its buffer");
+			char* at = out;
+			((at = Fields::put(at, args)), ...);
+			return (size_t)(at - out);
+		}
+	};
+
+	typedef Text<NAME_SIZE> Name;
+}
+
+// REGISTER, RECONNECT, GET_SIGNATURES and the CRC_ACK, CRC_NACK and CRC_FAIL verdicts only carry the name
+typedef Wire::Layout<Wire::Name> NameRequest;
+// SEND_KEY - name and the DER encoded public key
+typedef Wire::Layout<Wire::Name, Wire::Bytes<KEY_SIZE>> KeyRequest;
+// SEND_FILE - size and name up to CTR_VER, then the cipher and nonce, from RESUME_VER the offset
+// and from COMPRESS_VER the codec and the size of the file before it - the file itself follows separately
+typedef Wire::Layout<Wire::Int<uint32_t, SIZE_SIZE>, Wire::Name> FileRequest;
+typedef Wire::Layout<Wire::Int<uint32_t, SIZE_SIZE>, Wire::Name, Wire::Int<uint8_t, CIPHER_SIZE>, Wire::Bytes<NONCE_SIZE>> FileCTRRequest;
+typedef Wire::Layout<Wire::Int<uint32_t, SIZE_SIZE>, Wire::Name, Wire::Int<uint8_t, CIPHER_SIZE>, Wire::Bytes<NONCE_SIZE>,
+	Wire::Int<uint32_t, OFFSET_SIZE>> FileResumeRequest;
+typedef Wire::Layout<Wire::Int<uint32_t, SIZE_SIZE>, Wire::Name, Wire::Int<uint8_t, CIPHER_SIZE>, Wire::Bytes<NONCE_SIZE>,
+	Wire::Int<uint32_t, OFFSET_SIZE>, Wire::Int<uint8_t, CODEC_SIZE>, Wire::Int<uint32_t, SIZE_SIZE>> FileCodecRequest;
+// RESUME - name and nonce of the interrupted upload
+typedef Wire::Layout<Wire::Name, Wire::Bytes<NONCE_SIZE>> ResumeRequest;
+// RESUME_SESSION - name, ticket id and the client's nonce
+typedef Wire::Layout<Wire::Name, Wire::Bytes<TICKET_ID_SIZE>, Wire::Bytes<NONCE_SIZE>> ResumeSessionRequest;
+// CHUNK_CRCS - name and the cksum of every chunk
+typedef Wire::Layout<Wire::Name, Wire::List<Wire::Int<uint32_t, CRC_SIZE>>> ChunkCRCsRequest;
+// RESEND_CHUNKS and DEDUP_FILE - name, nonce of the data that follows and the indexes of the chunks in it
+typedef Wire::Layout<Wire::Name, Wire::Bytes<NONCE_SIZE>, Wire::List<Wire::Int<uint32_t, INDEX_SIZE>>> ChunksRequest;
+// CHUNK_LIST - name and a digest and length per chunk
+typedef Wire::Layout<Wire::Name, Wire::List<Wire::ChunkEntry>> ChunkListRequest;
+// DELTA_FILE - name and the nonce of the instruction stream
+typedef Wire::Layout<Wire::Name, Wire::Bytes<NONCE_SIZE>> DeltaRequest;
+
+static_assert(FileCodecRequest::fixed == SIZE_SIZE + NAME_SIZE + CIPHER_SIZE + NONCE_SIZE + OFFSET_SIZE + CODEC_SIZE + SIZE_SIZE, "SEND_FILE layout");
+static_assert(ChunksRequest::fixed == NAME_SIZE + NONCE_SIZE + COUNT_SIZE, "RESEND_CHUNKS layout");
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include "MappedFile.hpp"
+#include "Scheduler.hpp"
+#include "Session.hpp"
+#include "Watcher.hpp"
+
+// sorts by size and deals files out so every worker starts with a similar share of the big ones
+FileQueue::FileQueue(const std::vector<std::string>& paths, unsigned count, bool live) : opened(false), cancelled(false), live(live), added(0)
+{
+	if (count == 0) count = 1;
+	for (unsigned i = 0; i < count; i++)
+		workers.emplace_back(new Worker());
+	std::vector<Entry> entries;
+	for (const std::string& p : paths)
+	{
+		std::error_code ec;
+		uint64_t size = std::filesystem::file_size(p, ec);
+		entries.push_back({ p, ec ? 0 : size }); // unreadable files still get handed out so they're reported
+	}
+	std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.size > b.size; });
+	for (size_t i = 0; i < entries.size(); i++)
+		workers[i % count]->files.push_back(entries[i]);
+}
+
+// next file for the given worker - a live queue waits for one to be pushed while there's none, until it's closed
+bool FileQueue::pop(unsigned worker, std::string& path)
+{
+	while (true)
+	{
+		uint64_t seen;
+		{
+			std::lock_guard<std::mutex> guard(stateLock);
+			seen = added;
+		}
+		if (take(worker, path)) return true;
+		std::unique_lock<std::mutex> guard(stateLock);
+		stateChanged.wait(guard, [&]() { return !live or added != seen; });
+		if (added == seen) return false; // nothing came in since we looked
+	}
+}
+
+// own deque first, then the largest file any other worker still has queued
+bool FileQueue::take(unsigned worker, std::string& path)
+{
+	{
+		std::lock_guard<std::mutex> guard(workers[worker]->lock);
+		if (!workers[worker]->files.empty())
+		{
+			path = workers[worker]->files.front().path;
+			workers[worker]->files.pop_front();
+			return true;
+		}
+	}
+	while (true)
+	{
+		size_t victim = workers.size();
+		uint64_t best = 0;
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			if (i == worker) continue;
+			std::lock_guard<std::mutex> guard(workers[i]->lock);
+			if (!workers[i]->files.empty() and (victim == workers.size() or workers[i]->files.front().size > best))
+			{
+				victim = i;
+				best = workers[i]->files.front().size;
+			}
+		}
+		if (victim == workers.size()) return false; // nothing left anywhere
+		std::lock_guard<std::mutex> guard(workers[victim]->lock);
+		if (workers[victim]->files.empty()) continue; // victim got to it first, look again
+		path = workers[victim]->files.front().path;
+		workers[victim]->files.pop_front();
+		return true;
+	}
+}
+
+// requeues a file a failed session was in the middle of, any surviving worker will steal it
+void FileQueue::giveBack(unsigned worker, const std::string& path)
+{
+	std::error_code ec;
+	uint64_t size = std::filesystem::file_size(path, ec);
+	{
+		std::lock_guard<std::mutex> guard(workers[worker]->lock);
+		workers[worker]->files.push_front({ path, ec ? 0 : size });
+	}
+	std::lock_guard<std::mutex> guard(stateLock);
+	added++;
+	stateChanged.notify_all();
+}
+
+// queues files the watcher saw change, each to the worker with the least queued - one already waiting isn't queued twice
+void FileQueue::push(const std::vector<std::string>& paths)
+{
+	uint64_t count = 0;
+	for (const std::string& p : paths)
+	{
+		size_t least = 0, fewest = SIZE_MAX;
+		bool queued = false;
+		for (size_t i = 0; i < workers.size() and !queued; i++)
+		{
+			std::lock_guard<std::mutex> guard(workers[i]->lock);
+			for (const Entry& e : workers[i]->files)
+				queued = queued or e.path == p;
+			if (workers[i]->files.size() < fewest)
+			{
+				least = i;
+				fewest = workers[i]->files.size();
+			}
+		}
+		if (queued) continue;
+		std::error_code ec;
+		uint64_t size = std::filesystem::file_size(p, ec);
+		std::lock_guard<std::mutex> guard(workers[least]->lock);
+		workers[least]->files.push_back({ p, ec ? 0 : size });
+		count++;
+	}
+	if (!count) return;
+	std::lock_guard<std::mutex> guard(stateLock);
+	added += count;
+	stateChanged.notify_all();
+}
+
+// no more files will be pushed and those still queued are dropped - sessions end after the file they're on
+void FileQueue::close()
+{
+	for (auto& w : workers)
+	{
+		std::lock_guard<std::mutex> guard(w->lock);
+		w->files.clear();
+	}
+	std::lock_guard<std::mutex> guard(stateLock);
+	live = false;
+	stateChanged.notify_all();
+}
+
+bool FileQueue::isLive()
+{
+	std::lock_guard<std::mutex> guard(stateLock);
+	return live;
+}
+
+// files nobody got to
+size_t FileQueue::remaining()
+{
+	size_t count = 0;
+	for (auto& w : workers)
+	{
+		std::lock_guard<std::mutex> guard(w->lock);
+		count += w->files.size();
+	}
+	return count;
+}
+
+unsigned FileQueue::getWorkers() const
+{
+	return (unsigned)workers.size();
+}
+
+// called by the lead session once UID and key are settled
+void FileQueue::open()
+{
+	std::lock_guard<std::mutex> guard(stateLock);
+	opened = true;
+	stateChanged.notify_all();
+}
+
+// called if the lead session dies - has no effect once the queue was opened
+void FileQueue::cancel()
+{
+	std::lock_guard<std::mutex> guard(stateLock);
+	cancelled = true;
+	stateChanged.notify_all();
+}
+
+bool FileQueue::isOpen()
+{
+	std::lock_guard<std::mutex> guard(stateLock);
+	return opened;
+}
+
+// blocks other sessions until the lead registered or reconnected - false if it never will
+bool FileQueue::waitOpen()
+{
+	std::unique_lock<std::mutex> guard(stateLock);
+	stateChanged.wait(guard, [this]() { return opened or cancelled; });
+	return opened;
+}
+
+// runs count concurrent sessions (each with its own socket) over all configured files
+// session 0 does any registration, the others reconnect once it's done
+void runSessions(ConfigHandler* conf, unsigned count)
+{
+	FileQueue queue(conf->getPaths(), count);
+	Journal journal;
+	count = queue.getWorkers();
+	std::vector<std::unique_ptr<Session>> sessions;
+	for (unsigned i = 0; i < count; i++)
+		sessions.emplace_back(new Session(conf, &queue, &journal, i));
+	std::exception_ptr leadError;
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < count; i++)
+	{
+		threads.emplace_back([&sessions, i]()
+		{
+			try
+			{
+				sessions[i]->run();
+			}
+			catch (std::exception const& error) // other workers pick up whatever this one left behind
+			{
+				std::cout << "Error: session " << i << " stopped:" << error.what() << std::endl;
+			}
+		});
+	}
+	try
+	{
+		sessions[0]->run();
+	}
+	catch (std::exception const& error)
+	{
+		std::cout << "Error: session 0 stopped:" << error.what() << std::endl;
+		if (!queue.isOpen()) leadError = std::current_exception(); // never got past the handshake, nobody transferred anything
+	}
+	for (std::thread& t : threads)
+		t.join();
+	if (leadError) std::rethrow_exception(leadError);
+	size_t total = conf->getPaths().size(), verified = 0;
+	for (auto& s : sessions)
+		verified += s->getVerified();
+	std::cout << "Transferred " << verified << " of " << total << " files" << std::endl;
+	if (verified < total) throw std::runtime_error("Some files couldn't be transferred");
+}
+
+// keeps count sessions connected, uploading every configured file and from then on each file the watcher reports,
+// until *stop is set - the key, the AES key and the connections stay up between changes, so a saved file goes out
+// over a session that is already authenticated
+// a session that drops is started again after a backoff, over the ticket or a reconnect, and the file it was on goes back
+// to the queue - files still queued at the stop are caught by the first pass of the next start
+// a refused reconnect stops the daemon, registering anew would change the UID under the sessions still running
+void runDaemon(ConfigHandler* conf, unsigned count, const volatile std::sig_atomic_t* stop)
+{
+	FileQueue queue(conf->getPaths(), count, true);
+	Journal journal;
+	MappedFile::setCopying(true); // files are read while being edited, a truncated one mustn't take the daemon down
+	Watcher watcher(conf->getRoots());
+	count = queue.getWorkers();
+	std::atomic<bool> failed(false);
+	std::exception_ptr leadError;
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < count; i++)
+	{
+		threads.emplace_back([&, i]()
+		{
+			unsigned failures = 0;
+			while (queue.isLive())
+			{
+				std::unique_ptr<Session> session;
+				try
+				{
+					session.reset(new Session(conf, &queue, &journal, i));
+					session->run();
+					return; // the queue was closed, or the lead never opened it
+				}
+				catch (RefusedError const& error) // our UID is gone, every session would be refused from now on
+				{
+					std::cout << "Error: session " << i << " stopped:" << error.what() << std::endl;
+					if (!failed.exchange(true)) leadError = std::current_exception();
+					return;
+				}
+				catch (std::exception const& error)
+				{
+					std::cout << "Error: session " << i << " stopped:" << error.what() << std::endl;
+					if (i == 0 and !queue.isOpen()) // the handshake failed, the next try wouldn't fare better
+					{
+						if (!failed.exchange(true)) leadError = std::current_exception();
+						return;
+					}
+				}
+				if (i == 0 and !conf->getFlag()) conf->flipFlag(); // registered on its first run, reconnects from now on
+				failures = session and session->getVerified() ? 1 : failures + 1;
+				std::chrono::milliseconds backoff(std::min<long long>((long long)DAEMON_BACKOFF << std::min(failures - 1, 5u), DAEMON_BACKOFF_MAX));
+				for (auto until = std::chrono::steady_clock::now() + backoff; std::chrono::steady_clock::now() < until and queue.isLive();)
+					std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_TICK));
+			}
+		});
+	}
+	std::cout << "Watching " << conf->getRoots().size() << " paths for changes" << std::endl;
+	std::vector<std::string> changed;
+	while (!*stop and !failed)
+	{
+		watcher.wait(changed);
+		if (!changed.empty()) queue.push(changed);
+	}
+	queue.close();
+	for (std::thread& t : threads)
+		t.join();
+	if (leadError) std::rethrow_exception(leadError);
+	std::cout << "Stopped watching" << std::endl;
+}
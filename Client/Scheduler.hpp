@@ -0,0 +1,56 @@
+// Hands files out to concurrent sessions
+#pragma once
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ConfigHandler;
+
+// Work stealing queue: files are sorted largest first and dealt out round robin to per worker deques
+// a worker takes from the front of its own deque and once it runs dry steals the largest file left elsewhere,
+// so a single huge file never ends up starting last
+// a live queue is the daemon's: it starts with every configured file, the watcher pushes changed ones as they settle
+// and sessions that run dry wait for more until it's closed
+class FileQueue
+{
+private:
+	struct Entry
+	{
+		std::string path;
+		uint64_t size;
+	};
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Entry> files;
+	};
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::mutex stateLock;
+	std::condition_variable stateChanged;
+	bool opened; // lead session finished the handshake, the rest may reconnect
+	bool cancelled; // lead session failed before that
+	bool live; // the daemon may still add files, an empty queue waits for them instead of ending the sessions
+	uint64_t added; // files pushed or given back so far, tells a waiting pop something new arrived
+	bool take(unsigned worker, std::string& path);
+public:
+	FileQueue(const std::vector<std::string>& paths, unsigned count, bool live = false);
+	bool pop(unsigned worker, std::string& path);
+	void push(const std::vector<std::string>& paths);
+	void giveBack(unsigned worker, const std::string& path);
+	void close();
+	bool isLive();
+	size_t remaining();
+	unsigned getWorkers() const;
+	void open();
+	void cancel();
+	bool waitOpen();
+	bool isOpen();
+};
+
+void runSessions(ConfigHandler* conf, unsigned count);
+void runDaemon(ConfigHandler* conf, unsigned count, const volatile std::sig_atomic_t* stop);
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+#include "SendEngine.hpp"
+#include "Session.hpp"
+#include "Metrics.hpp"
+
+// smallest free buffer that fits, a new one if none does
+BufferPool::Buffer BufferPool::acquire(size_t size)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto best = free.end();
+		for (auto it = free.begin(); it != free.end(); ++it)
+			if ((*it)->size() >= size and (best == free.end() or (*it)->size() < (*best)->size()))
+				best = it;
+		if (best != free.end())
+		{
+			Buffer buffer = std::move(*best);
+			free.erase(best);
+			return buffer;
+		}
+	}
+	return Buffer(new std::vector<char>(size));
+}
+
+void BufferPool::release(Buffer buffer)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (free.size() < SEND_POOL_SIZE) free.push_back(std::move(buffer));
+}
+
+SendEngine::SendEngine(Session* s) : s(s), queuedBytes(0), chunk(SEND_CHUNK), adaptive(true), lastRate(0), direction(1)
+{
+}
+
+// socket options for a freshly connected socket and the configured chunk size
+void SendEngine::configure()
+{
+	boost::asio::ip::tcp::socket* socket = s->getSocket();
+	socket->set_option(boost::asio::ip::tcp::no_delay(true)); // requests are small and each waits for its answer
+	if (s->getConfig()->getSendBuffer()) socket->set_option(boost::asio::socket_base::send_buffer_size((int)s->getConfig()->getSendBuffer()));
+	adaptive = !s->getConfig()->getSendChunk();
+	chunk = adaptive ? SEND_CHUNK : std::min(std::max(s->getConfig()->getSendChunk(), (size_t)MIN_SEND_CHUNK), (size_t)MAX_SEND_CHUNK);
+	lastRate = 0;
+	direction = 1;
+}
+
+// holds header and request back so they leave in the same write as the start of the payload
+void SendEngine::begin(const std::vector<boost::asio::mutable_buffer>& head)
+{
+	cork(true);
+	size_t size = 0;
+	for (const boost::asio::mutable_buffer& b : head)
+		size += b.size();
+	BufferPool::Buffer buffer = pool.acquire(size);
+	size_t at = 0;
+	for (const boost::asio::mutable_buffer& b : head)
+	{
+		memcpy(buffer->data() + at, b.data(), b.size());
+		at += b.size();
+	}
+	send(std::move(buffer), size);
+}
+
+// a buffer to fill - hand it back through send
+BufferPool::Buffer SendEngine::acquire(size_t size)
+{
+	return pool.acquire(size);
+}
+
+// a buffer that ended up not being sent
+void SendEngine::release(BufferPool::Buffer buffer)
+{
+	pool.release(std::move(buffer));
+}
+
+// queues the first length bytes of buffer, writing everything queued once a chunk's worth is waiting
+void SendEngine::send(BufferPool::Buffer buffer, size_t length)
+{
+	queued.push_back(std::move(buffer));
+	lengths.push_back(length);
+	queuedBytes += length;
+	if (queuedBytes >= chunk) flush();
+}
+
+// writes whatever is still queued and lets the last partial segment go
+void SendEngine::end()
+{
+	flush();
+	cork(false);
+}
+
+// one vectored write for all queued buffers, timed to steer the chunk size
+void SendEngine::flush()
+{
+	if (queued.empty()) return;
+	std::vector<boost::asio::const_buffer> gather;
+	for (size_t i = 0; i < queued.size(); i++)
+		gather.push_back(boost::asio::buffer(queued[i]->data(), lengths[i]));
+	auto start = std::chrono::steady_clock::now();
+	boost::asio::write(*s->getSocket(), gather);
+	std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+	adapt(queuedBytes, took.count());
+	Metrics::observe(Metrics::IO_SECONDS, "gather write", took.count());
+	Metrics::observe(Metrics::IO_BYTES, "gather write", (double)queuedBytes);
+	Metrics::count(Metrics::SYSCALLS, "gather write");
+	Metrics::count(Metrics::BYTES, "sent", queuedBytes);
+	for (BufferPool::Buffer& buffer : queued)
+		pool.release(std::move(buffer));
+	queued.clear();
+	lengths.clear();
+	queuedBytes = 0;
+}
+
+// hill climbing on throughput - keep moving the chunk size the same way while writes get faster
+void SendEngine::adapt(size_t bytes, double seconds)
+{
+	if (!adaptive or seconds <= 0 or bytes < chunk) return; // a short final write says nothing about the link
+	double rate = bytes / seconds;
+	if (lastRate and rate < lastRate * 0.95) direction = -direction;
+	lastRate = rate;
+	if (direction > 0) chunk = std::min(chunk * 2, (size_t)MAX_SEND_CHUNK);
+	else chunk = std::max(chunk / 2, (size_t)MIN_SEND_CHUNK);
+}
+
+void SendEngine::cork(bool on)
+{
+#ifdef TCP_CORK
+	int value = on ? 1 : 0;
+	setsockopt(s->getSocket()->native_handle(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#else
+	(void)on; // no cork on this platform - the gather write already keeps header and payload together
+#endif
+}
+
+size_t SendEngine::getChunk() const
+{
+	return chunk;
+}
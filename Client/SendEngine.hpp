@@ -0,0 +1,55 @@
+// Batches outgoing file data into large vectored socket writes
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include "defs.hpp"
+
+class Session;
+
+// Recycles payload buffers so a transfer allocates a handful of them instead of one per chunk
+// safe to use from the encryption workers and the sending thread at once
+class BufferPool
+{
+public:
+	typedef std::unique_ptr<std::vector<char>> Buffer;
+private:
+	std::mutex lock;
+	std::vector<Buffer> free;
+public:
+	Buffer acquire(size_t size);
+	void release(Buffer buffer);
+};
+
+// Queues filled buffers and writes them out together once chunk bytes are waiting, in a single gather write
+// the request header rides along with the first chunk, and on Linux TCP_CORK keeps the kernel from
+// sending a short segment in between - everything else goes out with TCP_NODELAY
+// unless a fixed chunk size is configured the chunk doubles or halves after each write, towards whichever
+// direction last improved the measured throughput
+class SendEngine
+{
+private:
+	Session* s;
+	BufferPool pool;
+	std::vector<BufferPool::Buffer> queued;
+	std::vector<size_t> lengths;
+	size_t queuedBytes;
+	size_t chunk;
+	bool adaptive;
+	double lastRate; // bytes per second of the previous write
+	int direction; // 1 while growing the chunk, -1 while shrinking it
+	void flush();
+	void adapt(size_t bytes, double seconds);
+	void cork(bool on);
+public:
+	SendEngine(Session* s);
+	void configure();
+	void begin(const std::vector<boost::asio::mutable_buffer>& head);
+	BufferPool::Buffer acquire(size_t size);
+	void release(BufferPool::Buffer buffer);
+	void send(BufferPool::Buffer buffer, size_t length);
+	void end();
+	size_t getChunk() const;
+};
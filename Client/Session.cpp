@@ -3,32 +3,53 @@
 #include "defs.hpp"
 #include "Session.hpp"
 #include "osrng.h"
+#include "Metrics.hpp"
 
 using boost::asio::ip::tcp;
 
 //init all session vars
-Session::Session(ConfigHandler* conf) : io_context(), socket(io_context), resolver(io_context)
+Session::Session(ConfigHandler* conf, FileQueue* queue, Journal* journal, unsigned worker) : io_context(), socket(io_context), resolver(io_context), timer(io_context)
 {
 	config = conf;
-	buffer = "";
+	this->queue = queue;
+	this->journal = journal;
+	resumable = false;
+	this->worker = worker;
 	address = NULL;
 	port = NULL;
 	headerSent = new Header();
-	headerRecieved = new ServerHeader();
+	sender = new SendEngine(this);
 	fileLen = 0;
-	crcFail = 4; // number of retries in case of bad crc
+	crc = 0;
+	version = BASE_VER;
+	ticketUsed = false;
+	dedup = false;
+	delta = false;
+	deltaBlock = 0;
+	crcFail = CRC_TRIES; // number of retries in case of bad crc
+	verified = 0;
+	retry = false;
 }
 
 void Session::run()
 {
-	runProtocol(this);
+	try
+	{
+		runProtocol(this);
+	}
+	catch (std::exception const&)
+	{
+		if (isLead()) queue->cancel(); // release waiting sessions if registration never finished
+		if (!path.empty()) queue->giveBack(worker, path); // let another session retry the file we were on
+		throw;
+	}
 }
 
 //after protocol cleanup
 Session::~Session()
 {
 	delete headerSent; // dynamically allocated structs
-	delete headerRecieved;
+	delete sender;
 }
 
 //socket getter
@@ -37,10 +58,10 @@ boost::asio::ip::tcp::socket* Session::getSocket()
 	return &socket;
 }
 
-//serverheader getter
+//serverheader getter - the header of the last response, in place at the start of it
 ServerHeader* Session::getHeaderRecieved()
 {
-	return headerRecieved;
+	return (ServerHeader*)ring.message();
 }
 
 //clientheader getter
@@ -67,10 +88,26 @@ ConfigHandler* Session::getConfig()
 	return config;
 }
 
-//payload buffer getter
-std::string* Session::getBuffer()
+SendEngine* Session::getSender()
 {
-	return &buffer;
+	return sender;
+}
+
+//receive buffer getter
+RecvRing* Session::getRing()
+{
+	return &ring;
+}
+
+//payload getter - valid until the next response is read
+std::string_view Session::getPayload()
+{
+	return payload;
+}
+
+void Session::setPayload(std::string_view payload)
+{
+	this->payload = payload;
 }
 
 //AES (unwrapped) getter
@@ -79,9 +116,31 @@ CryptoPP::SecByteBlock Session::getAES()
 	return AES;
 }
 
+// key derived without RSA, from a resumption ticket
+void Session::setSessionKey(CryptoPP::SecByteBlock key)
+{
+	this->AES = key;
+}
+
+CryptoPP::byte* Session::getTicketNonce()
+{
+	return ticketNonce;
+}
+
+bool Session::getTicketUsed()
+{
+	return ticketUsed;
+}
+
+void Session::setTicketUsed(bool used)
+{
+	ticketUsed = used;
+}
+
 //AES setter (gets encrypted AES as arg and handles decryption)
 void Session::setAES(CryptoPP::SecByteBlock AES)
 {
+	Metrics::Timer timer(Metrics::CPU_SECONDS, "aes unwrap");
 	std::string decrypted;
 	CryptoPP::AutoSeededRandomPool rng;
 	CryptoPP::RSAES_OAEP_SHA_Decryptor d(this->getConfig()->getKey());
@@ -91,17 +150,108 @@ void Session::setAES(CryptoPP::SecByteBlock AES)
 }
 
 //filelen setter
-void Session::setLen(int len)
+void Session::setLen(uint32_t len)
 {
 	fileLen = len;
 }
 
 //filelen getter
-int Session::getLen()
+uint32_t Session::getLen()
 {
 	return fileLen;
 }
 
+//crc getter
+uint32_t Session::getCRC()
+{
+	return crc;
+}
+
+//crc setter
+void Session::setCRC(uint32_t crc)
+{
+	this->crc = crc;
+}
+
+// per chunk cksums of the file last sent, filled by sendFile
+std::vector<uint32_t>* Session::getChunkCRCs()
+{
+	return &chunkCRCs;
+}
+
+// chunks to resend, filled by badChunksAck
+std::vector<uint32_t>* Session::getBadChunks()
+{
+	return &badChunks;
+}
+
+// content defined chunks of the current file, filled by sendChunkList
+std::vector<Chunker::Chunk>* Session::getDedupChunks()
+{
+	return &dedupChunks;
+}
+
+// chunks the server lacks, filled by missingChunksAck
+std::vector<uint32_t>* Session::getMissingChunks()
+{
+	return &missingChunks;
+}
+
+// buffer of at least size bytes for the payload of the next request, only allocating when it has to grow
+char* Session::getRequest(size_t size)
+{
+	if (request.size() < size) request.resize(size);
+	return request.data();
+}
+
+bool Session::getDedup()
+{
+	return dedup;
+}
+
+void Session::setDedup(bool dedup)
+{
+	this->dedup = dedup;
+}
+
+// delta instructions of the current file, filled by signaturesAck
+std::vector<Delta::Op>* Session::getDeltaOps()
+{
+	return &deltaOps;
+}
+
+uint32_t Session::getDeltaBlock()
+{
+	return deltaBlock;
+}
+
+void Session::setDeltaBlock(uint32_t block)
+{
+	deltaBlock = block;
+}
+
+bool Session::getDelta()
+{
+	return delta;
+}
+
+void Session::setDelta(bool delta)
+{
+	this->delta = delta;
+}
+
+uint8_t Session::getVersion()
+{
+	return version;
+}
+
+// speak the highest version both sides support
+void Session::setVersion(uint8_t serverVersion)
+{
+	if (serverVersion < BASE_VER) return;
+	version = serverVersion < CLIENT_VER ? serverVersion : CLIENT_VER;
+}
+
 //retry getter
 bool Session::getRetry()
 {
@@ -137,4 +287,102 @@ std::string* Session::getFname()
 {
 	return &fname;
 }
+
+//moves on to the next readable file from the queue and resets per file state - false once all are done
+bool Session::nextFile()
+{
+	path.clear();
+	while (queue->pop(worker, path))
+	{
+		std::ifstream f(path, std::ios::binary | std::ios::in);
+		if (!f.is_open())
+		{
+			std::cout << "Error: Couldn't open file:" << path << ", skipping it" << std::endl;
+			path.clear();
+			continue;
+		}
+		if (config->storedName(path).length() >= NAME_SIZE) // only files that appeared under a watched directory since the start
+		{
+			std::cout << "Error: " << path << " is nested too deep to be stored, skipping it" << std::endl;
+			path.clear();
+			continue;
+		}
+		crcFail = CRC_TRIES;
+		retry = false;
+		resumable = journal->find(path, progress); // an earlier run got part of it across
+		if (!Journal::identify(path, picked)) picked = Journal::Entry();
+		chunkCRCs.clear();
+		badChunks.clear();
+		dedupChunks.clear();
+		missingChunks.clear();
+		dedup = false;
+		deltaOps.clear();
+		delta = false;
+		return true;
+	}
+	return false;
+}
+
+//path getter
+std::string Session::getPath()
+{
+	return path;
+}
+
+//marks the current file finished - it counts as verified unless the server was told to give up on it
+//the daemon queues it again if it changed since it was picked
+void Session::fileDone()
+{
+	if (headerSent->code == CRC_ACK) verified++;
+	Metrics::count(Metrics::FILES, headerSent->code == CRC_ACK ? "verified" : "failed");
+	Metrics::observe(Metrics::FILE_RETRIES, "crc", CRC_TRIES - crcFail);
+	journal->remove(path); // finished either way, nothing left to resume
+	Journal::Entry now;
+	if (queue->isLive() and Journal::identify(path, now) and (now.size != picked.size or now.mtime != picked.mtime)) // the copy sent may be torn
+	{
+		std::cout << path << " changed while it was sent, queueing it again" << std::endl;
+		queue->push({ path });
+	}
+	path.clear();
+}
+
+//verified getter
+size_t Session::getVerified()
+{
+	return verified;
+}
+
+//lead session registers or reconnects first, the others wait for it
+bool Session::isLead()
+{
+	return worker == 0;
+}
+
+//queue getter
+FileQueue* Session::getQueue()
+{
+	return queue;
+}
+
+//journal getter
+Journal* Session::getJournal()
+{
+	return journal;
+}
+
+//progress getter - filled in by nextFile when the journal knows the file, by sendFile otherwise
+Journal::Entry* Session::getProgress()
+{
+	return &progress;
+}
+
+bool Session::getResumable()
+{
+	return resumable;
+}
+
+void Session::setResumable(bool resumable)
+{
+	this->resumable = resumable;
+}
 #undef _CRT_SECURE_NO_WARNINGS
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <boost/asio.hpp>
 #include <memory>
 #include "defs.hpp"
@@ -11,6 +13,12 @@
 #include "ConfigHandler.hpp"
 #include "Protocol.hpp"
 #include "Client.hpp"
+#include "Scheduler.hpp"
+#include "Journal.hpp"
+#include "SendEngine.hpp"
+#include "RecvRing.hpp"
+#include "Chunker.hpp"
+#include "Delta.hpp"
 #define R_ONLY "r"
 #define R_W "rw"
 #define W_ONLY "w"
@@ -23,19 +31,42 @@ private:
 	boost::asio::io_context io_context;
 	boost::asio::ip::tcp::socket socket;
 	boost::asio::ip::tcp::resolver resolver;
-	std::string buffer;
+	boost::asio::steady_timer timer; // read deadline
+	RecvRing ring; // responses are read into it and parsed in place
+	std::string_view payload; // of the last response, a view into ring
+	std::vector<char> request; // payload of requests that carry a list, kept so later ones reuse its capacity
 	std::string fname;
+	std::string path; // file currently being transferred
+	FileQueue* queue; // shared with the other sessions of this run
+	Journal* journal; // progress of partially sent files, shared as well
+	Journal::Entry progress; // journal entry of the current file - nonce and offset to continue from
+	Journal::Entry picked; // size and mtime of the current file when it was taken from the queue
+	bool resumable; // the journal had an entry for the current file
+	unsigned worker; // this session's slot in the queue - 0 is the lead session
+	size_t verified; // files the server acked
 	char* address;
 	char* port;
-	ServerHeader* headerRecieved; // Last Recieved header
 	Header* headerSent; // Last Sent header
 	ConfigHandler* config;
+	SendEngine* sender; // file data goes out through it
 	CryptoPP::SecByteBlock AES;
-	int fileLen;
+	uint32_t fileLen; // what the server reports for the current file, SIZE_SIZE bytes on the wire
+	uint32_t crc; // cksum of the plaintext last sent
+	std::vector<uint32_t> chunkCRCs; // cksum of every CHECK_CHUNK of the file last sent
+	std::vector<uint32_t> badChunks; // chunks the server reported as mismatched
+	std::vector<Chunker::Chunk> dedupChunks; // content defined chunks of the current file
+	std::vector<uint32_t> missingChunks; // those of them the server doesn't hold
+	bool dedup; // the next upload only carries the missing chunks
+	std::vector<Delta::Op> deltaOps; // how to rebuild the file from the copy the server holds
+	uint32_t deltaBlock; // block size of that copy's signatures
+	bool delta; // the next upload is a delta
+	CryptoPP::byte ticketNonce[NONCE_SIZE]; // our half of the nonces a ticket reconnect derives its key from
+	bool ticketUsed; // this session's key came from a ticket
+	uint8_t version; // protocol version spoken - BASE_VER until the server reports its own
 	int crcFail;
 	bool retry;
 public:
-	Session(ConfigHandler* conf);
+	Session(ConfigHandler* conf, FileQueue* queue, Journal* journal, unsigned worker);
 	~Session();
 	Client* to;
 	void run();
@@ -45,13 +76,46 @@ public:
 	boost::asio::ip::tcp::resolver* getResolver();
 	boost::asio::io_context* getIOContext();
 	ConfigHandler* getConfig();
-	std::string* getBuffer();
+	SendEngine* getSender();
+	RecvRing* getRing();
+	std::string_view getPayload();
+	void setPayload(std::string_view payload);
+	char* getRequest(size_t size);
 	CryptoPP::SecByteBlock getAES();
 	void setAES(CryptoPP::SecByteBlock AES);
+	void setSessionKey(CryptoPP::SecByteBlock key);
+	CryptoPP::byte* getTicketNonce();
+	bool getTicketUsed();
+	void setTicketUsed(bool used);
 	void setFname(const char* name);
 	std::string* getFname();
-	int getLen();
-	void setLen(int len);
+	bool nextFile();
+	std::string getPath();
+	void fileDone();
+	size_t getVerified();
+	bool isLead();
+	FileQueue* getQueue();
+	Journal* getJournal();
+	Journal::Entry* getProgress();
+	bool getResumable();
+	void setResumable(bool resumable);
+	uint32_t getLen();
+	void setLen(uint32_t len);
+	uint32_t getCRC();
+	void setCRC(uint32_t crc);
+	std::vector<uint32_t>* getChunkCRCs();
+	std::vector<uint32_t>* getBadChunks();
+	std::vector<Chunker::Chunk>* getDedupChunks();
+	std::vector<uint32_t>* getMissingChunks();
+	bool getDedup();
+	void setDedup(bool dedup);
+	std::vector<Delta::Op>* getDeltaOps();
+	uint32_t getDeltaBlock();
+	void setDeltaBlock(uint32_t block);
+	bool getDelta();
+	void setDelta(bool delta);
+	uint8_t getVersion();
+	void setVersion(uint8_t serverVersion);
 	void setRetry(bool retry);
 	bool getRetry();
 	void decFail();
@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include "FileUtil.hpp"
+#include "Ticket.hpp"
+#include "hmac.h"
+#include "sha.h"
+
+static int64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// loads the ticket a previous run stored - a missing or damaged file just means a full reconnect
+TicketStore::TicketStore(const std::string& file) : file(file), valid(false), secret(TICKET_SECRET_SIZE), expires(0)
+{
+	std::ifstream in(file);
+	std::string idHex, secretHex;
+	if (!(in >> idHex >> secretHex >> expires)) return;
+	valid = fromHex(idHex, id, TICKET_ID_SIZE) and fromHex(secretHex, secret.data(), TICKET_SECRET_SIZE);
+}
+
+// rewrites the ticket file through a temporary one readable by the owner only, or removes it once there's no ticket
+void TicketStore::save()
+{
+	std::error_code ec;
+	if (!valid)
+	{
+		std::filesystem::remove(file, ec);
+		return;
+	}
+	std::string contents = toHex(id, TICKET_ID_SIZE) + '\n' + toHex(secret.data(), TICKET_SECRET_SIZE) + '\n' + std::to_string(expires) + '\n';
+	if (!replaceFile(file, contents)) std::cout << "Warning: Couldn't write " << file << ", next run does a full reconnect" << std::endl;
+}
+
+// copies out the ticket if there is one that hasn't expired yet
+bool TicketStore::get(CryptoPP::byte* id, CryptoPP::SecByteBlock& secret)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!valid or now() >= expires) return false;
+	memcpy(id, this->id, TICKET_ID_SIZE);
+	secret = this->secret;
+	return true;
+}
+
+// a newly issued ticket replaces the old one
+void TicketStore::set(const CryptoPP::byte* id, const CryptoPP::byte* secret, uint32_t lifetime)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	memcpy(this->id, id, TICKET_ID_SIZE);
+	memcpy(this->secret.data(), secret, TICKET_SECRET_SIZE);
+	expires = now() + lifetime;
+	valid = true;
+	save();
+}
+
+// the server refused the ticket
+void TicketStore::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!valid) return;
+	valid = false;
+	save();
+}
+
+// session key = HMAC-SHA256(secret, id | client nonce | server nonce) cut to the AES key size
+CryptoPP::SecByteBlock TicketStore::derive(const CryptoPP::SecByteBlock& secret, const CryptoPP::byte* id,
+	const CryptoPP::byte* clientNonce, const CryptoPP::byte* serverNonce)
+{
+	CryptoPP::HMAC<CryptoPP::SHA256> mac(secret.data(), secret.size());
+	mac.Update(id, TICKET_ID_SIZE);
+	mac.Update(clientNonce, NONCE_SIZE);
+	mac.Update(serverNonce, NONCE_SIZE);
+	CryptoPP::byte digest[CryptoPP::HMAC<CryptoPP::SHA256>::DIGESTSIZE];
+	mac.Final(digest);
+	return CryptoPP::SecByteBlock(digest, AES_SIZE);
+}
@@ -0,0 +1,29 @@
+// Session resumption ticket issued by the server, kept next to me.info
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "cryptlib.h"
+#include "defs.hpp"
+
+// The ticket id is opaque to us, the secret was handed over under an RSA protected session key
+// a reconnect presenting the id derives its session key from the secret and fresh nonces of both sides,
+// so no RSA operation is needed on either end - the ticket may be presented by several sessions at once
+class TicketStore
+{
+private:
+	std::string file;
+	std::mutex lock;
+	bool valid;
+	CryptoPP::byte id[TICKET_ID_SIZE];
+	CryptoPP::SecByteBlock secret;
+	int64_t expires; // seconds since the epoch
+	void save();
+public:
+	TicketStore(const std::string& file = TICKET_FILE);
+	bool get(CryptoPP::byte* id, CryptoPP::SecByteBlock& secret);
+	void set(const CryptoPP::byte* id, const CryptoPP::byte* secret, uint32_t lifetime);
+	void clear();
+	static CryptoPP::SecByteBlock derive(const CryptoPP::SecByteBlock& secret, const CryptoPP::byte* id,
+		const CryptoPP::byte* clientNonce, const CryptoPP::byte* serverNonce);
+};
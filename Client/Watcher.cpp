@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include "Watcher.hpp"
+#ifdef __linux__
+#include <climits>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_ONLYDIR)
+#endif
+
+// starts watching every root - files already there aren't reported, the daemon's first pass covers them
+Watcher::Watcher(const std::vector<std::string>& roots) : roots(roots)
+{
+#ifdef __linux__
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) throw std::runtime_error("Couldn't start inotify");
+	for (const std::string& root : roots)
+	{
+		std::error_code ec;
+		if (std::filesystem::is_directory(root, ec))
+		{
+			watchTree(root, false);
+			continue;
+		}
+		files.insert(root);
+		watch(std::filesystem::path(root).parent_path().string(), false);
+	}
+#else
+	scan(false);
+	scanned = Clock::now();
+#endif
+}
+
+Watcher::~Watcher()
+{
+#ifdef __linux__
+	close(fd);
+#endif
+}
+
+// a file changed, it's reported once it has been left alone long enough
+void Watcher::changed(const std::string& path)
+{
+	pending[path] = Clock::now();
+}
+
+// moves the files nothing touched for the settle time to out, dropping those that are gone or aren't regular files
+void Watcher::settled(std::vector<std::string>& out)
+{
+#ifdef __linux__
+	Clock::duration settle = std::chrono::milliseconds(WATCH_SETTLE);
+#else
+	Clock::duration settle = std::chrono::milliseconds(WATCH_POLL); // the scan after the one that saw it change found it the same
+#endif
+	Clock::time_point now = Clock::now();
+	for (auto it = pending.begin(); it != pending.end();)
+	{
+		if (now - it->second < settle)
+		{
+			it++;
+			continue;
+		}
+		std::error_code ec;
+		if (std::filesystem::is_regular_file(it->first, ec)) out.push_back(it->first);
+		it = pending.erase(it);
+	}
+}
+
+// waits up to WATCH_TICK ms and hands back the files that settled meanwhile, changed is empty if none did
+void Watcher::wait(std::vector<std::string>& changed)
+{
+	changed.clear();
+#ifdef __linux__
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(WATCH_TICK);
+	for (auto& p : pending)
+		deadline = std::min(deadline, p.second + std::chrono::milliseconds(WATCH_SETTLE));
+	long long timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+	pollfd p = { fd, POLLIN, 0 };
+	if (poll(&p, 1, (int)std::max(0LL, timeout)) > 0) readEvents(); // EINTR from the stop signal just ends the wait early
+#else
+	std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_TICK));
+	if (Clock::now() - scanned >= std::chrono::milliseconds(WATCH_POLL))
+	{
+		scan(true);
+		scanned = Clock::now();
+	}
+#endif
+	settled(changed);
+}
+
+#ifdef __linux__
+// adds a watch on dir - one the kernel already has (same directory under another root, or moved) keeps its descriptor
+void Watcher::watch(const std::string& dir, bool recursive)
+{
+	int wd = inotify_add_watch(fd, dir.empty() ? "." : dir.c_str(), WATCH_MASK);
+	if (wd < 0)
+	{
+		std::cout << "Warning: Couldn't watch " << (dir.empty() ? "." : dir) << ", changes in it won't be uploaded" << std::endl;
+		return;
+	}
+	auto it = dirs.find(wd);
+	if (it == dirs.end()) dirs[wd] = { dir, recursive };
+	else if (recursive) it->second = { dir, true }; // events are named after the path it has now
+}
+
+// watches dir and every directory below it - report queues the files already in them, for trees that appeared
+// after the watch on their parent, whose files may have been written before their own watch was in place
+void Watcher::watchTree(const std::string& dir, bool report)
+{
+	watch(dir, true);
+	std::error_code ec;
+	for (const auto& f : std::filesystem::recursive_directory_iterator(dir, std::filesystem::directory_options::skip_permission_denied, ec))
+	{
+		if (f.is_symlink(ec)) continue; // not followed, like the initial expansion
+		if (f.is_directory(ec)) watch(f.path().string(), true);
+		else if (report and f.is_regular_file(ec)) changed(f.path().string());
+	}
+}
+
+// drains the inotify descriptor
+void Watcher::readEvents()
+{
+	alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+	while (true)
+	{
+		ssize_t got = read(fd, buffer, sizeof(buffer));
+		if (got <= 0) return; // EAGAIN, nothing left
+		const inotify_event* e;
+		for (char* at = buffer; at < buffer + got; at += sizeof(inotify_event) + e->len)
+		{
+			e = (const inotify_event*)at;
+			if (e->mask & IN_Q_OVERFLOW) // events were lost, everything may have changed
+			{
+				std::cout << "Warning: inotify queue overflowed, rescanning every watched path" << std::endl;
+				for (const std::string& root : roots)
+				{
+					std::error_code ec;
+					if (std::filesystem::is_directory(root, ec)) watchTree(root, true);
+					else changed(root);
+				}
+				continue;
+			}
+			auto dir = dirs.find(e->wd);
+			if (dir == dirs.end()) continue;
+			if (e->mask & IN_IGNORED) // removed, or its file system went away
+			{
+				dirs.erase(dir);
+				continue;
+			}
+			if (!e->len) continue;
+			std::string path = (std::filesystem::path(dir->second.path) / e->name).string();
+			if (!dir->second.recursive)
+			{
+				if (files.count(path)) changed(path);
+				continue;
+			}
+			if (e->mask & IN_ISDIR)
+			{
+				if (e->mask & (IN_CREATE | IN_MOVED_TO)) watchTree(path, true);
+				continue;
+			}
+			changed(path);
+		}
+	}
+}
+#else
+// stamps every file under the roots - report marks those that are new or differ from the last scan
+void Watcher::scan(bool report)
+{
+	std::map<std::string, std::pair<std::filesystem::file_time_type, uint64_t>> seen;
+	auto stamp = [&](const std::string& path)
+	{
+		std::error_code ec;
+		auto time = std::filesystem::last_write_time(path, ec);
+		if (ec) return;
+		uint64_t size = std::filesystem::file_size(path, ec);
+		if (ec) return;
+		seen[path] = { time, size };
+		auto old = stamps.find(path);
+		if (report and (old == stamps.end() or old->second != seen[path])) changed(path);
+	};
+	for (const std::string& root : roots)
+	{
+		std::error_code ec;
+		if (!std::filesystem::is_directory(root, ec))
+		{
+			if (std::filesystem::is_regular_file(root, ec)) stamp(root);
+			continue;
+		}
+		for (const auto& f : std::filesystem::recursive_directory_iterator(root, std::filesystem::directory_options::skip_permission_denied, ec))
+			if (f.is_regular_file(ec)) stamp(f.path().string());
+	}
+	stamps.swap(seen);
+}
+#endif
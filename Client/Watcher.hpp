@@ -0,0 +1,48 @@
+// Watches the configured files and directories for changes the daemon should upload
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "defs.hpp"
+
+// Directories are watched with everything below them, files on their own - on Linux through inotify, elsewhere by
+// rescanning the trees every WATCH_POLL ms and comparing modification times and sizes
+// a changed file is only reported once nothing touched it for WATCH_SETTLE ms, so a burst of writes to it,
+// an editor's save dance or a copy in progress ends up as one upload of the finished file
+class Watcher
+{
+private:
+	typedef std::chrono::steady_clock Clock;
+	std::vector<std::string> roots;
+	std::map<std::string, Clock::time_point> pending; // changed files and when they last changed
+#ifdef __linux__
+	struct Dir
+	{
+		std::string path;
+		bool recursive; // inside a watched directory, not just the parent of a watched file
+	};
+	int fd;
+	std::map<int, Dir> dirs; // by watch descriptor
+	std::set<std::string> files; // roots that are files, their parents only report those
+	void watch(const std::string& dir, bool recursive);
+	void watchTree(const std::string& dir, bool report);
+	void readEvents();
+#else
+	std::map<std::string, std::pair<std::filesystem::file_time_type, uint64_t>> stamps; // of every file seen by the last scan
+	Clock::time_point scanned;
+	void scan(bool report);
+#endif
+	void changed(const std::string& path);
+	void settled(std::vector<std::string>& out);
+public:
+	Watcher(const std::vector<std::string>& roots);
+	~Watcher();
+	Watcher(const Watcher&) = delete;
+	Watcher& operator=(const Watcher&) = delete;
+	void wait(std::vector<std::string>& changed);
+};
@@ -1,7 +1,15 @@
 
 // Version info
-#define CLIENT_VER 3
-#define SERVER_VER 3
+#define CLIENT_VER 10
+#define SERVER_VER 10
+#define BASE_VER 3 // every server understands it - used until the server reports its own version
+#define CTR_VER 4 // first version sending files with AES-CTR and a per file nonce
+#define RESUME_VER 5 // first version able to continue a partially sent file
+#define CHUNK_VER 6 // first version repairing a bad upload chunk by chunk instead of resending all of it
+#define TICKET_VER 7 // first version issuing session resumption tickets
+#define COMPRESS_VER 8 // first version accepting deflated files
+#define DEDUP_VER 9 // first version keeping content defined chunks per client
+#define DELTA_VER 10 // first version patching a stored file from block signatures
 
 // Field sizes
 #define UID_SIZE 16
@@ -12,10 +20,53 @@
 #define KEY_SIZE 160
 #define HEADER_SIZE 23
 #define SERVER_HEADER_SIZE 7
-#define MAX_SIZE 1024 // max size of incoming message
+#define RECV_RING_SIZE 65536 // receive buffer of a session, grown only for a larger response
+#define MAP_WINDOW 268435456 // bytes of a file mapped at once (256Mb, a multiple of the 2Mb huge page size)
+#define READ_WINDOW 4194304 // bytes of a file read at once when it isn't mapped (4Mb, a multiple of CHECK_CHUNK)
 #define MAX_FILE_SIZE 4294967296 // Protocol allows at most 4 Gb
 #define RSA_SIZE 1024
 #define AES_SIZE 16
+#define AES_BLOCK 16
+#define AES_ROUNDS 10 // of AES-128, the only key size the protocol uses
+#define CIPHER_SIZE 1
+#define NONCE_SIZE 16
+#define OFFSET_SIZE 4
+#define COUNT_SIZE 4
+#define TICKET_ID_SIZE 16
+#define TICKET_SECRET_SIZE 32
+#define LIFETIME_SIZE 4
+#define INDEX_SIZE 4
+#define CODEC_SIZE 1
+#define DIGEST_SIZE 32
+#define LENGTH_SIZE 4
+#define BLOCK_SIZE 4
+#define WEAK_SIZE 4
+#define STRONG_SIZE 16 // truncated SHA-256
+#define OP_SIZE 1
+#define CHECK_CHUNK 1048576 // bytes covered by each chunk cksum, MAP_WINDOW is a multiple of it
+#define SEND_CHUNK 262144 // bytes gathered into one socket write to start with
+#define MIN_SEND_CHUNK 65536
+#define MAX_SEND_CHUNK 4194304
+#define SEND_POOL_SIZE 8 // idle buffers kept for reuse per session
+#define CTR_SEGMENT 1048576 // bytes of a file each thread encrypts at a time in CTR mode
+#define PIPELINE_DEPTH 8 // buffers an upload has in flight between its stages
+#define PIPELINE_BLOCK 1048576 // bytes per buffer in CBC mode
+#define PIPELINE_MEMORY 67108864 // cap on PIPELINE_DEPTH times the block size, CTR blocks hold a segment per thread below it
+#define PIPELINE_MIN 4194304 // smaller files run the stages on the session's thread
+#define MULTI_CBC_LANES 8 // independent CBC streams encrypted in lockstep at most
+#define COMPRESS_MIN 4096 // smaller files go out as they are
+#define COMPRESS_MAX 67108864 // larger ones too - the deflated file is held in memory whole before its header can go out
+#define COMPRESS_SAMPLES 4 // samples deflated to judge a file
+#define COMPRESS_SAMPLE 65536 // bytes per sample
+#define COMPRESS_RATIO 90 // percent of its size a file has to shrink below to go out deflated
+#define COMPRESS_LEVEL 3 // deflate level, low enough to keep up with the link
+#define DEDUP_MIN_CHUNK 16384 // content defined chunk bounds
+#define DEDUP_AVG_BITS 16 // log2 of the average chunk size
+#define DEDUP_MAX_CHUNK 262144
+#define DEDUP_MIN_FILE 1048576 // smaller files are sent whole
+#define DELTA_MIN_FILE 1048576 // smaller files aren't worth a signature round trip
+#define DELTA_RATIO 90 // percent of the file the delta has to stay below to be sent instead
+#define DELTA_FILTER_BITS 20 // bits of the weak checksum filter tried before the signature table
 
 // Request codes
 #define REGISTER 1100
@@ -25,6 +76,15 @@
 #define CRC_ACK 1104
 #define CRC_NACK 1105
 #define CRC_FAIL 1106
+#define RESUME 1107
+#define CHUNK_CRCS 1108
+#define RESEND_CHUNKS 1109
+#define RESUME_SESSION 1110
+#define GET_TICKET 1111
+#define CHUNK_LIST 1112
+#define DEDUP_FILE 1113
+#define GET_SIGNATURES 1114
+#define DELTA_FILE 1115
 #define END 0 // tells protocol to close connection - never actually sent
 
 // Respone codes
@@ -36,12 +96,40 @@
 #define RECONNECT_GOOD 2105
 #define RECONNECT_BAD 2106
 #define GENERIC_ERROR 2107
+#define RESUME_OFFSET 2108
+#define BAD_CHUNKS 2109
+#define SESSION_RESUMED 2110
+#define TICKET 2111
+#define TICKET_BAD 2112
+#define MISSING_CHUNKS 2113
+#define SIGNATURES 2114
 
-// Arg counts
-#define REGISTER_ARGS 1
-#define SEND_FILE_ARGS 2
-#define SEND_KEY_ARGS 2
-#define SEND_CRC_ARGS 1
+// Cipher ids sent along with files from CTR_VER on
+#define CIPHER_CBC 0
+#define CIPHER_CTR 1
+
+// Codec ids sent along with files from COMPRESS_VER on
+#define CODEC_NONE 0
+#define CODEC_ZLIB 1
+
+// Delta instructions
+#define DELTA_COPY 0 // block index and count of the stored file follow
+#define DELTA_LITERAL 1 // length and that many new bytes follow
 
 // Misc
-#define MAX_PORT 65535
\ No newline at end of file
+#define MAX_PORT 65535
+#define READ_TIMEOUT 5000 // default ms to wait for a server response
+#define JOURNAL_FILE "resume.info" // progress of interrupted uploads, kept next to me.info
+#define TICKET_FILE "ticket.info" // resumption ticket, kept next to me.info
+#define KEY_CACHE_FILE "me.der" // DER copy of the key in me.info behind a SHA-256 of its base64 text, loaded instead of decoding that text
+#define KEY_POOL_FILE "keys.pool" // pre-generated RSA keys, filled by the keypool mode
+#define KEY_POOL_TARGET 8 // keys the pool is topped back up to
+#define KEY_POOL_LOCK_STALE 5000 // ms after which a left over pool lock is broken
+#define JOURNAL_STEP 16777216 // bytes sent between journal updates
+#define CRC_TRIES 4 // sends of a file before giving up on its CRC
+#define METRICS_PREFIX "bckup_client_" // of every exported metric name
+#define WATCH_SETTLE 150 // ms a changed file has to be left alone before the daemon queues it
+#define WATCH_TICK 100 // ms the daemon waits for changes between looks at its stop flag
+#define WATCH_POLL 1000 // ms between scans of the watched trees where inotify isn't available
+#define DAEMON_BACKOFF 1000 // ms before a dropped session is started again, doubled for every failure in a row
+#define DAEMON_BACKOFF_MAX 30000
\ No newline at end of file
@@ -2,20 +2,88 @@
 // BckUp_Client : Implements a file backup system using a remote host for storage
 #define LOCAL_FAILURE -1
 #define REMOTE_FAILURE -2
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
 #include "Session.hpp"
+#include "KeyPool.hpp"
+#include "Metrics.hpp"
 
-int main()
+volatile std::sig_atomic_t stopRequested = 0; // set by SIGINT or SIGTERM, the daemon finishes the files in flight and exits
+
+void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+// usage: client [-j connections] [-t read timeout ms] [-c write chunk kb] [-b send buffer kb] [-u] [-d] [-w] [-m metrics file]
+//        -w keeps running as a daemon, uploading the configured files whenever they change
+//        client keypool [keys] - pre-generates RSA keys for later registrations and exits
+int main(int argc, char* argv[])
 {
+    if (argc > 1 and !strcmp(argv[1], "keypool"))
+    {
+        size_t target = argc > 2 ? (size_t)std::max(1, atoi(argv[2])) : KEY_POOL_TARGET;
+        try
+        {
+            KeyPool pool;
+            size_t added = pool.fill(target);
+            std::cout << "Key pool holds " << pool.size() << " keys, generated " << added << std::endl;
+        }
+        catch (std::exception const& error)
+        {
+            std::cout << "Fatal error:" << error.what() << std::endl;
+            return LOCAL_FAILURE;
+        }
+        return 0;
+    }
+    unsigned connections = 1;
+    int timeout = READ_TIMEOUT;
+    size_t chunk = 0, sndbuf = 0;
+    bool compress = true, dedup = false, daemon = false;
+    std::string metrics; // JSON if the name ends in .json, a Prometheus textfile otherwise
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-j") and i + 1 < argc) connections = (unsigned)std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-t") and i + 1 < argc) timeout = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-c") and i + 1 < argc) chunk = (size_t)std::max(0, atoi(argv[++i])) << 10;
+        else if (!strcmp(argv[i], "-b") and i + 1 < argc) sndbuf = (size_t)std::max(0, atoi(argv[++i])) << 10;
+        else if (!strcmp(argv[i], "-u")) compress = false;
+        else if (!strcmp(argv[i], "-d")) dedup = true;
+        else if (!strcmp(argv[i], "-w")) daemon = true;
+        else if (!strcmp(argv[i], "-m") and i + 1 < argc) metrics = argv[++i];
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [-j connections] [-t read timeout ms] [-c write chunk kb] [-b send buffer kb] [-u] [-d] [-w] [-m metrics file]" << std::endl;
+            return LOCAL_FAILURE;
+        }
+    }
+    int result = 0;
     try 
     {
+        KeyPool pool; // outlives the sessions so a refill they started can finish
         ConfigHandler conf; // init configuration
-        Session session(&conf); // init session with given configuration
-        session.run(); // run protocol
+        if (KeyPool::exists()) conf.setKeyPool(&pool); // only used once the keypool mode created it
+        conf.setTimeout(std::chrono::milliseconds(timeout));
+        conf.setSendChunk(chunk); // 0 adapts to the link
+        conf.setSendBuffer(sndbuf);
+        conf.setCompress(compress); // -u sends files uncompressed
+        conf.setDedup(dedup); // -d only sends chunks the server doesn't hold yet
+        if (daemon)
+        {
+            std::signal(SIGINT, requestStop);
+            std::signal(SIGTERM, requestStop);
+            runDaemon(&conf, connections, &stopRequested); // sessions stay up and upload whatever changes until stopped
+        }
+        else runSessions(&conf, connections); // run protocol over as many sessions as requested
     }
     catch (std::exception const& error)
     {
         std::cout << "Fatal error:" << error.what() << std::endl;
-        return LOCAL_FAILURE;
+        result = LOCAL_FAILURE;
     }
-    return 0;
+    // exported whether the run succeeded or not, a failed run is the one worth looking at
+    if (!metrics.empty() and !Metrics::write(metrics)) std::cout << "Warning: Couldn't write metrics to " << metrics << std::endl;
+    return result;
 }
@@ -9,6 +9,34 @@ except sqlite3.Error:
     print("Fatal error: Couldn't generate in memory database, terminating server")
     exit(errno.ENOMEM)
 
+# Template for the table of files still being received - kept separate so older server.db files gain it on load
+partial_preset = \
+    "CREATE TABLE IF NOT EXISTS partials ( \
+    ID CHAR(16) NOT NULL, \
+    `File Name` CHAR(255) NOT NULL, \
+    Nonce CHAR(16) NOT NULL, \
+    Size INT NOT NULL, \
+    PRIMARY KEY(ID, 'File Name') \
+    )"
+
+# Template for the resumption tickets handed to clients - bound to the UID they were issued to
+ticket_preset = \
+    "CREATE TABLE IF NOT EXISTS tickets ( \
+    Ticket CHAR(16) PRIMARY KEY, \
+    ID CHAR(16) NOT NULL, \
+    Secret CHAR(32) NOT NULL, \
+    Expires INT NOT NULL \
+    )"
+
+# Template for the content defined chunks kept per client, the data itself is in the client's chunk directory
+chunk_preset = \
+    "CREATE TABLE IF NOT EXISTS chunks ( \
+    ID CHAR(16) NOT NULL, \
+    Hash CHAR(32) NOT NULL, \
+    Size INT NOT NULL, \
+    PRIMARY KEY(ID, Hash) \
+    )"
+
 # Template for generating empty tables
 db_preset = \
     "CREATE TABLE clients ( \
@@ -23,7 +51,7 @@ db_preset = \
     `Path Name` CHAR(160) NOT NULL, \
     Verified INT NOT NULL, \
     PRIMARY KEY(ID, 'File Name') \
-    )"
+    ); " + partial_preset + "; " + ticket_preset + "; " + chunk_preset
 
 
 # Initialize database: handles all startup setup of the database used by the server
@@ -35,6 +63,9 @@ def init_db():
             for line in old_db.iterdump():  # copy disk db into in mem db
                 if line not in ('BEGIN;', 'COMMIT;'):
                     ram_db.execute(line)
+            ram_db.executescript(partial_preset)
+            ram_db.executescript(ticket_preset)
+            ram_db.executescript(chunk_preset)
             ram_db.commit()
             fail = False
         except sqlite3.Error:
@@ -169,6 +200,112 @@ def register_file(uid, filename, path):
     return True
 
 
+# Start partial: remember the nonce and size of a CTR upload so an interrupted transfer can be continued
+def start_partial(uid, filename, nonce, size):
+    try:
+        cur = ram_db.cursor()
+        args = (uid, filename, nonce, size)
+        sql = "INSERT OR REPLACE INTO partials(ID, `File Name`, Nonce, Size) VALUES(?, ?, ?, ?)"
+        cur.execute(sql, args)
+        cur.close()
+        ram_db.commit()
+    except sqlite3.Error as e:
+        print("Error: Failed to write data back to db, transfer won't be resumable", e)
+        return False
+    return True
+
+
+# Get partial: fetches (nonce, size) of an unfinished upload (used in protocol recv_resume)
+def get_partial(uid, filename):
+    try:
+        cur = ram_db.cursor()
+        args = (uid, filename)
+        sql = "SELECT Nonce, Size FROM partials WHERE ID = ? AND `File Name` = ?"
+        res = cur.execute(sql, args)
+        res = res.fetchone()
+        cur.close()
+    except sqlite3.Error:
+        print("Error: Failed to read data from db")
+        return None
+    return res
+
+
+# End partial: forget an upload once it was received in full
+def end_partial(uid, filename):
+    try:
+        cur = ram_db.cursor()
+        args = (uid, filename)
+        sql = "DELETE FROM partials WHERE ID = ? AND `File Name` = ?"
+        cur.execute(sql, args)
+        cur.close()
+        ram_db.commit()
+    except sqlite3.Error:
+        print("Error: Failed to write data back to db")
+        return False
+    return True
+
+
+# Held chunks: which of the given chunk hashes are already stored for a client (used in protocol recv_chunk_list)
+def held_chunks(uid, hashes):
+    held = set()
+    try:
+        cur = ram_db.cursor()
+        sql = "SELECT Hash FROM chunks WHERE ID = ? AND Hash = ?"
+        for digest in hashes:
+            if cur.execute(sql, (uid, digest)).fetchone() is not None:
+                held.add(digest)
+        cur.close()
+    except sqlite3.Error:
+        print("Error: Failed to read data from db")
+        return set()
+    return held
+
+
+# Store chunk: records a chunk written to the client's chunk directory
+def store_chunk(uid, digest, size):
+    try:
+        cur = ram_db.cursor()
+        args = (uid, digest, size)
+        sql = "INSERT OR REPLACE INTO chunks(ID, Hash, Size) VALUES(?, ?, ?)"
+        cur.execute(sql, args)
+        cur.close()
+        ram_db.commit()
+    except sqlite3.Error as e:
+        print("Error: Failed to write data back to db, chunk won't be reused", e)
+        return False
+    return True
+
+
+# Store ticket: saves a newly issued resumption ticket and drops the ones that ran out
+def store_ticket(ticket, uid, secret, expires, now):
+    try:
+        cur = ram_db.cursor()
+        cur.execute("DELETE FROM tickets WHERE Expires <= ?", (now,))
+        args = (ticket, uid, secret, expires)
+        sql = "INSERT OR REPLACE INTO tickets(Ticket, ID, Secret, Expires) VALUES(?, ?, ?, ?)"
+        cur.execute(sql, args)
+        cur.close()
+        ram_db.commit()
+    except sqlite3.Error as e:
+        print("Error: Failed to write data back to db, ticket not issued", e)
+        return False
+    return True
+
+
+# Get ticket: fetches (uid, secret, expires) of a resumption ticket (used in protocol resume_session)
+def get_ticket(ticket):
+    try:
+        cur = ram_db.cursor()
+        sql = "SELECT ID, Secret, Expires FROM tickets WHERE Ticket = ?"
+        res = cur.execute(sql, (ticket,))
+        res = res.fetchone()
+        cur.close()
+    except sqlite3.Error:
+        print("Error: Failed to read data from db")
+        return None
+    return res
+
+
 # Update keys: update AES and PublicKey fields of a client entry (used in protocol recv_key)
 def update_keys(pubkey, privkey, uid):
     try:
@@ -2,7 +2,15 @@ USER_HEADER_SIZE = 23
 SERVER_HEADER_SIZE = 7
 TIMEOUT = 5
 RETRIES = 3
-VER = 3
+VER = 10
+MIN_VER = 3  # oldest client version still served
+CTR_VER = 4  # first version sending files in AES-CTR under a per file nonce
+RESUME_VER = 5  # first version able to continue a partially received file
+CHUNK_VER = 6  # first version repairing a bad upload chunk by chunk
+TICKET_VER = 7  # first version issuing session resumption tickets
+COMPRESS_VER = 8  # first version that may send files deflated
+DEDUP_VER = 9  # first version uploading content defined chunks
+DELTA_VER = 10  # first version patching an older copy of a file from a delta
 
 # Client codes
 REGISTER = 1100
@@ -12,7 +20,19 @@ SEND_FILE = 1103
 GOOD_CRC = 1104
 BAD_CRC = 1105
 FAIL_CRC = 1106
+RESUME = 1107
+CHUNK_CRCS = 1108
+RESEND_CHUNKS = 1109
+RESUME_SESSION = 1110
+GET_TICKET = 1111
+CHUNK_LIST = 1112
+DEDUP_FILE = 1113
+GET_SIGNATURES = 1114
+DELTA_FILE = 1115
 READING = 3000
+REPAIRING = 3001
+DEDUPING = 3002
+PATCHING = 3003
 
 # Server codes
 REGISTER_GOOD = 2100
@@ -23,6 +43,13 @@ CRC_ACK = 2104
 RECONNECT_GOOD = 2105
 RECONNECT_BAD = 2106
 GENERIC_ERROR = 2107
+RESUME_OFFSET = 2108
+BAD_CHUNKS = 2109
+SESSION_RESUMED = 2110
+TICKET = 2111
+TICKET_BAD = 2112
+MISSING_CHUNKS = 2113
+SIGNATURES = 2114
 
 # Field sizes
 SIZE_SIZE = 4
@@ -30,6 +57,26 @@ NAME_SIZE = 255
 KEY_SIZE = 160
 UID_SIZE = 16
 CRC_SIZE = 4
+CIPHER_SIZE = 1
+NONCE_SIZE = 16
+OFFSET_SIZE = 4
+COUNT_SIZE = 4
+INDEX_SIZE = 4
+CODEC_SIZE = 1
+DIGEST_SIZE = 32
+LENGTH_SIZE = 4
+DEDUP_MAX_CHUNK = 262144  # largest content defined chunk a client may send
+BLOCK_SIZE = 4
+WEAK_SIZE = 4
+STRONG_SIZE = 16
+OP_SIZE = 1
+DELTA_MIN_BLOCK = 2048  # bounds of the signature block size, which grows with the square root of the file
+DELTA_MAX_BLOCK = 131072
+TICKET_ID_SIZE = 16
+TICKET_SECRET_SIZE = 32
+LIFETIME_SIZE = 4
+TICKET_LIFETIME = 86400  # seconds a resumption ticket stays valid
+CHECK_CHUNK = 1048576  # bytes covered by each chunk cksum
 CHUNK_SIZE = 1024
 
 # Open connection fields
@@ -43,6 +90,26 @@ KEY = 6
 FILE = 7
 F_NAME = 8
 PATH = 9
+UID = 10
+AES_KEY = 11
+CIPHER = 12
+RESUME_AT = 13
+REPAIR = 14
+INFLATE = 15
+DEDUP = 16
+DELTA = 17
+
+# Cipher ids
+CIPHER_CBC = 0
+CIPHER_CTR = 1
+
+# Codec ids
+CODEC_NONE = 0
+CODEC_ZLIB = 1
+
+# Delta ops
+DELTA_COPY = 0
+DELTA_LITERAL = 1
 
 # Misc
 BAD = "BAD"
@@ -3,9 +3,9 @@ from defs import *
 
 # ClientHeader: Class representing a protocol header of user sent messages
 class ClientHeader:
-    def __init__(self, uid, code, size):
+    def __init__(self, uid, code, size, ver=VER):
         self.uid = uid
-        self.ver = VER
+        self.ver = ver
         self.code = code
         self.size = size
 
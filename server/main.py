@@ -52,24 +52,25 @@ def accept(sock, mask):
 
 # Read: Centralizes all active communication with client while handling retries and exceptions
 def read(conn, mask):
-    try:
-        if openConns[connUID[conn]][CODES] == READING:
-            mid_recv(connUID[conn], conn)
-            return
-    except KeyError:
-        pass
+    if conn in openConns and openConns[conn][CODES] == READING:
+        mid_recv(conn)
+        return
+    if conn in openConns and openConns[conn][CODES] == REPAIRING:
+        mid_repair(conn)
+        return
+    if conn in openConns and openConns[conn][CODES] == DEDUPING:
+        mid_dedup(conn)
+        return
+    if conn in openConns and openConns[conn][CODES] == PATCHING:
+        mid_patch(conn)
+        return
     try:
         data = conn.recv(USER_HEADER_SIZE, socket.MSG_WAITALL)
-        if len(data) == 0:  # connection closed
-            try:
-                sel.unregister(conn)
-            except KeyError:
-                pass
-            finally:
-                return
-        time.sleep(1)
+        if len(data) == 0:  # connection closed - client is done with all its files
+            close_conn(conn)
+            return
         h = header_unpacking(data)
-        if h.code != REGISTER and h.code != RECONNECT and h.uid not in openConns.keys():
+        if h.code not in (REGISTER, RECONNECT, RESUME_SESSION) and (conn not in openConns or openConns[conn][UID] != h.uid):
             return
         handle_payload(h, conn)
     except ValueError as e:
@@ -85,11 +86,12 @@ def read(conn, mask):
 def header_unpacking(header):
     data = struct.unpack("<16schI", header)
     uid = data[0]
-    if int.from_bytes(data[1], "little") != VER:
+    ver = int.from_bytes(data[1], "little")
+    if not MIN_VER <= ver <= VER:  # replies always carry VER so newer clients can step up
         raise Exception("Error: Incompatible client version")
     code = data[2]
     size = data[3]
-    return ClientHeader(uid, code, size)
+    return ClientHeader(uid, code, size, ver)
 
 
 # Handle payload: This function calls the appropriate protocol function based on the code in the user sent header
@@ -100,6 +102,18 @@ def handle_payload(header, conn):
         register(header, conn)
     elif header.code == RECONNECT:
         reconnect(header, conn)
+    elif header.code == RESUME_SESSION:
+        resume_session(header, conn)
+    elif header.code == GET_TICKET:
+        send_ticket(header, conn)
+    elif header.code == CHUNK_LIST:
+        recv_chunk_list(header, conn)
+    elif header.code == DEDUP_FILE:
+        recv_dedup_file(header, conn)
+    elif header.code == GET_SIGNATURES:
+        send_signatures(header, conn)
+    elif header.code == DELTA_FILE:
+        recv_delta_file(header, conn)
     elif header.code == SEND_KEY:
         recv_key(header, conn)
     elif header.code == SEND_FILE:
@@ -110,6 +124,12 @@ def handle_payload(header, conn):
         ack_bad(header, conn)
     elif header.code == FAIL_CRC:
         ack_fail(header, conn)
+    elif header.code == RESUME:
+        recv_resume(header, conn)
+    elif header.code == CHUNK_CRCS:
+        recv_chunk_crcs(header, conn)
+    elif header.code == RESEND_CHUNKS:
+        recv_chunks(header, conn)
 
 
 # Get port: this function reads the port given in the config file port.info
@@ -11,21 +11,34 @@ from Crypto.Util.Padding import unpad
 from main import sel
 import time
 import os
+import hmac
+import hashlib
+import zlib
+import math
 
 # Dict detailing response codes to sent code
 codeDict = {REGISTER: {GOOD: REGISTER_GOOD, BAD: REGISTER_BAD}, SEND_KEY: GOT_KEY, SEND_FILE: SEND_CRC,
-            RECONNECT: {GOOD: RECONNECT_GOOD, BAD: RECONNECT_BAD}, GOOD_CRC: CRC_ACK, FAIL_CRC: CRC_ACK}
+            RECONNECT: {GOOD: RECONNECT_GOOD, BAD: RECONNECT_BAD},
+            RESUME_SESSION: {GOOD: SESSION_RESUMED, BAD: TICKET_BAD}, GET_TICKET: TICKET, GOOD_CRC: CRC_ACK, FAIL_CRC: CRC_ACK}
 # Dict detailing size of static portion of payloads according to code
 sizeDict = {REGISTER: NAME_SIZE, SEND_KEY: NAME_SIZE + KEY_SIZE, RECONNECT: NAME_SIZE, SEND_FILE: SIZE_SIZE + NAME_SIZE,
             BAD_CRC: NAME_SIZE, GOOD_CRC: NAME_SIZE, FAIL_CRC: NAME_SIZE, REGISTER_GOOD: UID_SIZE, REGISTER_BAD: 0,
             RECONNECT_GOOD: UID_SIZE, SEND_CRC: UID_SIZE + SIZE_SIZE + NAME_SIZE + CRC_SIZE, CRC_ACK: UID_SIZE,
-            RECONNECT_BAD: UID_SIZE, GOT_KEY: UID_SIZE, GENERIC_ERROR: 0}
+            RECONNECT_BAD: UID_SIZE, GOT_KEY: UID_SIZE, GENERIC_ERROR: 0, RESUME: NAME_SIZE + NONCE_SIZE,
+            RESUME_OFFSET: UID_SIZE + OFFSET_SIZE, CHUNK_CRCS: NAME_SIZE + COUNT_SIZE,
+            RESEND_CHUNKS: NAME_SIZE + NONCE_SIZE + COUNT_SIZE, BAD_CHUNKS: UID_SIZE + COUNT_SIZE,
+            CHUNK_LIST: NAME_SIZE + COUNT_SIZE, DEDUP_FILE: NAME_SIZE + NONCE_SIZE + COUNT_SIZE,
+            MISSING_CHUNKS: UID_SIZE + COUNT_SIZE, RESUME_SESSION: NAME_SIZE + TICKET_ID_SIZE + NONCE_SIZE, GET_TICKET: 0, SESSION_RESUMED: UID_SIZE + NONCE_SIZE,
+            TICKET: UID_SIZE + TICKET_ID_SIZE + TICKET_SECRET_SIZE + LIFETIME_SIZE,
+            GET_SIGNATURES: NAME_SIZE, SIGNATURES: UID_SIZE + BLOCK_SIZE + COUNT_SIZE, DELTA_FILE: NAME_SIZE + NONCE_SIZE}
 # Dict detailing possible response codes from client based on last sent code
-nextcodeDict = {REGISTER: [SEND_KEY], RECONNECT: [SEND_FILE], SEND_KEY: [SEND_FILE],
-                SEND_FILE: [GOOD_CRC, BAD_CRC, FAIL_CRC], BAD_CRC: [SEND_FILE]}
-# Dict that holds protocol state of currently open connections
+nextcodeDict = {REGISTER: [SEND_KEY], RECONNECT: [SEND_FILE, RESUME, CHUNK_LIST, GET_SIGNATURES, GET_TICKET],
+                SEND_KEY: [SEND_FILE, RESUME, CHUNK_LIST, GET_SIGNATURES, GET_TICKET], SEND_FILE: [GOOD_CRC, BAD_CRC, FAIL_CRC, CHUNK_CRCS],
+                BAD_CRC: [SEND_FILE], GOOD_CRC: [SEND_FILE, RESUME, CHUNK_LIST, GET_SIGNATURES, GET_TICKET],
+                FAIL_CRC: [SEND_FILE, RESUME, CHUNK_LIST, GET_SIGNATURES, GET_TICKET],
+                RESUME_SESSION: [SEND_FILE, RESUME, CHUNK_LIST, GET_SIGNATURES]}
+# Dict that holds protocol state of currently open connections, keyed by socket so a client may hold several at once
 openConns = {}
-connUID = {}
 
 
 # Register: create new user entry in clients table with newly generated ID
@@ -33,10 +46,9 @@ def register(header, conn):
     # Check size validity before reading payload to avoid DOS attack caused by absurdly large payloads
     if header.size != sizeDict[header.code]:
         print("Error: Bad payload size, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
-    payload = conn.recv(header.size)  # receive payload (name)
-    time.sleep(1)
+    payload = conn.recv(header.size, socket.MSG_WAITALL)  # receive payload (name)
     payload = payload.decode("ascii", errors="ignore")  # decode name from ascii encoding
     index = payload.find('\0')
     payload = payload[:index] + '\0'  # null terminate
@@ -50,9 +62,8 @@ def register(header, conn):
     packet = struct.pack("<BHI16s", h.ver, h.code, h.size, uid)  # generate bytes representation of packet
     num = conn.send(packet)
     print(num)
-    time.sleep(1)
     expected_codes = nextcodeDict[header.code]  # set of expected codes
-    openConns[uid] = [payload, conn, expected_codes, RETRIES, RETRIES, None, None, None, None, None]
+    openConns[conn] = [payload, conn, expected_codes, RETRIES, RETRIES, None, None, None, None, None, uid, None, None, None, None, None, None, None]
     db.update_time(uid)  # update last seen
 
 
@@ -60,9 +71,9 @@ def register(header, conn):
 def reconnect(header, conn):
     if header.size != sizeDict[header.code]:
         print("Error: Bad payload size, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
-    payload = conn.recv(header.size).decode("ascii", errors="ignore")  # receive payload (name)
+    payload = conn.recv(header.size, socket.MSG_WAITALL).decode("ascii", errors="ignore")  # receive payload (name)
     index = payload.find('\0')
     payload = payload[:index] + '\0'  # null terminate
     payload = payload + ('\0' * (NAME_SIZE - len(payload)))  # pad name
@@ -79,30 +90,89 @@ def reconnect(header, conn):
     h = ServerHeader(code, sizeDict[code] + len(encrypted))
     if not (db.update_keys(pubKey.exportKey(), plainKey, header.uid)):
         print("Error: Keys weren't written to db, unable to proceed")
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     # generate bytes representation of packet
     packet = struct.pack("<BHI16s" + str(len(encrypted)) + "s", h.ver, h.code, h.size, header.uid, encrypted)
     conn.send(packet)
     expected_codes = nextcodeDict[header.code]  # set of expected codes
-    openConns[header.uid] = [payload, conn, expected_codes, RETRIES, RETRIES, None, None, None, None, None]
+    # every connection keeps its own AES key so parallel sessions of one client don't clobber each other
+    openConns[conn] = [payload, conn, expected_codes, RETRIES, RETRIES, None, None, None, None, None, header.uid,
+                       plainKey, None, None, None, None, None, None]
     db.update_time(header.uid)  # update last seen
     db.write_back()  # update disk db
 
 
+# Resume session: set up connection with a registered user presenting a resumption ticket
+# the session key is derived from the ticket's secret and a nonce of each side, so no RSA operation is involved
+def resume_session(header, conn):
+    if header.size != sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    name = conn.recv(NAME_SIZE, socket.MSG_WAITALL).decode("ascii", errors="ignore")
+    index = name.find('\0')
+    name = name[:index] + '\0'  # null terminate
+    name = name + ('\0' * (NAME_SIZE - len(name)))  # pad name
+    ticket_id = conn.recv(TICKET_ID_SIZE, socket.MSG_WAITALL)
+    client_nonce = conn.recv(NONCE_SIZE, socket.MSG_WAITALL)
+    ticket = db.get_ticket(ticket_id)
+    if ticket is None or ticket[0] != header.uid or ticket[2] <= int(time.time()) or not db.check_id(name, header.uid):
+        print("Error: Session resumption failed, unknown or expired ticket")
+        fail_ticket(conn)
+        return
+    server_nonce = Random.get_random_bytes(NONCE_SIZE)
+    plainKey = hmac.new(ticket[1], ticket_id + client_nonce + server_nonce, hashlib.sha256).digest()[:16]
+    code = codeDict[header.code][GOOD]
+    h = ServerHeader(code, sizeDict[code])
+    packet = struct.pack("<BHI16s16s", h.ver, h.code, h.size, header.uid, server_nonce)
+    conn.send(packet)
+    expected_codes = nextcodeDict[header.code]  # set of expected codes
+    openConns[conn] = [name, conn, expected_codes, RETRIES, RETRIES, None, None, None, None, None, header.uid,
+                       plainKey, None, None, None, None, None, None]
+    db.update_time(header.uid)  # update last seen
+
+
+# Send ticket: issue a resumption ticket to a client authenticated through RSA
+# the secret travels in CTR mode under the connection's AES key, with the ticket id as nonce
+def send_ticket(header, conn):
+    db.update_time(header.uid)  # update last seen
+    if not (header.code in openConns[conn][CODES]):
+        print("Error: Unexpected opcode, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if header.size != sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    ticket_id = Random.get_random_bytes(TICKET_ID_SIZE)
+    secret = Random.get_random_bytes(TICKET_SECRET_SIZE)
+    now = int(time.time())
+    if not db.store_ticket(ticket_id, header.uid, secret, now + TICKET_LIFETIME, now):
+        fail_generic(conn)
+        return
+    db.write_back()  # tickets outlive the server process
+    sealed = ctr_cipher(openConns[conn][AES_KEY], ticket_id, 0).encrypt(secret)
+    code = codeDict[header.code]
+    h = ServerHeader(code, sizeDict[code])
+    packet = struct.pack("<BHI16s16s32sI", h.ver, h.code, h.size, header.uid, ticket_id, sealed, TICKET_LIFETIME)
+    conn.send(packet)
+    print("Alert: Issued resumption ticket on connection:", conn)
+
+
 # Receive key: get public rsa key from client, and send AES key encrypted using the rsa key
 def recv_key(header, conn):
     db.update_time(header.uid)  # update last seen
-    if not (header.code in openConns[header.uid][CODES]):
+    if not (header.code in openConns[conn][CODES]):
         print("Error: Unexpected opcode, may retry", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     if header.size != sizeDict[header.code]:
         print("Error: Bad payload size, may retry", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     try:
-        payload = conn.recv(header.size)  # receive payload (name + key)
+        payload = conn.recv(header.size, socket.MSG_WAITALL)  # receive payload (name + key)
         print("Public key:"+str(payload[255:]))
         plainKey = Random.get_random_bytes(16)  # generate plain AES key
         print("AES:"+str(plainKey))
@@ -116,136 +186,265 @@ def recv_key(header, conn):
         h = ServerHeader(code, sizeDict[code] + len(encrypted))
         if not(db.update_keys(pubKey.exportKey(), plainKey, header.uid)):
             print("Error: Keys weren't written to db, unable to proceed")
-            fail_generic(conn, header.uid)
+            fail_generic(conn)
             return
         # generate bytes representation of packet
         packet = struct.pack("<BHI16s" + str(len(encrypted)) + "s", h.ver, h.code, h.size, header.uid, encrypted)
         conn.send(packet)
         expected_codes = nextcodeDict[header.code]  # set of expected codes
-        openConns[header.uid][CODES] = expected_codes  # update connection state
-        openConns[header.uid][RETRY] = RETRIES  # update connection state
+        openConns[conn][CODES] = expected_codes  # update connection state
+        openConns[conn][RETRY] = RETRIES  # update connection state
+        openConns[conn][AES_KEY] = plainKey
         db.write_back()  # update disk db
     except Exception as e:  # For debugging
         print(e)
         exit(1)
 
 
+# CTR cipher: decryptor for data that sits at offset (a multiple of 16) in a file sent under nonce
+# the counter is the whole nonce plus the blocks before offset, as in the client's CryptoPP CTR_Mode
+def ctr_cipher(key, nonce, offset):
+    counter = (int.from_bytes(nonce, "big") + offset // 16) % (1 << 128)
+    return AES.new(key, AES.MODE_CTR, nonce=b"", initial_value=counter.to_bytes(16, "big"))
+
+
+# Clean name: turn a received name field into a null terminated name that can't escape the client's directory
+def clean_name(raw):
+    filename = raw.decode("ascii", errors="ignore")
+    index = filename.find('\0')
+    filename = filename[:index] + '\0'  # null terminate
+    filename = filename.replace("\\", "")  # remove all occurrences of backslash to avoid path traversal
+    filename = filename.replace("/", "%2F")  # files from listed directories arrive as %2F separated paths, keep any other slash flat too
+    filename = filename.replace("..", "")  # remove all occurrences of backslash to avoid path traversal
+    return filename
+
+
+# Client path: full path a client's file is stored under, creating the client's directory if needed
+def client_path(uid, filename):
+    path = uid.hex()  # generate HEX UID PATH
+    wd = os.getcwd()  # get path to working directory
+    if not wd.endswith('\\'):
+        wd = wd + '\\'
+    try:
+        path = wd + path
+        os.mkdir(path)  # generate new dir for client if one doesn't exist already
+    except FileExistsError:
+        pass
+    return path + "\\" + filename[:filename.find('\0')]  # concat name to user dir to generate full path
+
+
+# Chunk path: where a client's content defined chunks are kept, named by their SHA-256
+def chunk_path(uid, digest):
+    path = uid.hex() + "_chunks"  # next to the client's upload directory
+    wd = os.getcwd()  # get path to working directory
+    if not wd.endswith('\\'):
+        wd = wd + '\\'
+    try:
+        path = wd + path
+        os.mkdir(path)  # generate the chunk directory if one doesn't exist already
+    except FileExistsError:
+        pass
+    return path + "\\" + digest.hex()
+
+
+# Receive resume: tell the client how much of an interrupted upload is already on disk
+# only whole AES blocks count so the CTR counter can pick up exactly there, anything past that is cut off
+def recv_resume(header, conn):
+    db.update_time(header.uid)  # update last seen
+    if not (header.code in openConns[conn][CODES]):
+        print("Error: Unexpected opcode, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if header.size != sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    filename = clean_name(conn.recv(NAME_SIZE, socket.MSG_WAITALL))
+    nonce = conn.recv(NONCE_SIZE, socket.MSG_WAITALL)
+    offset = 0
+    partial = db.get_partial(header.uid, filename.encode("ascii"))
+    if len(filename) > 1 and partial is not None and partial[0] == nonce:
+        path = client_path(header.uid, filename)
+        try:
+            offset = min(os.path.getsize(path), partial[1])
+            offset = offset - offset % 16
+            os.truncate(path, offset)
+        except OSError:
+            offset = 0
+    openConns[conn][RESUME_AT] = (filename, nonce, offset)
+    code = RESUME_OFFSET
+    h = ServerHeader(code, sizeDict[code])
+    packet = struct.pack("<BHI16sI", h.ver, h.code, h.size, header.uid, offset)
+    conn.send(packet)
+    print("Alert: Resuming", filename, "at", offset, "on connection:", conn)
+
+
 # Receive file: get file from client, decrypt it using AES key and store it
+# from RESUME_VER on the payload ends with the offset the client continues from, as agreed through recv_resume
+# from COMPRESS_VER on the codec and original size follow, a deflated file is inflated as it comes in
 def recv_file(header, conn):
     db.update_time(header.uid)  # update last seen
-    if not (header.code in openConns[header.uid][CODES]):
+    if not (header.code in openConns[conn][CODES]):
         print("Error: Unexpected opcode, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     if header.size < sizeDict[header.code]:
         print("Error: Bad payload size, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     try:
         size = conn.recv(SIZE_SIZE, socket.MSG_WAITALL)
-        print(str(size[3]))
         size = int.from_bytes(size, byteorder="little")  # reported size of file
-        if size != (header.size - NAME_SIZE - SIZE_SIZE):  # sanity check both sizes
+        static = sizeDict[header.code] + (CIPHER_SIZE + NONCE_SIZE if header.ver >= CTR_VER else 0)
+        static = static + (OFFSET_SIZE if header.ver >= RESUME_VER else 0)
+        static = static + (CODEC_SIZE + SIZE_SIZE if header.ver >= COMPRESS_VER else 0)
+        filename = clean_name(conn.recv(NAME_SIZE, socket.MSG_WAITALL))
+        cipher = CIPHER_CBC
+        offset = 0
+        if header.ver >= CTR_VER:  # cipher id and nonce follow the name from version 4 on
+            cipher = conn.recv(CIPHER_SIZE, socket.MSG_WAITALL)[0]
+            nonce = conn.recv(NONCE_SIZE, socket.MSG_WAITALL)
+            if cipher not in (CIPHER_CBC, CIPHER_CTR):
+                print("Error: Unknown cipher, terminating connection", conn)
+                fail_generic(conn)
+                return
+        if header.ver >= RESUME_VER:
+            offset = int.from_bytes(conn.recv(OFFSET_SIZE, socket.MSG_WAITALL), byteorder="little")
+        codec = CODEC_NONE
+        if header.ver >= COMPRESS_VER:
+            codec = conn.recv(CODEC_SIZE, socket.MSG_WAITALL)[0]
+            original = int.from_bytes(conn.recv(SIZE_SIZE, socket.MSG_WAITALL), byteorder="little")
+            if codec not in (CODEC_NONE, CODEC_ZLIB) or (codec == CODEC_ZLIB and (cipher != CIPHER_CTR or offset)):
+                print("Error: Unknown codec or deflated resume, terminating connection", conn)
+                fail_generic(conn)
+                return
+        if size - offset != (header.size - static):  # sanity check both sizes
             print("Error: Size mismatch, terminating connection", conn)
-            fail_generic(conn, header.uid)
+            fail_generic(conn)
+            return
+        if offset and (cipher != CIPHER_CTR or openConns[conn][RESUME_AT] != (filename, nonce, offset)):
+            print("Error: Resume offset wasn't agreed on, terminating connection", conn)
+            fail_generic(conn)
             return
-        openConns[header.uid][REM] = size
-        filename = conn.recv(NAME_SIZE, socket.MSG_WAITALL).decode("ascii", errors="ignore")
-        print(str(filename[254]))
-        index = filename.find('\0')
-        filename = filename[:index] + '\0'  # null terminate
-        filename = filename.replace("\\", "")  # remove all occurrences of backslash to avoid path traversal
-        filename = filename.replace("..", "")  # remove all occurrences of backslash to avoid path traversal
+        openConns[conn][RESUME_AT] = None
         if len(filename) == 0:
             print("Error: Bad filename", conn)
-            fail_generic(conn, header.uid)
+            fail_generic(conn)
             return
-        aes = db.get_aes(header.uid)  # retrieve aes from db
+        aes = openConns[conn][AES_KEY]  # key handed out on this connection
         print("AES retrieved:" + str(aes))
         if not aes:
             print("Error: Couldn't retrieve public key cannot proceed, terminating connection", conn)
-            openConns[header.uid][RETRY] = 0
-            fail_generic(conn, header.uid)
+            openConns[conn][RETRY] = 0
+            fail_generic(conn)
             return
-        aes = AES.new(aes, AES.MODE_CBC, iv=bytes(16))  # init usable key
-        path = header.uid.hex()  # generate HEX UID PATH
-        wd = os.getcwd()  # get path to working directory
-        if not wd.endswith('\\'):
-            wd = wd + '\\'
-        try:
-            path = wd + path
-            os.mkdir(path)  # generate new dir for client if one doesn't exist already
-        except FileExistsError:
-            pass
-        path = path + "\\" + filename[:filename.find('\0')]  # concat name to user dir to generate full path
-        out = open(path, "wb")
+        if cipher == CIPHER_CTR:
+            aes = ctr_cipher(aes, nonce, offset)
+            if not offset and codec == CODEC_NONE:  # deflated uploads can't be resumed
+                db.start_partial(header.uid, filename.encode("ascii"), nonce, size)
+                db.write_back()  # a restarted server still knows the upload can be resumed
+        else:
+            aes = AES.new(aes, AES.MODE_CBC, iv=bytes(16))  # init usable key
+        path = client_path(header.uid, filename)
+        out = open(path, "ab" if offset else "wb")  # resumed uploads keep what is already on disk
         out.close()
-        openConns[header.uid][REM] = size
-        openConns[header.uid][KEY] = aes
-        openConns[header.uid][F_NAME] = filename.encode("ascii")
-        openConns[header.uid][PATH] = path
-        openConns[header.uid][CODES] = READING
-        connUID[conn] = header.uid
+        openConns[conn][REM] = size - offset
+        openConns[conn][KEY] = aes
+        openConns[conn][CIPHER] = cipher
+        openConns[conn][INFLATE] = [zlib.decompressobj(), original] if codec == CODEC_ZLIB else None
+        openConns[conn][F_NAME] = filename.encode("ascii")
+        openConns[conn][PATH] = path
+        openConns[conn][CODES] = READING
+        if openConns[conn][REM] == 0:  # nothing was missing
+            end_recv(conn)
     except Exception as e:  # For debugging
         print(e)
         exit(1)
 
 
 # Receive file end: finalize file transfer and send a 2103 message to the client
-def end_recv(uid, conn):
-    openConns[CODES] = nextcodeDict[SEND_FILE]
-    db.write_back()
+def end_recv(conn):
+    uid = openConns[conn][UID]
     code = SEND_CRC
     h = ServerHeader(code, sizeDict[code])
-    file = open(openConns[uid][PATH], "rb")
+    file = open(openConns[conn][PATH], "rb")
     content = file.read()
     crc = memcrc(content)  # calculate crc of file
     print(crc)
-    filename = openConns[uid][F_NAME]  # ascii representation of name of file as saved on server
+    filename = openConns[conn][F_NAME]  # ascii representation of name of file as saved on server
+    db.end_partial(uid, filename)  # fully received, nothing left to resume
     # generate bytes representation of packet
-    if not db.register_file(uid, filename, openConns[uid][PATH]):  # update files table to include new file
-        fail_generic(conn, uid)
+    if not db.register_file(uid, filename, openConns[conn][PATH]):  # update files table to include new file
+        fail_generic(conn)
         return
-    size = len(content) + (16-(len(content) % 16))  # AES blocks are 16 bytes - calculate the padding
+    size = len(content)
+    if openConns[conn][CIPHER] == CIPHER_CBC:
+        size = size + (16-(size % 16))  # AES blocks are 16 bytes - calculate the padding
     packet = struct.pack("<BHI16sI255sI", h.ver, h.code, h.size, uid, size, filename, crc)
     conn.send(packet)
     expected_codes = nextcodeDict[SEND_FILE]  # set of expected codes
-    openConns[uid][CODES] = expected_codes  # update connection state
+    openConns[conn][CODES] = expected_codes  # update connection state
     db.write_back()  # update disk db
 
 
 # Mid-file receive: this function handles all chunk transfers and, decryption and writing back to file
-def mid_recv(uid, conn):
-    vals = openConns[uid]
+def mid_recv(conn):
+    vals = openConns[conn]
     req = min(vals[REM], CHUNK_SIZE)
-    file = conn.recv(req, socket.MSG_WAITALL)  # guarantees everything has been read
+    file = conn.recv(req, socket.MSG_WAITALL)  # guarantees everything has been read, unless the client went away
+    if len(file) < req:  # the partial record stays, the client resumes the upload from what is on disk
+        print("Error: Client dropped mid upload:", conn)
+        close_conn(conn)
+        return
     file = vals[KEY].decrypt(file)  # decrypt file
     out = open(vals[PATH], "ab")
-    if vals[REM] == req:
+    if vals[REM] == req and vals[CIPHER] == CIPHER_CBC:  # CTR output carries no padding
         file = unpad(file, vals[KEY].block_size)  # remove padding
+    if vals[INFLATE] is not None:
+        try:
+            file = inflate(vals[INFLATE], file, vals[REM] == req)
+        except (zlib.error, ValueError) as e:
+            out.close()
+            print("Error:", e, "terminating connection", conn)
+            fail_generic(conn)
+            return
     out.write(file)  # save to file
     out.close()
-    openConns[uid][REM] = vals[REM] - req
-    if openConns[uid][REM] == 0:
-        end_recv(uid, conn)
+    openConns[conn][REM] = vals[REM] - len(file)
+    if openConns[conn][REM] == 0:
+        end_recv(conn)
         return
 
 
+# Inflate: state is [decompressor, bytes still expected], never produce more than the client said the file holds
+def inflate(state, data, last):
+    data = state[0].decompress(data, state[1] + 1)
+    if last:
+        data = data + state[0].flush()
+    if len(data) > state[1] or state[0].unconsumed_tail:
+        raise ValueError("Deflated file is larger than announced")
+    state[1] = state[1] - len(data)
+    if last and (state[1] or not state[0].eof):
+        raise ValueError("Deflated file is truncated")
+    return data
+
+
 # Acknowledge good crc: Send final message to client to confirm file has been marked as verified
+# the connection stays open so the client can send its next file under the same key
 def ack_good(header, conn):
     db.update_time(header.uid)  # update last seen
-    if not (header.code in openConns[header.uid][CODES]):
+    if not (header.code in openConns[conn][CODES]):
         print("Error: Unexpected opcode, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     if header.size != sizeDict[header.code]:
         print("Error: Bad payload size, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
-    payload = conn.recv(header.size)
+    payload = conn.recv(header.size, socket.MSG_WAITALL)
     if not(db.check_id_file(header.uid, payload)):
         print("Error: Don't own any file with that name, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     db.verify(header.uid, payload)  # mark file as verified
     code = codeDict[header.code]
@@ -253,70 +452,486 @@ def ack_good(header, conn):
     # generate bytes representation of packet
     packet = struct.pack("<BHI16s", h.ver, h.code, h.size, header.uid)
     conn.send(packet)
-    try:
-        sel.unregister(conn)  # unregister user from open connections monitored by selector
-    except KeyError:
-        pass
-    # need to delete from openConns here
-    conn.close()
+    next_file(conn)
     db.write_back()  # update disk db
 
 
 # Acknowledge bad crc: get message about bad crc from client, prepare to get file again
 def ack_bad(header, conn):
-    if openConns[header.uid][F_RETRY] == 0:
+    if openConns[conn][F_RETRY] == 0:
         print("Error: Too many retries attempted, terminating connection")
-        openConns[header.uid][RETRY] = 0
-        fail_generic(conn, header.uid)
+        openConns[conn][RETRY] = 0
+        fail_generic(conn)
         return
-    openConns[header.uid][F_RETRY] = openConns[header.uid][F_RETRY] - 1
+    openConns[conn][F_RETRY] = openConns[conn][F_RETRY] - 1
     db.update_time(header.uid)
-    if not (header.code in openConns[header.uid][CODES]):
+    if not (header.code in openConns[conn][CODES]):
         print("Error: Unexpected opcode, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     if header.size != sizeDict[header.code]:
         print("Error: Bad payload size, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
-    payload = conn.recv(header.size)
+    payload = conn.recv(header.size, socket.MSG_WAITALL)
     if not(db.check_id_file(header.uid, payload)):
         print("Error: Don't own any file with that name, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     db.write_back()
     expected_codes = nextcodeDict[header.code]
-    openConns[header.uid][CODES] = expected_codes
-    openConns[header.uid][F_RETRY] = openConns[header.uid][F_RETRY] - 1
+    openConns[conn][CODES] = expected_codes
+    openConns[conn][F_RETRY] = openConns[conn][F_RETRY] - 1
+
+
+# Receive chunk crcs: compare the client's cksum of every chunk against the stored file and report the ones that differ
+# counts as a bad CRC retry just like ack_bad, but the client then resends only the reported chunks
+def recv_chunk_crcs(header, conn):
+    db.update_time(header.uid)  # update last seen
+    if not (header.code in openConns[conn][CODES]):
+        print("Error: Unexpected opcode, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if openConns[conn][F_RETRY] == 0:
+        print("Error: Too many retries attempted, terminating connection")
+        openConns[conn][RETRY] = 0
+        fail_generic(conn)
+        return
+    openConns[conn][F_RETRY] = openConns[conn][F_RETRY] - 1
+    if header.size < sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    name = conn.recv(NAME_SIZE, socket.MSG_WAITALL)
+    count = int.from_bytes(conn.recv(COUNT_SIZE, socket.MSG_WAITALL), byteorder="little")
+    if header.size != sizeDict[header.code] + count * CRC_SIZE:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    crcs = conn.recv(count * CRC_SIZE, socket.MSG_WAITALL)
+    if not(db.check_id_file(header.uid, name)):
+        print("Error: Don't own any file with that name, terminating connection", conn)
+        fail_generic(conn)
+        return
+    file = open(openConns[conn][PATH], "rb")
+    content = file.read()
+    file.close()
+    chunks = (len(content) + CHECK_CHUNK - 1) // CHECK_CHUNK
+    bad = []
+    for i in range(chunks):  # chunks the client doesn't know about can't be repaired - report them all
+        theirs = int.from_bytes(crcs[i * CRC_SIZE:(i + 1) * CRC_SIZE], byteorder="little") if i < count else None
+        if memcrc(content[i * CHECK_CHUNK:(i + 1) * CHECK_CHUNK]) != theirs:
+            bad.append(i)
+    if count != chunks:
+        bad = []  # lengths differ, only a full resend can fix that
+    openConns[conn][REPAIR] = (bad, len(content))
+    openConns[conn][CODES] = [RESEND_CHUNKS, SEND_FILE]
+    code = BAD_CHUNKS
+    h = ServerHeader(code, sizeDict[code] + len(bad) * INDEX_SIZE)
+    packet = struct.pack("<BHI16sI", h.ver, h.code, h.size, header.uid, len(bad))
+    packet = packet + b"".join(i.to_bytes(INDEX_SIZE, byteorder="little") for i in bad)
+    conn.send(packet)
+    print("Alert:", len(bad), "of", chunks, "chunks mismatched on connection:", conn)
+
+
+# Receive chunks: start receiving the chunks reported by recv_chunk_crcs, mid_repair writes them over the stored file
+def recv_chunks(header, conn):
+    db.update_time(header.uid)  # update last seen
+    if not (header.code in openConns[conn][CODES]):
+        print("Error: Unexpected opcode, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if header.size < sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    name = conn.recv(NAME_SIZE, socket.MSG_WAITALL)
+    nonce = conn.recv(NONCE_SIZE, socket.MSG_WAITALL)
+    count = int.from_bytes(conn.recv(COUNT_SIZE, socket.MSG_WAITALL), byteorder="little")
+    indexes = conn.recv(count * INDEX_SIZE, socket.MSG_WAITALL)
+    indexes = [int.from_bytes(indexes[i:i + INDEX_SIZE], byteorder="little") for i in range(0, len(indexes), INDEX_SIZE)]
+    bad, size = openConns[conn][REPAIR]
+    data = sum(min(CHECK_CHUNK, size - i * CHECK_CHUNK) for i in indexes if i in bad)
+    if len(indexes) != count or not set(indexes) <= set(bad) or clean_name(name).encode("ascii") != openConns[conn][F_NAME]:
+        print("Error: Chunks weren't requested, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if header.size != sizeDict[header.code] + count * INDEX_SIZE + data:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    openConns[conn][REPAIR] = (indexes, size, nonce)
+    openConns[conn][KEY] = None
+    openConns[conn][CODES] = REPAIRING
+    if count == 0:
+        end_recv(conn)
+
+
+# Receive chunk list: get the digest and length of every chunk of a file, reply with the ones not stored for this UID yet
+# a digest repeated within the file is only asked for once
+def recv_chunk_list(header, conn):
+    db.update_time(header.uid)  # update last seen
+    if not (header.code in openConns[conn][CODES]):
+        print("Error: Unexpected opcode, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if header.size < sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    filename = clean_name(conn.recv(NAME_SIZE, socket.MSG_WAITALL))
+    count = int.from_bytes(conn.recv(COUNT_SIZE, socket.MSG_WAITALL), byteorder="little")
+    entry = DIGEST_SIZE + LENGTH_SIZE
+    if header.size != sizeDict[header.code] + count * entry:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    entries = conn.recv(count * entry, socket.MSG_WAITALL)
+    digests = [entries[i:i + DIGEST_SIZE] for i in range(0, len(entries), entry)]
+    lengths = [int.from_bytes(entries[i + DIGEST_SIZE:i + entry], byteorder="little") for i in range(0, len(entries), entry)]
+    if len(filename) == 0 or not all(0 < length <= DEDUP_MAX_CHUNK for length in lengths) or sum(lengths) >= 2 ** 32:
+        print("Error: Bad chunk list, terminating connection", conn)
+        fail_generic(conn)
+        return
+    held = {d for d in db.held_chunks(header.uid, set(digests)) if os.path.exists(chunk_path(header.uid, d))}
+    missing = []
+    for i, digest in enumerate(digests):
+        if digest not in held:
+            missing.append(i)
+            held.add(digest)
+    openConns[conn][DEDUP] = [filename, digests, lengths, missing]
+    openConns[conn][CODES] = [DEDUP_FILE, SEND_FILE]
+    code = MISSING_CHUNKS
+    h = ServerHeader(code, sizeDict[code] + len(missing) * INDEX_SIZE)
+    packet = struct.pack("<BHI16sI", h.ver, h.code, h.size, header.uid, len(missing))
+    packet = packet + b"".join(i.to_bytes(INDEX_SIZE, byteorder="little") for i in missing)
+    conn.send(packet)
+    print("Alert:", len(missing), "of", count, "chunks missing on connection:", conn)
+
+
+# Receive deduplicated file: get the chunks recv_chunk_list asked for, as one CTR stream under the nonce given
+def recv_dedup_file(header, conn):
+    db.update_time(header.uid)  # update last seen
+    if not (header.code in openConns[conn][CODES]):
+        print("Error: Unexpected opcode, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if header.size < sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    name = conn.recv(NAME_SIZE, socket.MSG_WAITALL)
+    nonce = conn.recv(NONCE_SIZE, socket.MSG_WAITALL)
+    count = int.from_bytes(conn.recv(COUNT_SIZE, socket.MSG_WAITALL), byteorder="little")
+    indexes = conn.recv(count * INDEX_SIZE, socket.MSG_WAITALL)
+    indexes = [int.from_bytes(indexes[i:i + INDEX_SIZE], byteorder="little") for i in range(0, len(indexes), INDEX_SIZE)]
+    filename, digests, lengths, missing = openConns[conn][DEDUP]
+    if indexes != missing or clean_name(name) != filename:
+        print("Error: Chunks weren't requested, terminating connection", conn)
+        fail_generic(conn)
+        return
+    data = sum(lengths[i] for i in missing)
+    if header.size != sizeDict[header.code] + count * INDEX_SIZE + data:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    openConns[conn][DEDUP] = [filename, digests, lengths, missing, 0, bytearray()]  # next missing chunk, its data so far
+    openConns[conn][KEY] = ctr_cipher(openConns[conn][AES_KEY], nonce, 0)
+    openConns[conn][CIPHER] = CIPHER_CTR
+    openConns[conn][F_NAME] = filename.encode("ascii")
+    openConns[conn][PATH] = client_path(header.uid, filename)
+    openConns[conn][REM] = data
+    openConns[conn][CODES] = DEDUPING
+    if data == 0:  # the server held every chunk
+        end_dedup(conn)
+
+
+# Mid-dedup receive: decrypt the stream, and store every chunk once it is complete and matches its digest
+def mid_dedup(conn):
+    vals = openConns[conn]
+    state = vals[DEDUP]
+    digests, lengths, missing, current = state[1], state[2], state[3], state[5]
+    req = min(vals[REM], CHUNK_SIZE)
+    data = conn.recv(req, socket.MSG_WAITALL)  # guarantees everything has been read, unless the client went away
+    if len(data) < req:  # chunks stored so far stay in the store, the file itself is never put together
+        print("Error: Client dropped mid dedup upload:", conn)
+        close_conn(conn)
+        return
+    current += vals[KEY].decrypt(data)
+    vals[REM] = vals[REM] - len(data)
+    while state[4] < len(missing) and len(current) >= lengths[missing[state[4]]]:
+        index = missing[state[4]]
+        chunk = bytes(current[:lengths[index]])
+        del current[:lengths[index]]
+        if hashlib.sha256(chunk).digest() != digests[index]:
+            print("Error: Chunk doesn't match its digest, terminating connection", conn)
+            vals[RETRY] = 0
+            fail_generic(conn)
+            return
+        out = open(chunk_path(vals[UID], digests[index]), "wb")
+        out.write(chunk)
+        out.close()
+        db.store_chunk(vals[UID], digests[index], len(chunk))
+        state[4] = state[4] + 1
+    if vals[REM] == 0:
+        end_dedup(conn)
+
+
+# Dedup end: put the file together from the chunk store and finish it like any other upload
+def end_dedup(conn):
+    vals = openConns[conn]
+    try:
+        out = open(vals[PATH], "wb")
+        for digest in vals[DEDUP][1]:
+            chunk = open(chunk_path(vals[UID], digest), "rb")
+            out.write(chunk.read())
+            chunk.close()
+        out.close()
+    except OSError as e:
+        print("Error: Couldn't reassemble file,", e, "terminating connection", conn)
+        vals[RETRY] = 0
+        fail_generic(conn)
+        return
+    vals[DEDUP] = None
+    end_recv(conn)
+
+
+# Send signatures: sign every whole block of the client's copy of a file so it may upload a delta against it
+# a zero count means there is no copy, the client then sends the file the usual way
+def send_signatures(header, conn):
+    db.update_time(header.uid)  # update last seen
+    if not (header.code in openConns[conn][CODES]):
+        print("Error: Unexpected opcode, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if header.size != sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    filename = clean_name(conn.recv(NAME_SIZE, socket.MSG_WAITALL))
+    path = client_path(header.uid, filename)
+    block = 0
+    entries = []
+    if len(filename) > 1 and os.path.isfile(path):
+        size = os.path.getsize(path)
+        block = max(DELTA_MIN_BLOCK, min(DELTA_MAX_BLOCK, math.isqrt(size) & ~1023))
+        basis = open(path, "rb")
+        data = basis.read(block)
+        while len(data) == block:  # a trailing partial block is always sent as a literal
+            entries.append(zlib.adler32(data).to_bytes(WEAK_SIZE, byteorder="little") + hashlib.sha256(data).digest()[:STRONG_SIZE])
+            data = basis.read(block)
+        basis.close()
+    openConns[conn][CODES] = [DELTA_FILE, SEND_FILE, CHUNK_LIST] if entries else [SEND_FILE, CHUNK_LIST]
+    openConns[conn][DELTA] = [filename, path, block, len(entries)] if entries else None
+    code = SIGNATURES
+    h = ServerHeader(code, sizeDict[code] + len(entries) * (WEAK_SIZE + STRONG_SIZE))
+    packet = struct.pack("<BHI16sII", h.ver, h.code, h.size, header.uid, block, len(entries))
+    conn.send(packet + b"".join(entries))
+    print("Alert:", len(entries), "signatures of", block, "bytes sent on connection:", conn)
+
+
+# Receive delta file: patch the client's copy of a file from a stream of copy and literal ops, into a temp file
+def recv_delta_file(header, conn):
+    db.update_time(header.uid)  # update last seen
+    if not (header.code in openConns[conn][CODES]):
+        print("Error: Unexpected opcode, terminating connection", conn)
+        fail_generic(conn)
+        return
+    if header.size <= sizeDict[header.code]:
+        print("Error: Bad payload size, terminating connection", conn)
+        fail_generic(conn)
+        return
+    name = clean_name(conn.recv(NAME_SIZE, socket.MSG_WAITALL))
+    nonce = conn.recv(NONCE_SIZE, socket.MSG_WAITALL)
+    filename, path, block, count = openConns[conn][DELTA]
+    if name != filename:
+        print("Error: Delta isn't for the file signed, terminating connection", conn)
+        fail_generic(conn)
+        return
+    try:
+        basis = open(path, "rb")
+        out = open(path + ".delta~", "wb")
+    except OSError as e:
+        print("Error: Couldn't open files to patch,", e, "terminating connection", conn)
+        openConns[conn][RETRY] = 0
+        fail_generic(conn)
+        return
+    # basis, output, block size, block count, undecoded bytes, literal bytes left, bytes written
+    openConns[conn][DELTA] = [basis, out, block, count, bytearray(), 0, 0]
+    openConns[conn][KEY] = ctr_cipher(openConns[conn][AES_KEY], nonce, 0)
+    openConns[conn][CIPHER] = CIPHER_CTR
+    openConns[conn][F_NAME] = filename.encode("ascii")
+    openConns[conn][PATH] = path
+    openConns[conn][REM] = header.size - sizeDict[header.code]
+    openConns[conn][CODES] = PATCHING
+
+
+# Mid-patch receive: decode ops as they arrive, copying runs of blocks from the old copy and appending literals
+def mid_patch(conn):
+    vals = openConns[conn]
+    state = vals[DELTA]
+    basis, out, block, count, pending = state[0], state[1], state[2], state[3], state[4]
+    req = min(vals[REM], CHUNK_SIZE)
+    data = conn.recv(req, socket.MSG_WAITALL)  # guarantees everything has been read, unless the client went away
+    if len(data) < req:
+        drop_patch(conn)
+        print("Error: Client dropped mid delta upload:", conn)
+        close_conn(conn)
+        return
+    pending += vals[KEY].decrypt(data)
+    vals[REM] = vals[REM] - len(data)
+    while pending:
+        if state[5]:  # inside a literal
+            take = min(state[5], len(pending))
+            out.write(pending[:take])
+            del pending[:take]
+            state[5] = state[5] - take
+            state[6] = state[6] + take
+        elif pending[0] == DELTA_COPY and len(pending) >= OP_SIZE + INDEX_SIZE + COUNT_SIZE:
+            first = int.from_bytes(pending[OP_SIZE:OP_SIZE + INDEX_SIZE], byteorder="little")
+            run = int.from_bytes(pending[OP_SIZE + INDEX_SIZE:OP_SIZE + INDEX_SIZE + COUNT_SIZE], byteorder="little")
+            del pending[:OP_SIZE + INDEX_SIZE + COUNT_SIZE]
+            if run == 0 or first + run > count:
+                abort_patch(conn, "Copy past the signed blocks")
+                return
+            basis.seek(first * block)
+            left = run * block
+            while left:
+                data = basis.read(min(left, CHECK_CHUNK))
+                out.write(data)
+                left = left - len(data)
+            state[6] = state[6] + run * block
+        elif pending[0] == DELTA_LITERAL and len(pending) >= OP_SIZE + LENGTH_SIZE:
+            state[5] = int.from_bytes(pending[OP_SIZE:OP_SIZE + LENGTH_SIZE], byteorder="little")
+            del pending[:OP_SIZE + LENGTH_SIZE]
+        elif pending[0] not in (DELTA_COPY, DELTA_LITERAL):
+            abort_patch(conn, "Unknown delta op")
+            return
+        else:
+            break  # op split across reads
+        if state[6] >= 2 ** 32:
+            abort_patch(conn, "Patched file too large")
+            return
+    if vals[REM] == 0:
+        end_patch(conn)
+
+
+# Patch end: the stream must end on an op boundary, then the patched file replaces the old copy
+def end_patch(conn):
+    vals = openConns[conn]
+    basis, out, pending, literal = vals[DELTA][0], vals[DELTA][1], vals[DELTA][4], vals[DELTA][5]
+    if pending or literal:
+        abort_patch(conn, "Delta ends mid op")
+        return
+    basis.close()
+    out.close()
+    try:
+        os.replace(vals[PATH] + ".delta~", vals[PATH])
+    except OSError as e:
+        abort_patch(conn, "Couldn't replace file, " + str(e))
+        return
+    vals[DELTA] = None
+    end_recv(conn)
+
+
+# Drop patch: close and remove the half patched file, the old copy stays as it was
+def drop_patch(conn):
+    vals = openConns[conn]
+    vals[DELTA][0].close()
+    vals[DELTA][1].close()
+    try:
+        os.remove(vals[PATH] + ".delta~")
+    except OSError:
+        pass
+
+
+# Abort patch: drop the half patched file and the connection
+def abort_patch(conn, reason):
+    vals = openConns[conn]
+    drop_patch(conn)
+    print("Error:", reason + ", terminating connection", conn)
+    vals[RETRY] = 0
+    fail_generic(conn)
+
+
+# Mid-repair receive: like mid_recv but each chunk is decrypted from its own counter and written back in place
+def mid_repair(conn):
+    vals = openConns[conn]
+    indexes, size, nonce = vals[REPAIR]
+    start = indexes[0] * CHECK_CHUNK
+    length = min(CHECK_CHUNK, size - start)
+    if vals[KEY] is None:  # first piece of this chunk
+        vals[KEY] = ctr_cipher(vals[AES_KEY], nonce, start)
+        vals[REM] = length
+    req = min(vals[REM], CHUNK_SIZE)
+    file = conn.recv(req, socket.MSG_WAITALL)  # guarantees everything has been read, unless the client went away
+    if len(file) < req:  # the file keeps its bad chunks and is never acknowledged
+        print("Error: Client dropped mid repair:", conn)
+        close_conn(conn)
+        return
+    file = vals[KEY].decrypt(file)
+    out = open(vals[PATH], "r+b")
+    out.seek(start + length - vals[REM])
+    out.write(file)
+    out.close()
+    vals[REM] = vals[REM] - len(file)
+    if vals[REM] == 0:
+        indexes.pop(0)
+        vals[KEY] = None
+        if not indexes:
+            end_recv(conn)  # recompute the whole file's crc and ask the client again
 
 
 # Acknowledge crc fail: get message about 4th file transfer failure from client, send ack to client and close connection
 def ack_fail(header, conn):
     db.update_time(header.uid)  # update last seen
-    if not (header.code in openConns[header.uid][CODES]):
+    if not (header.code in openConns[conn][CODES]):
         print("Error: Unexpected opcode, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     if header.size != sizeDict[header.code]:
         print("Error: Bad payload size, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
-    payload = conn.recv(header.size)
+    payload = conn.recv(header.size, socket.MSG_WAITALL)
     if not(db.check_id_file(header.uid, payload)):
         print("Error: Don't own any file with that name, terminating connection", conn)
-        fail_generic(conn, header.uid)
+        fail_generic(conn)
         return
     code = codeDict[header.code]
     h = ServerHeader(code, sizeDict[code])
     packet = struct.pack("<BHI16s", h.ver, h.code, h.size, header.uid)  # generate bytes representation of packet
     conn.send(packet)
-    print("Alert: File CRC mismatched 4 times, client aborted on connection:", conn)
+    print("Alert: File CRC mismatched 4 times, client gave up on it on connection:", conn)
+    next_file(conn)
+    db.write_back()  # update disk db
+
+
+# Next file: reset per file connection state once a file is done so the client may send another one
+def next_file(conn):
+    openConns[conn][CODES] = nextcodeDict[GOOD_CRC]
+    openConns[conn][RETRY] = RETRIES
+    openConns[conn][F_RETRY] = RETRIES
+    openConns[conn][REM] = None
+    openConns[conn][KEY] = None
+    openConns[conn][CIPHER] = None
+    openConns[conn][RESUME_AT] = None
+    openConns[conn][REPAIR] = None
+    openConns[conn][INFLATE] = None
+    openConns[conn][DEDUP] = None
+    openConns[conn][DELTA] = None
+    openConns[conn][F_NAME] = None
+    openConns[conn][PATH] = None
+
+
+# Close connection: forget all protocol state of a connection the client has closed
+def close_conn(conn):
     try:
-        sel.unregister(conn)  # unregister client from open connections monitored by selector
-    except KeyError:
+        sel.unregister(conn)
+    except (KeyError, ValueError):
         pass
-    del openConns[header.uid]  # delete from open connections
-    db.write_back()  # update disk db
+    openConns.pop(conn, None)
+    conn.close()
 
 
 # Fail register: notify client of failure in registering him as a user
@@ -359,8 +974,27 @@ def fail_reconnect(conn):
         pass
 
 
+# Fail ticket: notify client its resumption ticket was refused, it falls back to a regular reconnect
+def fail_ticket(conn):
+    code = TICKET_BAD
+    h = ServerHeader(code, 0)
+    packet = struct.pack("<BHI", h.ver, h.code, h.size)  # generate bytes representation of packet
+    try:  # flush buffer
+        conn.setblocking(False)
+        conn.recv(2 ** 32)
+    except BlockingIOError:
+        pass
+    finally:
+        conn.setblocking(True)
+    conn.send(packet)
+    try:
+        sel.unregister(conn)  # unregister client from open connections monitored by selector
+    except KeyError:
+        pass
+
+
 # Fail generic: notify client of an error not explicitly addressed by other error codes
-def fail_generic(conn, uid):
+def fail_generic(conn):
     code = GENERIC_ERROR
     h = ServerHeader(code, 0)
     packet = struct.pack("<BHI", h.ver, h.code, h.size)  # generate bytes representation of packet
@@ -371,14 +1005,14 @@ def fail_generic(conn, uid):
         pass
     finally:
         conn.setblocking(True)
-    if openConns[uid][RETRY] == 0:
+    if conn not in openConns or openConns[conn][RETRY] == 0:
         try:
             sel.unregister(conn)  # unregister client from open connections monitored by selector
         except KeyError:
             pass
-        del openConns[uid]  # delete from open connections
+        openConns.pop(conn, None)  # delete from open connections
     else:
-        openConns[uid][RETRY] = openConns[uid][RETRY] - 1
+        openConns[conn][RETRY] = openConns[conn][RETRY] - 1
     conn.send(packet)
 
 